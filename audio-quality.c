@@ -0,0 +1,64 @@
+/* Resampler and converter quality profiles. audioresample's quality
+ * goes from 0 to 10 and sets the length of its filter, which is what
+ * the CPU time goes into. The full sinc table costs some memory but
+ * saves interpolating the filter for every sample, so both ends use
+ * it; auto would pick it for the common rates anyway.
+ */
+#include "audio-quality.h"
+
+static const AudioQualityProfile profiles[] = {
+  {"low-cpu", 0, "full", "none", "none"},
+  {"default", 4, "auto", "tpdf", "none"},
+  {"mastering", 10, "full", "tpdf-hf", "high"},
+};
+
+const gchar *audio_quality_profile_names[] = {
+  "low-cpu", "default", "mastering", NULL
+};
+
+const AudioQualityProfile *
+audio_quality_profile_find (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (profiles); i++) {
+    if (g_str_equal (profiles[i].name, name))
+      return &profiles[i];
+  }
+
+  return NULL;
+}
+
+void
+audio_quality_profile_apply (const AudioQualityProfile * profile,
+    GstElement * element)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+
+  if (g_str_equal (name, "audioresample")) {
+    g_object_set (element, "quality", profile->quality, NULL);
+    gst_util_set_object_arg (G_OBJECT (element), "sinc-filter-mode",
+        profile->sinc_filter_mode);
+  } else if (g_str_equal (name, "audioconvert")) {
+    gst_util_set_object_arg (G_OBJECT (element), "dithering",
+        profile->dithering);
+    gst_util_set_object_arg (G_OBJECT (element), "noise-shaping",
+        profile->noise_shaping);
+  }
+}
+
+static void
+deep_element_added (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    const AudioQualityProfile * profile)
+{
+  audio_quality_profile_apply (profile, element);
+}
+
+void
+audio_quality_profile_watch (const AudioQualityProfile * profile,
+    GstElement * bin)
+{
+  g_signal_connect (bin, "deep-element-added",
+      G_CALLBACK (deep_element_added), (gpointer) profile);
+}
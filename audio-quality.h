@@ -0,0 +1,36 @@
+#ifndef __AUDIO_QUALITY_H__
+#define __AUDIO_QUALITY_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Settings for audioresample and audioconvert, from cheapest to best:
+ * low-cpu, default and mastering */
+typedef struct
+{
+  const gchar *name;
+  /* audioresample */
+  gint quality;
+  const gchar *sinc_filter_mode;
+  /* audioconvert */
+  const gchar *dithering;
+  const gchar *noise_shaping;
+} AudioQualityProfile;
+
+const AudioQualityProfile *audio_quality_profile_find (const gchar * name);
+
+/* The profile names, for option help and benchmarks, NULL terminated */
+extern const gchar *audio_quality_profile_names[];
+
+/* Set up @element if it's an audioresample or audioconvert */
+void audio_quality_profile_apply (const AudioQualityProfile * profile,
+    GstElement * element);
+
+/* Apply to every audioresample and audioconvert that gets added to
+ * @bin, or any bin inside it, like the ones playbin makes */
+void audio_quality_profile_watch (const AudioQualityProfile * profile,
+    GstElement * bin);
+
+G_END_DECLS
+#endif /* __AUDIO_QUALITY_H__ */
@@ -0,0 +1,517 @@
+/* Convert lots of short Ogg/Vorbis clips to Opus or AAC. Each worker
+ * thread builds its pipeline once and reuses it for file after file,
+ * only going back to READY in between, so the cost of making elements
+ * and plugging them together isn't paid per clip. Files are dealt out
+ * to the workers up front; a worker that runs out takes files from the
+ * back of the longest other queue.
+ *
+ *   ./batch-transcode -f opus -o out clips/
+ *   ./batch-transcode --compare clips/
+ *
+ * Every clip goes to out_dir/<name>.<ext>. Clips with the same name
+ * from different directories get a number added, rather than being
+ * written over each other.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+static gint jobs = 0;
+static gchar *format = NULL;
+static gchar *encoder = NULL;
+static gchar *out_dir = NULL;
+static gboolean compare = FALSE;
+
+static GOptionEntry opt_entries[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of pipelines to run at once (default: number of CPUs)", "N"},
+  {"format", 'f', 0, G_OPTION_ARG_STRING, &format,
+      "Output format: opus (default) or aac", "FORMAT"},
+  {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder,
+      "Encoder (default: opusenc or avenc_aac)", "DESC"},
+  {"output", 'o', 0, G_OPTION_ARG_FILENAME, &out_dir,
+      "Directory to write to (default: transcoded)", "DIR"},
+  {"compare", 'c', 0, G_OPTION_ARG_NONE, &compare,
+      "Also run with a new pipeline for every file, and compare", NULL},
+  {NULL}
+};
+
+typedef struct _Batch Batch;
+
+typedef struct
+{
+  gchar *in;
+  gchar *out;
+} Clip;
+
+typedef struct
+{
+  Batch *batch;
+  GThread *thread;
+
+  /* Clips still to do, taken from the head by this worker and from the
+   * tail by the others */
+  GMutex lock;
+  GQueue files;
+
+  GstElement *pipeline;
+  GstElement *src;
+  GstElement *sink;
+  GstPad *chain_pad;
+
+  /* The file being done */
+  gint64 started;
+  gint64 first_audio;
+
+  /* Statistics */
+  guint done;
+  guint failed;
+  guint stolen;
+  gint64 setup_time;
+  gint64 total_time;
+} Worker;
+
+struct _Batch
+{
+  Worker *workers;
+  guint n_workers;
+  const gchar *encoder;
+  const gchar *mux;
+  const gchar *extension;
+  gboolean reuse;
+};
+
+static gdouble
+seconds_since (gint64 start)
+{
+  return (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+}
+
+static GstElement *
+create_element (const gchar * type, const gchar * name)
+{
+  GstElement *e;
+
+  e = gst_element_factory_make (type, name);
+  if (!e) {
+    g_print ("Failed to create element %s\n", type);
+    exit (1);
+  }
+
+  return e;
+}
+
+/* Once there's decoded audio, the pipeline is set up for this file */
+static GstPadProbeReturn
+first_audio_probe (GstPad * pad, GstPadProbeInfo * info, Worker * w)
+{
+  if (w->first_audio == 0)
+    w->first_audio = g_get_monotonic_time ();
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* oggdemux makes new pads for every file, link the Vorbis one each
+ * time. A pipeline from gst_parse_launch() would only do it once */
+static void
+demux_pad_added (GstElement * demux, GstPad * pad, Worker * w)
+{
+  GstCaps *caps = gst_pad_query_caps (pad, NULL);
+
+  if (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          "audio/x-vorbis") && !gst_pad_is_linked (w->chain_pad))
+    gst_pad_link (pad, w->chain_pad);
+  gst_caps_unref (caps);
+}
+
+static void
+create_pipeline (Worker * w)
+{
+  Batch *batch = w->batch;
+  GstElement *demux, *chain, *dec;
+  GError *err = NULL;
+  GstPad *pad;
+  gchar *desc;
+
+  w->pipeline = gst_pipeline_new (NULL);
+  w->src = create_element ("filesrc", NULL);
+  demux = create_element ("oggdemux", NULL);
+
+  desc = g_strdup_printf ("vorbisdec name=dec ! audioconvert ! "
+      "audioresample ! %s ! %s ! filesink name=sink", batch->encoder,
+      batch->mux);
+  chain = gst_parse_bin_from_description (desc, TRUE, &err);
+  g_free (desc);
+  if (chain == NULL) {
+    g_print ("Failed to create pipeline: %s\n", err->message);
+    exit (1);
+  }
+
+  gst_bin_add_many (GST_BIN (w->pipeline), w->src, demux, chain, NULL);
+  gst_element_link (w->src, demux);
+  w->chain_pad = gst_element_get_static_pad (chain, "sink");
+  g_signal_connect (demux, "pad-added", G_CALLBACK (demux_pad_added), w);
+
+  w->sink = gst_bin_get_by_name (GST_BIN (chain), "sink");
+  dec = gst_bin_get_by_name (GST_BIN (chain), "dec");
+  pad = gst_element_get_static_pad (dec, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) first_audio_probe, w, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (dec);
+}
+
+static void
+free_pipeline (Worker * w)
+{
+  gst_element_set_state (w->pipeline, GST_STATE_NULL);
+  gst_object_unref (w->chain_pad);
+  gst_object_unref (w->sink);
+  gst_object_unref (w->pipeline);
+  w->pipeline = NULL;
+}
+
+static gboolean
+transcode (Worker * w, const gchar * in, const gchar * out)
+{
+  GstMessage *msg;
+  GstBus *bus;
+  gboolean ok;
+
+  w->started = g_get_monotonic_time ();
+  w->first_audio = 0;
+  if (w->pipeline == NULL)
+    create_pipeline (w);
+
+  /* Both can change in READY */
+  g_object_set (w->src, "location", in, NULL);
+  g_object_set (w->sink, "location", out, NULL);
+
+  gst_element_set_state (w->pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (w->pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  if (!ok) {
+    GError *err = NULL;
+
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("%s: %s\n", in, err->message);
+    g_error_free (err);
+  }
+  gst_message_unref (msg);
+
+  /* READY closes the files and forgets the streams, but keeps the
+   * elements. The bus only gets flushed going to NULL, so drop what's
+   * left on it, like more errors, or the next file would get them.
+   * After an error, who knows what state the elements are in, start
+   * again with new ones */
+  if (w->batch->reuse && ok) {
+    gst_element_set_state (w->pipeline, GST_STATE_READY);
+    gst_bus_set_flushing (bus, TRUE);
+    gst_bus_set_flushing (bus, FALSE);
+  } else {
+    free_pipeline (w);
+  }
+  gst_object_unref (bus);
+
+  if (w->first_audio)
+    w->setup_time += w->first_audio - w->started;
+  w->total_time += g_get_monotonic_time () - w->started;
+
+  return ok;
+}
+
+/* Our own clips first, then the last one of whoever has most left */
+static Clip *
+next_clip (Worker * w)
+{
+  Batch *batch = w->batch;
+  Worker *victim;
+  Clip *clip;
+  guint i, longest;
+
+  g_mutex_lock (&w->lock);
+  clip = g_queue_pop_head (&w->files);
+  g_mutex_unlock (&w->lock);
+
+  while (clip == NULL) {
+    victim = NULL;
+    longest = 0;
+    for (i = 0; i < batch->n_workers; i++) {
+      Worker *other = &batch->workers[i];
+      guint len;
+
+      if (other == w)
+        continue;
+      g_mutex_lock (&other->lock);
+      len = other->files.length;
+      g_mutex_unlock (&other->lock);
+      if (len > longest) {
+        longest = len;
+        victim = other;
+      }
+    }
+    if (victim == NULL)
+      return NULL;
+
+    /* It may have emptied in the meantime, then look again */
+    g_mutex_lock (&victim->lock);
+    clip = g_queue_pop_tail (&victim->files);
+    g_mutex_unlock (&victim->lock);
+    if (clip)
+      w->stolen++;
+  }
+
+  return clip;
+}
+
+static gpointer
+worker_thread (Worker * w)
+{
+  Clip *clip;
+
+  while ((clip = next_clip (w))) {
+    if (transcode (w, clip->in, clip->out))
+      w->done++;
+    else
+      w->failed++;
+  }
+
+  if (w->pipeline)
+    free_pipeline (w);
+
+  return NULL;
+}
+
+/* Returns the files per second */
+static gdouble
+run_batch (Batch * batch, GArray * clips)
+{
+  guint i, done = 0, failed = 0, stolen = 0;
+  gint64 setup_time = 0, total_time = 0, start;
+  gdouble seconds;
+
+  batch->workers = g_new0 (Worker, batch->n_workers);
+  for (i = 0; i < batch->n_workers; i++) {
+    batch->workers[i].batch = batch;
+    g_mutex_init (&batch->workers[i].lock);
+    g_queue_init (&batch->workers[i].files);
+  }
+  for (i = 0; i < clips->len; i++)
+    g_queue_push_tail (&batch->workers[i % batch->n_workers].files,
+        &g_array_index (clips, Clip, i));
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < batch->n_workers; i++)
+    batch->workers[i].thread = g_thread_new (NULL,
+        (GThreadFunc) worker_thread, &batch->workers[i]);
+  for (i = 0; i < batch->n_workers; i++)
+    g_thread_join (batch->workers[i].thread);
+  seconds = seconds_since (start);
+
+  for (i = 0; i < batch->n_workers; i++) {
+    Worker *w = &batch->workers[i];
+
+    done += w->done;
+    failed += w->failed;
+    stolen += w->stolen;
+    setup_time += w->setup_time;
+    total_time += w->total_time;
+    g_mutex_clear (&w->lock);
+  }
+  g_free (batch->workers);
+  batch->workers = NULL;
+
+  g_print ("%s: %u files (%u failed) in %.2f s on %u pipelines, "
+      "%.1f files/s\n", batch->reuse ? "Reused pipelines" : "New pipelines",
+      done, failed, seconds, batch->n_workers, (done + failed) / seconds);
+  if (done + failed > 0)
+    g_print ("  per file %.1f ms, of which %.1f ms setup until decoded "
+        "audio came out, %u files taken from other queues\n",
+        total_time / 1000.0 / (done + failed),
+        setup_time / 1000.0 / (done + failed), stolen);
+
+  return (done + failed) / seconds;
+}
+
+/* The same file given twice, or by two different paths, is only
+ * transcoded once */
+static void
+add_file (GPtrArray * files, GHashTable * seen, const gchar * path)
+{
+  gchar *canonical = g_canonicalize_filename (path, NULL);
+
+  if (g_hash_table_add (seen, canonical))
+    g_ptr_array_add (files, g_strdup (path));
+  else
+    g_print ("Skipping %s, it's already in the list\n", path);
+}
+
+static void
+add_files (GPtrArray * files, GHashTable * seen, const gchar * path)
+{
+  const gchar *name;
+  GDir *dir;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+    add_file (files, seen, path);
+    return;
+  }
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child = g_build_filename (path, name, NULL);
+    gchar *lower = g_ascii_strdown (name, -1);
+
+    if (g_file_test (child, G_FILE_TEST_IS_DIR))
+      add_files (files, seen, child);
+    else if (g_str_has_suffix (lower, ".ogg") ||
+        g_str_has_suffix (lower, ".oga"))
+      add_file (files, seen, child);
+    g_free (lower);
+    g_free (child);
+  }
+  g_dir_close (dir);
+}
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Picks an output file for every input up front, so no two workers
+ * ever write to the same one. The second x.ogg becomes x-2.opus */
+static GArray *
+make_clips (GPtrArray * files, const gchar * extension)
+{
+  GHashTable *taken = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  GArray *clips = g_array_sized_new (FALSE, FALSE, sizeof (Clip),
+      files->len);
+  guint i, n;
+
+  for (i = 0; i < files->len; i++) {
+    Clip clip;
+    gchar *base, *dot, *name;
+
+    clip.in = g_strdup (g_ptr_array_index (files, i));
+    base = g_path_get_basename (clip.in);
+    dot = strrchr (base, '.');
+    if (dot)
+      *dot = '\0';
+
+    name = g_strdup_printf ("%s.%s", base, extension);
+    for (n = 2; g_hash_table_contains (taken, name); n++) {
+      g_free (name);
+      name = g_strdup_printf ("%s-%u.%s", base, n, extension);
+    }
+    if (n > 2)
+      g_print ("%s goes to %s, the name was taken\n", clip.in, name);
+
+    clip.out = g_build_filename (out_dir, name, NULL);
+    g_hash_table_add (taken, name);
+    g_array_append_val (clips, clip);
+    g_free (base);
+  }
+  g_hash_table_unref (taken);
+
+  return clips;
+}
+
+static void
+free_clips (GArray * clips)
+{
+  guint i;
+
+  for (i = 0; i < clips->len; i++) {
+    g_free (g_array_index (clips, Clip, i).in);
+    g_free (g_array_index (clips, Clip, i).out);
+  }
+  g_array_free (clips, TRUE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  GPtrArray *files;
+  GHashTable *seen;
+  GArray *clips;
+  Batch batch = { 0, };
+  gdouble reused_rate;
+  gint i;
+
+  opt_ctx = g_option_context_new ("<file|directory> ... - Transcode "
+      "Ogg/Vorbis clips");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (argc < 2) {
+    g_print ("Usage: %s [-f opus|aac] [-j jobs] [-o dir] [--compare] "
+        "<file|directory> ...\n", argv[0]);
+    return 1;
+  }
+
+  if (format == NULL || g_str_equal (format, "opus")) {
+    batch.encoder = encoder ? encoder : "opusenc";
+    batch.mux = "oggmux";
+    batch.extension = "opus";
+  } else if (g_str_equal (format, "aac")) {
+    batch.encoder = encoder ? encoder : "avenc_aac";
+    batch.mux = "mp4mux";
+    batch.extension = "m4a";
+  } else {
+    g_print ("Unknown format %s\n", format);
+    return 1;
+  }
+  if (out_dir == NULL)
+    out_dir = g_strdup ("transcoded");
+  g_mkdir_with_parents (out_dir, 0755);
+
+  files = g_ptr_array_new_with_free_func (g_free);
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (i = 1; i < argc; i++)
+    add_files (files, seen, argv[i]);
+  g_hash_table_unref (seen);
+  g_ptr_array_sort (files, compare_paths);
+  if (files->len == 0) {
+    g_print ("No Ogg files found\n");
+    return 1;
+  }
+  clips = make_clips (files, batch.extension);
+  g_ptr_array_free (files, TRUE);
+
+  batch.n_workers = jobs > 0 ? jobs : g_get_num_processors ();
+  batch.n_workers = MIN (batch.n_workers, clips->len);
+
+  batch.reuse = TRUE;
+  reused_rate = run_batch (&batch, clips);
+
+  if (compare) {
+    gdouble new_rate;
+
+    batch.reuse = FALSE;
+    new_rate = run_batch (&batch, clips);
+    g_print ("Reusing pipelines: %.2fx the files/s\n",
+        reused_rate / new_rate);
+  }
+
+  free_clips (clips);
+  g_free (format);
+  g_free (encoder);
+  g_free (out_dir);
+
+  return 0;
+}
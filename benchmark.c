@@ -0,0 +1,601 @@
+/* Repeatable performance numbers for the tools in this repository, all
+ * headless and in one process:
+ *
+ *   decode     frames/s and speed vs real time through playbin
+ *   seek       latency of flushing keyframe seeks in a paused playbin
+ *   rtsp       time for several clients to get an RTSP session playing
+ *              from the test-rtsp-uri style server
+ *   sync       how far a network client clock is from the master
+ *   pipeline   wall time of the command-lines.txt pipelines, with fake
+ *              sinks and a fixed number of buffers
+ *
+ * Each measurement runs several times and the median counts. The results
+ * go to a JSON file, and are compared with a baseline from an earlier
+ * run: anything more than --threshold percent worse fails the run.
+ *
+ *   ./benchmark -o bench-results.json -b bench-baseline.json
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <gst/gst.h>
+#include <gst/net/net.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <json-glib/json-glib.h>
+
+#define N_SEEKS 10
+#define N_RTSP_CLIENTS 4
+#define SYNC_SAMPLES 50
+
+static gint repeat = 7;
+static gdouble threshold = 20.0;
+static gchar *output = NULL;
+static gchar *baseline = NULL;
+static gchar *only = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"repeat", 'r', 0, G_OPTION_ARG_INT, &repeat,
+      "Runs of each measurement, the median counts (default: 7)", "N"},
+  {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+      "Write the results here (default: bench-results.json)", "FILE"},
+  {"baseline", 'b', 0, G_OPTION_ARG_FILENAME, &baseline,
+      "Compare with the results in this file", "FILE"},
+  {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold,
+      "Fail on results this many percent worse than the baseline "
+        "(default: 20)", "PERCENT"},
+  {"only", 0, 0, G_OPTION_ARG_STRING, &only,
+      "Only the results whose name starts with this, like "
+        "decode.cooldance.ogg", "PREFIX"},
+  {NULL}
+};
+
+static const gchar *media[] = {
+  "big-buck-bunny_trailer.webm",
+  "cooldance.ogg",
+};
+
+/* The pipelines from command-lines.txt, made to end by themselves and
+ * render nowhere */
+static const struct
+{
+  const gchar *name;
+  const gchar *desc;
+} pipelines[] = {
+  {"audiotestsrc", "audiotestsrc num-buffers=2000 ! audioconvert ! "
+        "fakesink"},
+  {"videotestsrc", "videotestsrc num-buffers=500 ! videoconvert ! "
+        "fakesink"},
+  {"oggdemux", "filesrc location=cooldance.ogg ! oggdemux name=d "
+        "d. ! queue ! vorbisdec ! audioconvert ! audioresample ! "
+        "fakesink sync=false d. ! queue ! theoradec ! videoconvert ! "
+        "videoscale ! fakesink sync=false"},
+  {"x264-mp4", "videotestsrc num-buffers=300 ! videoconvert ! x264enc ! "
+        "mp4mux ! fakesink"},
+  {"mpeg2-rtp", "videotestsrc num-buffers=300 ! avenc_mpeg2video ! "
+        "mpegvideoparse ! rtpmpvpay ! fakesink"},
+};
+
+typedef struct
+{
+  JsonBuilder *results;
+  guint n_results;
+} BenchData;
+
+/* --only matches result names. A measurement is needed if any of its
+ * results, which all start with @prefix, could match */
+static gboolean
+wanted (const gchar * prefix)
+{
+  return only == NULL || g_str_has_prefix (prefix, only) ||
+      g_str_has_prefix (only, prefix);
+}
+
+static gint
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Median of the runs that worked, or a negative number if none did */
+static gdouble
+median (GArray * runs)
+{
+  gdouble m;
+
+  if (runs->len == 0)
+    return -1.0;
+
+  g_array_sort (runs, compare_doubles);
+  m = g_array_index (runs, gdouble, runs->len / 2);
+  if (runs->len % 2 == 0)
+    m = (m + g_array_index (runs, gdouble, runs->len / 2 - 1)) / 2;
+
+  return m;
+}
+
+static void
+add_result (BenchData * data, const gchar * name, gdouble value,
+    const gchar * unit, gboolean higher_is_better)
+{
+  /* The other results of a measurement --only asked for */
+  if (only && !g_str_has_prefix (name, only))
+    return;
+
+  if (value < 0) {
+    g_print ("  %-40s failed\n", name);
+    return;
+  }
+
+  g_print ("  %-40s %10.2f %s\n", name, value, unit);
+
+  json_builder_set_member_name (data->results, name);
+  json_builder_begin_object (data->results);
+  json_builder_set_member_name (data->results, "value");
+  json_builder_add_double_value (data->results, value);
+  json_builder_set_member_name (data->results, "unit");
+  json_builder_add_string_value (data->results, unit);
+  json_builder_set_member_name (data->results, "better");
+  json_builder_add_string_value (data->results,
+      higher_is_better ? "higher" : "lower");
+  json_builder_end_object (data->results);
+  data->n_results++;
+}
+
+static GstElement *
+create_playbin (const gchar * uri, gboolean sync)
+{
+  GstElement *playbin, *vsink, *asink;
+
+  playbin = gst_element_factory_make ("playbin", NULL);
+  vsink = gst_element_factory_make ("fakesink", NULL);
+  asink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (vsink, "sync", sync, NULL);
+  g_object_set (asink, "sync", sync, NULL);
+  g_object_set (playbin, "uri", uri, "video-sink", vsink, "audio-sink",
+      asink, NULL);
+
+  return playbin;
+}
+
+/* Wait for one of @types, and say whether that's what came */
+static gboolean
+wait_for (GstElement * pipeline, GstMessageType types, GstClockTime timeout)
+{
+  GstMessage *msg;
+  GstBus *bus;
+  gboolean ok;
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, timeout, types | GST_MESSAGE_ERROR);
+  gst_object_unref (bus);
+  if (msg == NULL)
+    return FALSE;
+
+  ok = GST_MESSAGE_TYPE (msg) != GST_MESSAGE_ERROR;
+  gst_message_unref (msg);
+
+  return ok;
+}
+
+static GstPadProbeReturn
+count_probe (GstPad * pad, GstPadProbeInfo * info, guint * count)
+{
+  (*count)++;
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+bench_decode (BenchData * data, const gchar * file)
+{
+  GArray *fps = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  GArray *speed = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  gchar *uri = gst_filename_to_uri (file, NULL), *name;
+  gint i;
+
+  for (i = 0; i < repeat; i++) {
+    GstElement *playbin = create_playbin (uri, FALSE), *vsink;
+    GstPad *pad;
+    gint64 begin, duration = 0;
+    guint frames = 0;
+    gdouble seconds, v;
+
+    g_object_get (playbin, "video-sink", &vsink, NULL);
+    pad = gst_element_get_static_pad (vsink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) count_probe, &frames, NULL);
+    gst_object_unref (pad);
+    gst_object_unref (vsink);
+
+    begin = g_get_monotonic_time ();
+    gst_element_set_state (playbin, GST_STATE_PLAYING);
+    if (wait_for (playbin, GST_MESSAGE_EOS, 120 * GST_SECOND)) {
+      seconds = (g_get_monotonic_time () - begin) / (gdouble) G_USEC_PER_SEC;
+      gst_element_query_duration (playbin, GST_FORMAT_TIME, &duration);
+      v = frames / seconds;
+      g_array_append_val (fps, v);
+      v = (gdouble) duration / GST_SECOND / seconds;
+      g_array_append_val (speed, v);
+    }
+    gst_element_set_state (playbin, GST_STATE_NULL);
+    gst_object_unref (playbin);
+  }
+
+  name = g_strdup_printf ("decode.%s.fps", file);
+  add_result (data, name, median (fps), "frames/s", TRUE);
+  g_free (name);
+  name = g_strdup_printf ("decode.%s.realtime", file);
+  add_result (data, name, median (speed), "x", TRUE);
+  g_free (name);
+
+  g_array_free (fps, TRUE);
+  g_array_free (speed, TRUE);
+  g_free (uri);
+}
+
+static void
+bench_seek (BenchData * data, const gchar * file)
+{
+  GArray *latency = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  gchar *uri = gst_filename_to_uri (file, NULL), *name;
+  gint i, j;
+
+  for (i = 0; i < repeat; i++) {
+    GstElement *playbin = create_playbin (uri, TRUE);
+    gint64 duration = 0, begin;
+    gdouble total = 0;
+    gboolean ok;
+
+    gst_element_set_state (playbin, GST_STATE_PAUSED);
+    ok = wait_for (playbin, GST_MESSAGE_ASYNC_DONE, 30 * GST_SECOND) &&
+        gst_element_query_duration (playbin, GST_FORMAT_TIME, &duration) &&
+        duration > 0;
+
+    /* Spread over the file, not in order, so nothing is cached nearby */
+    for (j = 0; ok && j < N_SEEKS; j++) {
+      gint64 position = duration * ((j * 7) % N_SEEKS) / N_SEEKS;
+
+      begin = g_get_monotonic_time ();
+      gst_element_seek_simple (playbin, GST_FORMAT_TIME,
+          GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, position);
+      ok = wait_for (playbin, GST_MESSAGE_ASYNC_DONE, 30 * GST_SECOND);
+      total += (g_get_monotonic_time () - begin) / 1000.0;
+    }
+    if (ok) {
+      total /= N_SEEKS;
+      g_array_append_val (latency, total);
+    }
+
+    gst_element_set_state (playbin, GST_STATE_NULL);
+    gst_object_unref (playbin);
+  }
+
+  name = g_strdup_printf ("seek.%s.latency", file);
+  add_result (data, name, median (latency), "ms", FALSE);
+  g_free (name);
+
+  g_array_free (latency, TRUE);
+  g_free (uri);
+}
+
+static gpointer
+server_thread (GMainLoop * loop)
+{
+  g_main_context_push_thread_default (g_main_loop_get_context (loop));
+  g_main_loop_run (loop);
+  g_main_context_pop_thread_default (g_main_loop_get_context (loop));
+
+  return NULL;
+}
+
+/* Several clients at once against a shared media, like test-rtsp-uri
+ * serves it, until each has prerolled */
+static void
+bench_rtsp (BenchData * data)
+{
+  GArray *setup = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  GstRTSPServer *server;
+  GstRTSPMountPoints *mounts;
+  GstRTSPMediaFactoryURI *factory;
+  GMainContext *ctx;
+  GMainLoop *loop;
+  GThread *thread;
+  gchar *uri;
+  gint i, j, port;
+
+  server = gst_rtsp_server_new ();
+  gst_rtsp_server_set_service (server, "0");
+  mounts = gst_rtsp_server_get_mount_points (server);
+  factory = gst_rtsp_media_factory_uri_new ();
+  uri = gst_filename_to_uri ("cooldance.ogg", NULL);
+  gst_rtsp_media_factory_uri_set_uri (factory, uri);
+  g_free (uri);
+  gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (factory), TRUE);
+  gst_rtsp_mount_points_add_factory (mounts, "/bench",
+      GST_RTSP_MEDIA_FACTORY (factory));
+  g_object_unref (mounts);
+
+  ctx = g_main_context_new ();
+  loop = g_main_loop_new (ctx, FALSE);
+  if (gst_rtsp_server_attach (server, ctx) == 0) {
+    add_result (data, "rtsp.setup", -1.0, "ms", FALSE);
+    goto out;
+  }
+  port = gst_rtsp_server_get_bound_port (server);
+  thread = g_thread_new ("rtsp-server", (GThreadFunc) server_thread, loop);
+
+  uri = g_strdup_printf ("rtsp://127.0.0.1:%d/bench", port);
+  for (i = 0; i < repeat; i++) {
+    GstElement *clients[N_RTSP_CLIENTS];
+    GstClockTime begin = gst_util_get_timestamp ();
+    gdouble total = 0;
+    gboolean ok = TRUE;
+
+    for (j = 0; j < N_RTSP_CLIENTS; j++) {
+      clients[j] = create_playbin (uri, TRUE);
+      gst_element_set_state (clients[j], GST_STATE_PLAYING);
+    }
+
+    /* The message timestamps say when each client got there */
+    for (j = 0; j < N_RTSP_CLIENTS; j++) {
+      GstBus *bus = gst_element_get_bus (clients[j]);
+      GstMessage *msg = gst_bus_timed_pop_filtered (bus, 30 * GST_SECOND,
+          GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+
+      if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE)
+        total += (gdouble) (GST_MESSAGE_TIMESTAMP (msg) - begin) /
+            GST_MSECOND;
+      else
+        ok = FALSE;
+      if (msg)
+        gst_message_unref (msg);
+      gst_object_unref (bus);
+    }
+    if (ok) {
+      total /= N_RTSP_CLIENTS;
+      g_array_append_val (setup, total);
+    }
+
+    for (j = 0; j < N_RTSP_CLIENTS; j++) {
+      gst_element_set_state (clients[j], GST_STATE_NULL);
+      gst_object_unref (clients[j]);
+    }
+  }
+  g_free (uri);
+
+  add_result (data, "rtsp.setup", median (setup), "ms", FALSE);
+
+  g_main_loop_quit (loop);
+  g_thread_join (thread);
+
+out:
+  g_main_loop_unref (loop);
+  g_main_context_unref (ctx);
+  g_object_unref (server);
+  g_array_free (setup, TRUE);
+}
+
+/* playback-sync keeps a group in step through network clocks, so the
+ * spread across the group can't be better than how closely each one
+ * follows the master. Measure that over loopback */
+static void
+bench_sync (BenchData * data)
+{
+  GArray *mean_error = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  GArray *max_error = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  GstClock *master = gst_system_clock_obtain ();
+  GstNetTimeProvider *provider;
+  gint i, j, port;
+
+  provider = gst_net_time_provider_new (master, "127.0.0.1", 0);
+  g_object_get (provider, "port", &port, NULL);
+
+  for (i = 0; i < repeat; i++) {
+    GstClock *client;
+    gdouble sum = 0, max = 0;
+
+    client = gst_net_client_clock_new (NULL, "127.0.0.1", port, 0);
+    if (!gst_clock_wait_for_sync (client, 10 * GST_SECOND)) {
+      gst_object_unref (client);
+      continue;
+    }
+
+    for (j = 0; j < SYNC_SAMPLES; j++) {
+      GstClockTimeDiff error;
+
+      g_usleep (100 * 1000);
+      error = GST_CLOCK_DIFF (gst_clock_get_time (master),
+          gst_clock_get_time (client));
+      sum += ABS (error) / 1000.0;
+      max = MAX (max, ABS (error) / 1000.0);
+    }
+    sum /= SYNC_SAMPLES;
+    g_array_append_val (mean_error, sum);
+    g_array_append_val (max_error, max);
+    gst_object_unref (client);
+  }
+
+  add_result (data, "sync.clock-error-mean", median (mean_error), "us",
+      FALSE);
+  add_result (data, "sync.clock-error-max", median (max_error), "us", FALSE);
+
+  gst_object_unref (provider);
+  gst_object_unref (master);
+  g_array_free (mean_error, TRUE);
+  g_array_free (max_error, TRUE);
+}
+
+static void
+bench_pipeline (BenchData * data, const gchar * pipeline_name,
+    const gchar * desc)
+{
+  GArray *wall = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  gchar *name;
+  gint i;
+
+  for (i = 0; i < repeat; i++) {
+    GstElement *pipeline;
+    gint64 begin;
+    gdouble ms;
+
+    /* A missing plugin just means no number for this one */
+    pipeline = gst_parse_launch (desc, NULL);
+    if (pipeline == NULL)
+      break;
+
+    begin = g_get_monotonic_time ();
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    if (wait_for (pipeline, GST_MESSAGE_EOS, 120 * GST_SECOND)) {
+      ms = (g_get_monotonic_time () - begin) / 1000.0;
+      g_array_append_val (wall, ms);
+    }
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+  }
+
+  name = g_strdup_printf ("pipeline.%s", pipeline_name);
+  add_result (data, name, median (wall), "ms", FALSE);
+  g_free (name);
+  g_array_free (wall, TRUE);
+}
+
+/* Returns the number of regressions */
+static guint
+compare_baseline (JsonNode * results, const gchar * path)
+{
+  JsonParser *parser = json_parser_new ();
+  JsonObject *old, *new;
+  GList *names, *l;
+  GError *err = NULL;
+  guint regressions = 0;
+
+  if (!json_parser_load_from_file (parser, path, &err)) {
+    g_print ("No usable baseline in %s (%s), not comparing\n", path,
+        err->message);
+    g_error_free (err);
+    g_object_unref (parser);
+    return 0;
+  }
+
+  old = json_object_get_object_member (json_node_get_object
+      (json_parser_get_root (parser)), "results");
+  new = json_object_get_object_member (json_node_get_object (results),
+      "results");
+
+  g_print ("\nCompared with %s (threshold %.1f%%):\n", path, threshold);
+  names = json_object_get_members (new);
+  for (l = names; l; l = l->next) {
+    const gchar *name = l->data;
+    JsonObject *o, *n;
+    gdouble before, after, change;
+    gboolean higher, worse;
+
+    n = json_object_get_object_member (new, name);
+    if (old == NULL || !json_object_has_member (old, name)) {
+      g_print ("  %-40s new\n", name);
+      continue;
+    }
+    o = json_object_get_object_member (old, name);
+    before = json_object_get_double_member (o, "value");
+    after = json_object_get_double_member (n, "value");
+    higher = g_str_equal (json_object_get_string_member (n, "better"),
+        "higher");
+    if (before == 0)
+      continue;
+
+    change = (after - before) / before * 100;
+    worse = higher ? change < -threshold : change > threshold;
+    if (worse)
+      regressions++;
+    g_print ("  %-40s %10.2f -> %10.2f  %+6.1f%%%s\n", name, before, after,
+        change, worse ? "  REGRESSION" : "");
+  }
+  g_list_free (names);
+  g_object_unref (parser);
+
+  return regressions;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  BenchData data = { 0, };
+  JsonGenerator *gen;
+  JsonNode *root;
+  guint i, regressions = 0;
+
+  opt_ctx = g_option_context_new ("- Benchmark the tutorial tools");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (output == NULL)
+    output = g_strdup ("bench-results.json");
+  repeat = MAX (repeat, 1);
+
+  data.results = json_builder_new ();
+  json_builder_begin_object (data.results);
+  json_builder_set_member_name (data.results, "repeat");
+  json_builder_add_int_value (data.results, repeat);
+  json_builder_set_member_name (data.results, "results");
+  json_builder_begin_object (data.results);
+
+  g_print ("Median of %d runs:\n", repeat);
+  for (i = 0; i < G_N_ELEMENTS (media); i++) {
+    gchar *prefix;
+
+    prefix = g_strdup_printf ("decode.%s.", media[i]);
+    if (wanted (prefix))
+      bench_decode (&data, media[i]);
+    g_free (prefix);
+    prefix = g_strdup_printf ("seek.%s.", media[i]);
+    if (wanted (prefix))
+      bench_seek (&data, media[i]);
+    g_free (prefix);
+  }
+  if (wanted ("rtsp.setup"))
+    bench_rtsp (&data);
+  if (wanted ("sync."))
+    bench_sync (&data);
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    gchar *name = g_strdup_printf ("pipeline.%s", pipelines[i].name);
+
+    if (wanted (name))
+      bench_pipeline (&data, pipelines[i].name, pipelines[i].desc);
+    g_free (name);
+  }
+
+  json_builder_end_object (data.results);
+  json_builder_end_object (data.results);
+  root = json_builder_get_root (data.results);
+
+  gen = json_generator_new ();
+  json_generator_set_pretty (gen, TRUE);
+  json_generator_set_root (gen, root);
+  if (!json_generator_to_file (gen, output, &err)) {
+    g_printerr ("Could not write %s: %s\n", output, err->message);
+    return 1;
+  }
+  g_object_unref (gen);
+  g_print ("Results written to %s\n", output);
+
+  if (baseline)
+    regressions = compare_baseline (root, baseline);
+
+  json_node_unref (root);
+  g_object_unref (data.results);
+
+  if (regressions) {
+    g_print ("%u regression%s of more than %.1f%%\n", regressions,
+        regressions == 1 ? "" : "s", threshold);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,157 @@
+/* Frames per second of the convolve element from plugin/ at 720p and
+ * 1080p, for every instruction set this CPU has, on one thread and on
+ * all of them. Only the time spent inside the element counts, not
+ * making the test frames.
+ *
+ *   GST_PLUGIN_PATH=plugin ./convolve-bench -e sobel
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <gst/gst.h>
+
+static gint num_frames = 200;
+static gchar *effect = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"num-frames", 'n', 0, G_OPTION_ARG_INT, &num_frames,
+      "Frames per run (default: 200)", "N"},
+  {"effect", 'e', 0, G_OPTION_ARG_STRING, &effect,
+      "Effect to measure (default: sobel)", "NAME"},
+  {NULL}
+};
+
+static const struct
+{
+  const gchar *name;
+  gint width;
+  gint height;
+} sizes[] = {
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1080},
+};
+
+static const gchar *implementations[] = { "scalar", "sse2", "avx2", "neon" };
+
+typedef struct
+{
+  gint64 entered;
+  gint64 total;
+  guint frames;
+} FilterTime;
+
+static GstPadProbeReturn
+filter_in_probe (GstPad * pad, GstPadProbeInfo * info, FilterTime * t)
+{
+  t->entered = g_get_monotonic_time ();
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+filter_out_probe (GstPad * pad, GstPadProbeInfo * info, FilterTime * t)
+{
+  t->total += g_get_monotonic_time () - t->entered;
+  t->frames++;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Returns the frames per second, or a negative number if the element
+ * can't run this way here */
+static gdouble
+run (gint width, gint height, const gchar * impl, guint threads)
+{
+  GstElement *pipeline, *filter;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  GError *err = NULL;
+  FilterTime t = { 0, };
+  gchar *desc;
+  gboolean ok;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d pattern=smpte ! "
+      "video/x-raw,format=I420,width=%d,height=%d ! convolve name=f "
+      "effect=%s implementation=%s threads=%u ! fakesink", num_frames,
+      width, height, effect, impl, threads);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (pipeline == NULL) {
+    g_printerr ("Could not create pipeline: %s\n", err->message);
+    g_printerr ("Is GST_PLUGIN_PATH pointing at the plugin directory?\n");
+    exit (1);
+  }
+
+  /* The filter runs between these two on the streaming thread */
+  filter = gst_bin_get_by_name (GST_BIN (pipeline), "f");
+  pad = gst_element_get_static_pad (filter, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) filter_in_probe, &t, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (filter, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) filter_out_probe, &t, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (filter);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (!ok || t.frames == 0 || t.total == 0)
+    return -1.0;
+
+  return t.frames * (gdouble) G_USEC_PER_SEC / t.total;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  guint threads[2] = { 1, 0 };
+  guint s, i, j;
+
+  opt_ctx = g_option_context_new ("- Benchmark the convolve element");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (effect == NULL)
+    effect = g_strdup ("sobel");
+  threads[1] = g_get_num_processors ();
+
+  g_print ("%s, %d frames per run, %u CPUs\n", effect, num_frames,
+      threads[1]);
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++) {
+    for (i = 0; i < G_N_ELEMENTS (implementations); i++) {
+      for (j = 0; j < G_N_ELEMENTS (threads); j++) {
+        gdouble fps;
+
+        if (j > 0 && threads[j] == threads[0])
+          continue;
+        fps = run (sizes[s].width, sizes[s].height, implementations[i],
+            threads[j]);
+        if (fps < 0) {
+          /* Not this CPU's instruction set */
+          break;
+        }
+        g_print ("  %-6s %-7s %3u thread%s %9.1f fps\n", sizes[s].name,
+            implementations[i], threads[j], threads[j] == 1 ? " " : "s",
+            fps);
+      }
+    }
+  }
+
+  g_free (effect);
+
+  return 0;
+}
@@ -0,0 +1,425 @@
+/* Find the container type of a lot of files quickly. Full typefinding
+ * runs every typefinder GStreamer has against each file; most of what
+ * we ingest is WebM/Matroska, Ogg, MP4 or MPEG-TS, and those are easy to
+ * recognise from their first few hundred bytes. So check a small table
+ * of signatures first, trying the ones that go with the file extension
+ * before the others, and only fall back to full typefinding if nothing
+ * matches. Results are cached by device, inode and mtime, so the next
+ * run over the same files doesn't even open them.
+ *
+ *   ./fast-typefind --compare ~/media
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+
+/* How much of the file the signatures look at */
+#define HEAD_SIZE 1024
+
+static gboolean compare = FALSE;
+static gboolean no_cache = FALSE;
+static gboolean quiet = FALSE;
+
+static GOptionEntry opt_entries[] = {
+  {"compare", 'c', 0, G_OPTION_ARG_NONE, &compare,
+      "Also run full typefinding on every file, and report the time saved",
+      NULL},
+  {"no-cache", 'n', 0, G_OPTION_ARG_NONE, &no_cache,
+      "Don't use or update the cache", NULL},
+  {"quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet,
+      "Only print the summary", NULL},
+  {NULL}
+};
+
+typedef enum
+{
+  FOUND_CACHE,
+  FOUND_SIGNATURE,
+  FOUND_TYPEFIND,
+  FOUND_NOTHING,
+  N_FOUND
+} FoundBy;
+
+static const gchar *found_names[N_FOUND] = {
+  "cache", "signature", "typefind", "unknown"
+};
+
+typedef struct
+{
+  const gchar *extensions[4];
+  /* Returns the caps if @head looks like this type */
+  const gchar *(*check) (const guint8 * head, gsize size);
+} Signature;
+
+static const gchar *
+check_ebml (const guint8 * head, gsize size)
+{
+  static const guint8 ebml[] = { 0x1a, 0x45, 0xdf, 0xa3 };
+  gsize i;
+
+  if (size < 4 || memcmp (head, ebml, 4) != 0)
+    return NULL;
+
+  /* The DocType comes early in the EBML header */
+  for (i = 4; i + 4 <= MIN (size, 64); i++)
+    if (memcmp (head + i, "webm", 4) == 0)
+      return "video/webm";
+
+  return "video/x-matroska";
+}
+
+static const gchar *
+check_ogg (const guint8 * head, gsize size)
+{
+  if (size < 4 || memcmp (head, "OggS", 4) != 0)
+    return NULL;
+
+  return "application/ogg";
+}
+
+static const gchar *
+check_mp4 (const guint8 * head, gsize size)
+{
+  if (size < 12 || memcmp (head + 4, "ftyp", 4) != 0)
+    return NULL;
+
+  /* The major brand, mapped like the qtdemux typefinder does. Anything
+   * else is left to full typefinding */
+  if (memcmp (head + 8, "qt  ", 4) == 0)
+    return "video/quicktime";
+  if (memcmp (head + 8, "M4A ", 4) == 0 || memcmp (head + 8, "M4B ", 4) == 0)
+    return "audio/x-m4a";
+  if (memcmp (head + 8, "3gp", 3) == 0 || memcmp (head + 8, "3g2", 3) == 0)
+    return "application/x-3gp";
+  if (memcmp (head + 8, "isom", 4) == 0 || memcmp (head + 8, "iso2", 4) == 0
+      || memcmp (head + 8, "avc1", 4) == 0 || memcmp (head + 8, "mp41", 4) == 0
+      || memcmp (head + 8, "mp42", 4) == 0)
+    return "video/quicktime, variant=(string)iso";
+
+  return NULL;
+}
+
+static const gchar *
+check_mpegts (const guint8 * head, gsize size)
+{
+  gint sizes[] = { 188, 192 }, i, n;
+
+  /* Three sync bytes in a row at the packet size. M2TS packets have a
+   * 4 byte timestamp in front of the sync byte */
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+    gint offset = sizes[i] - 188;
+
+    for (n = 0; n < 3; n++)
+      if (offset + n * sizes[i] >= size || head[offset + n * sizes[i]] != 0x47)
+        break;
+    if (n == 3)
+      return sizes[i] == 188 ?
+          "video/mpegts, systemstream=(boolean)true, packetsize=(int)188" :
+          "video/mpegts, systemstream=(boolean)true, packetsize=(int)192";
+  }
+
+  return NULL;
+}
+
+static const Signature signatures[] = {
+  {{"webm", "mkv", "mka", NULL}, check_ebml},
+  {{"ogg", "ogv", "oga", "opus"}, check_ogg},
+  {{"mp4", "m4a", "mov", "m4v"}, check_mp4},
+  {{"ts", "m2ts", "mts", NULL}, check_mpegts},
+};
+
+static gboolean
+has_extension (const Signature * sig, const gchar * ext)
+{
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sig->extensions) && sig->extensions[i]; i++)
+    if (g_ascii_strcasecmp (sig->extensions[i], ext) == 0)
+      return TRUE;
+
+  return FALSE;
+}
+
+static gchar *
+signature_typefind (const gchar * path)
+{
+  guint8 head[HEAD_SIZE];
+  const gchar *ext, *caps = NULL;
+  gsize size;
+  FILE *f;
+  gint pass, i;
+
+  f = fopen (path, "rb");
+  if (f == NULL)
+    return NULL;
+  size = fread (head, 1, sizeof (head), f);
+  fclose (f);
+
+  ext = strrchr (path, '.');
+  ext = ext ? ext + 1 : "";
+
+  /* Signatures that go with the extension first, then the rest */
+  for (pass = 0; pass < 2 && caps == NULL; pass++) {
+    for (i = 0; i < G_N_ELEMENTS (signatures) && caps == NULL; i++)
+      if (has_extension (&signatures[i], ext) == (pass == 0))
+        caps = signatures[i].check (head, size);
+  }
+
+  return g_strdup (caps);
+}
+
+static void
+have_type_cb (GstElement * typefind, guint probability, GstCaps * caps,
+    gchar ** result)
+{
+  g_free (*result);
+  *result = gst_caps_to_string (caps);
+}
+
+/* What playbin does: filesrc ! typefind, all typefinders */
+static gchar *
+full_typefind (const gchar * path)
+{
+  GstElement *pipeline, *src, *typefind;
+  GstMessage *msg;
+  GstBus *bus;
+  gchar *caps = NULL;
+
+  pipeline = gst_parse_launch ("filesrc name=src ! typefind name=tf ! "
+      "fakesink", NULL);
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  typefind = gst_bin_get_by_name (GST_BIN (pipeline), "tf");
+  g_object_set (src, "location", path, NULL);
+  g_signal_connect (typefind, "have-type", G_CALLBACK (have_type_cb), &caps);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (typefind);
+  gst_object_unref (pipeline);
+
+  return caps;
+}
+
+typedef struct
+{
+  GKeyFile *cache;
+  gchar *cache_path;
+  gboolean cache_changed;
+
+  guint files;
+  guint found[N_FOUND];
+  guint mismatches;
+  /* All in seconds */
+  gdouble fast_time;
+  gdouble full_time;
+} CorpusData;
+
+static gchar *
+cache_key (struct stat *st)
+{
+  return g_strdup_printf ("%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+      (guint64) st->st_dev, (guint64) st->st_ino);
+}
+
+static gchar *
+cache_lookup (CorpusData * data, const gchar * key, gint64 mtime)
+{
+  GError *err = NULL;
+  gint64 cached_mtime;
+
+  cached_mtime = g_key_file_get_int64 (data->cache, key, "mtime", &err);
+  if (err) {
+    g_error_free (err);
+    return NULL;
+  }
+  if (cached_mtime != mtime)
+    return NULL;
+
+  return g_key_file_get_string (data->cache, key, "caps", NULL);
+}
+
+static void
+typefind_file (CorpusData * data, const gchar * path, struct stat *st)
+{
+  gchar *key, *caps = NULL, *full_caps = NULL;
+  gint64 mtime, begin;
+  gdouble fast, full = 0.0;
+  FoundBy found_by;
+
+  key = cache_key (st);
+  mtime = (gint64) st->st_mtim.tv_sec * G_USEC_PER_SEC +
+      st->st_mtim.tv_nsec / 1000;
+
+  begin = g_get_monotonic_time ();
+  found_by = FOUND_CACHE;
+  if (!no_cache)
+    caps = cache_lookup (data, key, mtime);
+  if (caps == NULL) {
+    found_by = FOUND_SIGNATURE;
+    caps = signature_typefind (path);
+  }
+  if (caps == NULL) {
+    found_by = FOUND_TYPEFIND;
+    caps = full_typefind (path);
+  }
+  if (caps == NULL)
+    found_by = FOUND_NOTHING;
+  fast = (g_get_monotonic_time () - begin) / (gdouble) G_USEC_PER_SEC;
+
+  if (compare) {
+    begin = g_get_monotonic_time ();
+    full_caps = full_typefind (path);
+    full = (g_get_monotonic_time () - begin) / (gdouble) G_USEC_PER_SEC;
+  }
+
+  if (caps && found_by != FOUND_CACHE && !no_cache) {
+    g_key_file_set_int64 (data->cache, key, "mtime", mtime);
+    g_key_file_set_string (data->cache, key, "caps", caps);
+    data->cache_changed = TRUE;
+  }
+
+  data->files++;
+  data->found[found_by]++;
+  data->fast_time += fast;
+  data->full_time += full;
+
+  if (!quiet) {
+    g_print ("%s: %s (%s, %.2f ms", path, caps ? caps : "unknown",
+        found_names[found_by], fast * 1000);
+    if (compare)
+      g_print (", full typefind %.2f ms, saved %.2f ms", full * 1000,
+          (full - fast) * 1000);
+    g_print (")\n");
+  }
+
+  /* A signature that disagrees with the typefinders is a bug in the
+   * table, say so */
+  if (compare && caps && full_caps) {
+    GstCaps *a = gst_caps_from_string (caps);
+    GstCaps *b = gst_caps_from_string (full_caps);
+
+    if (a && b && !gst_caps_can_intersect (a, b)) {
+      g_print ("%s: mismatch, full typefind says %s\n", path, full_caps);
+      data->mismatches++;
+    }
+    if (a)
+      gst_caps_unref (a);
+    if (b)
+      gst_caps_unref (b);
+  }
+
+  g_free (full_caps);
+  g_free (caps);
+  g_free (key);
+}
+
+static void
+typefind_path (CorpusData * data, const gchar * path)
+{
+  struct stat st;
+  const gchar *name;
+  GDir *dir;
+
+  if (stat (path, &st) != 0) {
+    g_printerr ("Can't read %s\n", path);
+    return;
+  }
+
+  if (S_ISREG (st.st_mode)) {
+    typefind_file (data, path, &st);
+    return;
+  }
+  if (!S_ISDIR (st.st_mode))
+    return;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child = g_build_filename (path, name, NULL);
+    typefind_path (data, child);
+    g_free (child);
+  }
+  g_dir_close (dir);
+}
+
+static void
+print_summary (CorpusData * data)
+{
+  if (data->files == 0)
+    return;
+
+  g_print ("%u files: %u from the cache, %u by signature, %u by full "
+      "typefinding, %u unknown\n", data->files, data->found[FOUND_CACHE],
+      data->found[FOUND_SIGNATURE], data->found[FOUND_TYPEFIND],
+      data->found[FOUND_NOTHING]);
+  g_print ("Typefinding took %.2f ms per file (%.2f s in total)\n",
+      data->fast_time * 1000 / data->files, data->fast_time);
+  if (compare) {
+    g_print ("Full typefinding took %.2f ms per file (%.2f s in total), "
+        "saved %.2f ms per file\n", data->full_time * 1000 / data->files,
+        data->full_time, (data->full_time - data->fast_time) * 1000 /
+        data->files);
+    if (data->mismatches)
+      g_print ("%u files typed differently by full typefinding\n",
+          data->mismatches);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  CorpusData data = { 0, };
+  gchar *dir;
+  gint i;
+
+  opt_ctx = g_option_context_new ("<file|dir> [...] - Fast typefinding");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (argc < 2) {
+    g_print ("Usage: %s [--compare] <file|dir> [<file|dir> ...]\n", argv[0]);
+    return 1;
+  }
+
+  dir = g_build_filename (g_get_user_cache_dir (), "fast-typefind", NULL);
+  g_mkdir_with_parents (dir, 0755);
+  /* types.ini had M4A and 3GP files typed as ISO MP4 */
+  data.cache_path = g_build_filename (dir, "types-2.ini", NULL);
+  g_free (dir);
+  data.cache = g_key_file_new ();
+  if (!no_cache)
+    g_key_file_load_from_file (data.cache, data.cache_path, G_KEY_FILE_NONE,
+        NULL);
+
+  for (i = 1; i < argc; i++)
+    typefind_path (&data, argv[i]);
+
+  print_summary (&data);
+
+  if (data.cache_changed &&
+      !g_key_file_save_to_file (data.cache, data.cache_path, &err)) {
+    g_printerr ("Could not save the cache: %s\n", err->message);
+    g_error_free (err);
+  }
+
+  g_key_file_free (data.cache);
+  g_free (data.cache_path);
+
+  return 0;
+}
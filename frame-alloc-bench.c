@@ -0,0 +1,259 @@
+/* Compares where decoded frames live: the producer's own buffer pool,
+ * a pool of system memory offered by the consumer, and pools backed by
+ * the memfd and huge page arenas of frame-allocator.c. For each, it
+ * reports per frame:
+ *
+ *   faults    page faults of the whole process, setup included
+ *   dTLB      data TLB read misses of the thread producing and reading
+ *             the frames, if perf events are allowed
+ *   CPU       user and system time of the whole process
+ *
+ * Without a file, 1080p frames come from videotestsrc. With one, they
+ * are decoded from it, which should be 1080p to be comparable:
+ *
+ *   ./frame-alloc-bench -n 500
+ *   ./frame-alloc-bench some-1080p-file.webm
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "frame-allocator.h"
+#include "frame-pool.h"
+
+static gint num_frames = 300;
+static gint pool_size = 8;
+
+static GOptionEntry opt_entries[] = {
+  {"num-frames", 'n', 0, G_OPTION_ARG_INT, &num_frames,
+      "Frames per run, without a file (default: 300)", "N"},
+  {"pool-size", 's', 0, G_OPTION_ARG_INT, &pool_size,
+      "Frames in the consumer's pool (default: 8)", "N"},
+  {NULL}
+};
+
+static const struct
+{
+  const gchar *name;
+  const gchar *allocator;
+} modes[] = {
+  {"producer's pool", NULL},
+  {"sysmem pool", "sysmem"},
+  {"memfd arena", "memfd"},
+  {"hugepage arena", "hugepage"},
+};
+
+typedef struct
+{
+  guint64 frames;
+  guint64 checksum;
+  gint perf_fd;
+  guint64 dtlb_start;
+  guint64 dtlb_misses;
+  gboolean have_dtlb;
+} RunData;
+
+/* Counts for the calling thread only, so it needs no privileges
+ * beyond perf_event_paranoid allowing user space measurements */
+static gint
+open_dtlb_counter (void)
+{
+  struct perf_event_attr attr;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof (attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static guint64
+read_counter (gint fd)
+{
+  guint64 count = 0;
+
+  if (read (fd, &count, sizeof (count)) != sizeof (count))
+    return 0;
+
+  return count;
+}
+
+/* A consumer reading every cache line of the luma plane */
+static GstFlowReturn
+new_sample (GstAppSink * appsink, RunData * run)
+{
+  GstSample *sample = gst_app_sink_pull_sample (appsink);
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+  gint x, y;
+
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  /* From the first frame on, in the streaming thread */
+  if (run->frames == 0) {
+    run->perf_fd = open_dtlb_counter ();
+    if (run->perf_fd >= 0)
+      run->dtlb_start = read_counter (run->perf_fd);
+  }
+
+  if (gst_video_info_from_caps (&vinfo, gst_sample_get_caps (sample)) &&
+      gst_video_frame_map (&frame, &vinfo, gst_sample_get_buffer (sample),
+          GST_MAP_READ)) {
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (&frame, 0); y++) {
+      const guint8 *line = GST_VIDEO_FRAME_COMP_DATA (&frame, 0) +
+          y * GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
+
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (&frame, 0); x += 64)
+        run->checksum += line[x];
+    }
+    gst_video_frame_unmap (&frame);
+  }
+  run->frames++;
+  gst_sample_unref (sample);
+
+  return GST_FLOW_OK;
+}
+
+static void
+eos (GstAppSink * appsink, RunData * run)
+{
+  if (run->perf_fd >= 0) {
+    run->dtlb_misses = read_counter (run->perf_fd) - run->dtlb_start;
+    run->have_dtlb = TRUE;
+    close (run->perf_fd);
+    run->perf_fd = -1;
+  }
+}
+
+static gdouble
+cpu_seconds (const struct rusage *usage)
+{
+  return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec +
+      (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) /
+      (gdouble) G_USEC_PER_SEC;
+}
+
+static gboolean
+run (const gchar * uri, const gchar * name, const gchar * allocator_name)
+{
+  GstAppSinkCallbacks callbacks = { NULL, };
+  GstAllocator *allocator = NULL;
+  GstElement *pipeline, *appsink;
+  struct rusage before, after;
+  RunData data = { 0, };
+  FrameArenaType type;
+  GstMessage *msg;
+  GstBus *bus;
+  GError *err = NULL;
+  gchar *desc;
+  gboolean ok;
+
+  if (uri)
+    desc = g_strdup_printf ("uridecodebin uri=%s caps=video/x-raw "
+        "expose-all-streams=false ! appsink name=sink", uri);
+  else
+    desc = g_strdup_printf ("videotestsrc num-buffers=%d pattern=ball ! "
+        "video/x-raw,format=I420,width=1920,height=1080 ! "
+        "appsink name=sink", num_frames);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (pipeline == NULL) {
+    g_printerr ("Could not create pipeline: %s\n", err->message);
+    exit (1);
+  }
+
+  appsink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (appsink, "sync", FALSE, "max-buffers", 2, NULL);
+  callbacks.new_sample = (GstFlowReturn (*)(GstAppSink *, gpointer))
+      new_sample;
+  callbacks.eos = (void (*)(GstAppSink *, gpointer)) eos;
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, &data,
+      NULL);
+  data.perf_fd = -1;
+
+  if (allocator_name) {
+    if (frame_arena_type_from_string (allocator_name, &type))
+      allocator = frame_allocator_new (type, pool_size);
+    frame_pool_attach (appsink, pool_size, allocator);
+  }
+  gst_object_unref (appsink);
+
+  getrusage (RUSAGE_SELF, &before);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  getrusage (RUSAGE_SELF, &after);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (ok && data.frames > 0) {
+    g_print ("  %-16s %10.1f", name,
+        (gdouble) (after.ru_minflt + after.ru_majflt - before.ru_minflt -
+            before.ru_majflt) / data.frames);
+    if (data.have_dtlb)
+      g_print (" %12.1f", (gdouble) data.dtlb_misses / data.frames);
+    else
+      g_print (" %12s", "n/a");
+    g_print (" %10.3f\n", (cpu_seconds (&after) - cpu_seconds (&before)) *
+        1000 / data.frames);
+  }
+
+  if (allocator)
+    gst_object_unref (allocator);
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  gchar *uri = NULL;
+  guint i;
+
+  opt_ctx = g_option_context_new ("[FILE] - Compare frame allocators");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (argc > 1)
+    uri = gst_uri_is_valid (argv[1]) ? g_strdup (argv[1]) :
+        gst_filename_to_uri (argv[1], NULL);
+  pool_size = MAX (pool_size, 4);
+
+  g_print ("%s, pools of %d frames, per frame:\n",
+      uri ? uri : "1080p videotestsrc", pool_size);
+  g_print ("  %-16s %10s %12s %10s\n", "frames from", "faults", "dTLB misses",
+      "CPU ms");
+  for (i = 0; i < G_N_ELEMENTS (modes); i++) {
+    if (!run (uri, modes[i].name, modes[i].allocator))
+      g_print ("  %-16s failed\n", modes[i].name);
+  }
+
+  g_free (uri);
+
+  return 0;
+}
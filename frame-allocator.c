@@ -0,0 +1,313 @@
+/* Decoded frames from a pre-faulted arena. A 1080p frame is 3MB, and
+ * malloc gives memory that large its own mapping, so every new frame
+ * costs hundreds of page faults on first touch, and then TLB misses on
+ * every pass over it with 4kB pages. The arena is mapped and touched
+ * once, and with huge pages a frame spans two TLB entries instead of
+ * hundreds.
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "frame-allocator.h"
+
+#define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define FRAME_ARENA_MEM_TYPE "FrameArena"
+
+typedef struct
+{
+  GstAllocator parent;
+
+  FrameArenaType type;
+  guint n_slots;
+  const gchar *backing;
+
+  GMutex lock;
+  guint8 *arena;
+  gsize arena_size;
+  gint fd;
+  gsize slot_size;
+  gboolean *busy;
+  guint n_busy;
+
+  /* Statistics */
+  guint64 allocations;
+  guint64 fallbacks;
+} FrameAllocator;
+
+typedef struct
+{
+  GstAllocatorClass parent_class;
+} FrameAllocatorClass;
+
+typedef struct
+{
+  GstMemory mem;
+  guint8 *data;
+  /* -1 for shares, which don't own the slot */
+  gint slot;
+} ArenaMemory;
+
+static GType frame_allocator_get_type (void);
+G_DEFINE_TYPE (FrameAllocator, frame_allocator, GST_TYPE_ALLOCATOR);
+
+gboolean
+frame_arena_type_from_string (const gchar * name, FrameArenaType * type)
+{
+  if (g_str_equal (name, "memfd"))
+    *type = FRAME_ARENA_MEMFD;
+  else if (g_str_equal (name, "hugepage"))
+    *type = FRAME_ARENA_HUGEPAGE;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+destroy_arena (FrameAllocator * self)
+{
+  if (self->arena)
+    munmap (self->arena, self->arena_size);
+  if (self->fd >= 0)
+    close (self->fd);
+  self->arena = NULL;
+  self->fd = -1;
+}
+
+/* Huge page aligned anonymous memory that the kernel may back with
+ * transparent huge pages */
+static guint8 *
+map_thp (gsize size)
+{
+  guint8 *p, *aligned;
+  gsize head;
+
+  p = mmap (NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+
+  aligned = (guint8 *) GST_ROUND_UP_N ((guintptr) p, HUGE_PAGE_SIZE);
+  head = aligned - p;
+  if (head)
+    munmap (p, head);
+  munmap (aligned + size, HUGE_PAGE_SIZE - head);
+  madvise (aligned, size, MADV_HUGEPAGE);
+
+  return aligned;
+}
+
+/* Call with the lock held, and no slots in use */
+static gboolean
+create_arena (FrameAllocator * self, gsize slot_size)
+{
+  gsize size = slot_size * self->n_slots, offset;
+  guint8 *p = MAP_FAILED;
+
+  destroy_arena (self);
+
+  if (self->type == FRAME_ARENA_HUGEPAGE) {
+    size = GST_ROUND_UP_N (size, HUGE_PAGE_SIZE);
+    p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    self->backing = "reserved huge pages";
+    if (p == MAP_FAILED) {
+      /* None reserved (vm.nr_hugepages) */
+      p = map_thp (size);
+      self->backing = "transparent huge pages";
+      if (p == NULL)
+        p = MAP_FAILED;
+    }
+  } else {
+    self->fd = memfd_create ("frame-arena", MFD_CLOEXEC);
+    if (self->fd >= 0 && ftruncate (self->fd, size) == 0)
+      p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+          self->fd, 0);
+    self->backing = "memfd";
+  }
+
+  if (p == MAP_FAILED) {
+    g_printerr ("Could not map a %" G_GSIZE_FORMAT " byte frame arena\n",
+        size);
+    destroy_arena (self);
+    return FALSE;
+  }
+
+  /* Fault everything in now, MAP_POPULATE is only a hint */
+  for (offset = 0; offset < size; offset += PAGE_SIZE)
+    p[offset] = 0;
+
+  self->arena = p;
+  self->arena_size = size;
+  self->slot_size = slot_size;
+  g_free (self->busy);
+  self->busy = g_new0 (gboolean, self->n_slots);
+
+  g_print ("Frame arena: %u frames of %" G_GSIZE_FORMAT " kB, %"
+      G_GSIZE_FORMAT " MB of %s\n", self->n_slots, slot_size / 1024,
+      size / (1024 * 1024), self->backing);
+
+  return TRUE;
+}
+
+static GstMemory *
+frame_allocator_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  FrameAllocator *self = (FrameAllocator *) allocator;
+  gsize maxsize = size + params->prefix + params->padding;
+  ArenaMemory *mem;
+  gint slot = -1;
+  guint i;
+
+  g_mutex_lock (&self->lock);
+  self->allocations++;
+  /* Bigger frames after a caps change, start over once the old ones
+   * are all back */
+  if ((self->arena == NULL || maxsize > self->slot_size) && self->n_busy == 0)
+    create_arena (self, GST_ROUND_UP_N (maxsize, PAGE_SIZE));
+
+  /* Slots are page aligned, so any smaller alignment is met */
+  if (self->arena && maxsize <= self->slot_size && params->align < PAGE_SIZE) {
+    for (i = 0; i < self->n_slots; i++) {
+      if (!self->busy[i]) {
+        self->busy[i] = TRUE;
+        self->n_busy++;
+        slot = i;
+        break;
+      }
+    }
+  }
+  if (slot < 0)
+    self->fallbacks++;
+  g_mutex_unlock (&self->lock);
+
+  if (slot < 0)
+    return gst_allocator_alloc (NULL, size, params);
+
+  mem = g_new0 (ArenaMemory, 1);
+  gst_memory_init (GST_MEMORY_CAST (mem), params->flags, allocator, NULL,
+      self->slot_size, params->align, params->prefix, size);
+  mem->data = self->arena + (gsize) slot *self->slot_size;
+  mem->slot = slot;
+
+  if (params->prefix && (params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED))
+    memset (mem->data, 0, params->prefix);
+  if (params->flags & GST_MEMORY_FLAG_ZERO_PADDED)
+    memset (mem->data + params->prefix + size, 0,
+        self->slot_size - params->prefix - size);
+
+  return GST_MEMORY_CAST (mem);
+}
+
+static void
+frame_allocator_free (GstAllocator * allocator, GstMemory * memory)
+{
+  FrameAllocator *self = (FrameAllocator *) allocator;
+  ArenaMemory *mem = (ArenaMemory *) memory;
+
+  if (mem->slot >= 0) {
+    g_mutex_lock (&self->lock);
+    self->busy[mem->slot] = FALSE;
+    self->n_busy--;
+    g_mutex_unlock (&self->lock);
+  }
+  g_free (mem);
+}
+
+static gpointer
+arena_mem_map (ArenaMemory * mem, gsize maxsize, GstMapFlags flags)
+{
+  return mem->data;
+}
+
+static void
+arena_mem_unmap (ArenaMemory * mem)
+{
+}
+
+static ArenaMemory *
+arena_mem_share (ArenaMemory * mem, gssize offset, gssize size)
+{
+  GstMemory *parent = mem->mem.parent ? mem->mem.parent : (GstMemory *) mem;
+  ArenaMemory *sub;
+
+  if (size == -1)
+    size = mem->mem.size - offset;
+
+  sub = g_new0 (ArenaMemory, 1);
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      mem->mem.allocator, parent, mem->mem.maxsize, mem->mem.align,
+      mem->mem.offset + offset, size);
+  sub->data = mem->data;
+  sub->slot = -1;
+
+  return sub;
+}
+
+static void
+frame_allocator_finalize (GObject * object)
+{
+  FrameAllocator *self = (FrameAllocator *) object;
+
+  destroy_arena (self);
+  g_free (self->busy);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (frame_allocator_parent_class)->finalize (object);
+}
+
+static void
+frame_allocator_class_init (FrameAllocatorClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  gobject_class->finalize = frame_allocator_finalize;
+  allocator_class->alloc = frame_allocator_alloc;
+  allocator_class->free = frame_allocator_free;
+}
+
+static void
+frame_allocator_init (FrameAllocator * self)
+{
+  GstAllocator *allocator = GST_ALLOCATOR_CAST (self);
+
+  allocator->mem_type = FRAME_ARENA_MEM_TYPE;
+  allocator->mem_map = (GstMemoryMapFunction) arena_mem_map;
+  allocator->mem_unmap = (GstMemoryUnmapFunction) arena_mem_unmap;
+  allocator->mem_share = (GstMemoryShareFunction) arena_mem_share;
+  GST_OBJECT_FLAG_SET (allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+
+  g_mutex_init (&self->lock);
+  self->fd = -1;
+}
+
+GstAllocator *
+frame_allocator_new (FrameArenaType type, guint n_slots)
+{
+  FrameAllocator *self = g_object_new (frame_allocator_get_type (), NULL);
+
+  /* Not floating, the caller owns it */
+  gst_object_ref_sink (self);
+  self->type = type;
+  self->n_slots = MAX (n_slots, 1);
+
+  return GST_ALLOCATOR_CAST (self);
+}
+
+void
+frame_allocator_print_stats (GstAllocator * allocator)
+{
+  FrameAllocator *self = (FrameAllocator *) allocator;
+
+  g_mutex_lock (&self->lock);
+  g_print ("Frame arena: %" G_GUINT64_FORMAT " allocations, %"
+      G_GUINT64_FORMAT " from the system allocator\n", self->allocations,
+      self->fallbacks);
+  g_mutex_unlock (&self->lock);
+}
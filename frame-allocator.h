@@ -0,0 +1,29 @@
+#ifndef __FRAME_ALLOCATOR_H__
+#define __FRAME_ALLOCATOR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  /* A memfd, which could also be passed to another process */
+  FRAME_ARENA_MEMFD,
+  /* Reserved huge pages if there are any, transparent ones if not */
+  FRAME_ARENA_HUGEPAGE
+} FrameArenaType;
+
+gboolean frame_arena_type_from_string (const gchar * name,
+    FrameArenaType * type);
+
+/* An allocator handing out frames from one arena of @n_slots
+ * equally sized slots, mapped and faulted in up front so using a
+ * frame never page faults. The slot size is set by the first
+ * allocation. Allocations that don't fit, or when all slots are in use,
+ * come from the system allocator instead */
+GstAllocator *frame_allocator_new (FrameArenaType type, guint n_slots);
+
+void frame_allocator_print_stats (GstAllocator * allocator);
+
+G_END_DECLS
+#endif /* __FRAME_ALLOCATOR_H__ */
@@ -0,0 +1,228 @@
+/* Frame difference metrics for scene-detect. The difference is one
+ * PSADBW (or the NEON equivalent) per 16 or 32 pixels, which is far
+ * cheaper than decoding the frame. The histogram has no useful SIMD
+ * form without scatter stores, so it counts into four tables in turn
+ * instead, which keeps repeated values in flat areas from waiting on
+ * each other's increments. As in plugin/convolve-simd.c, the SIMD
+ * versions are picked at run time.
+ */
+#include <string.h>
+
+#include "frame-diff.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static const gchar *impl_names[] = {
+  "auto", "scalar", "sse2", "avx2", "neon"
+};
+
+/* Does pixels 0 to some x <= width of a row, and returns that x */
+typedef gint (*SadRowFunc) (const guint8 * a, const guint8 * b, gint width,
+    guint64 * sum);
+
+#ifdef HAVE_X86
+__attribute__ ((target ("sse2")))
+static gint
+sad_row_sse2 (const guint8 * a, const guint8 * b, gint width, guint64 * sum)
+{
+  __m128i acc = _mm_setzero_si128 ();
+  guint64 lanes[2];
+  gint x;
+
+  for (x = 0; x + 16 <= width; x += 16)
+    acc = _mm_add_epi64 (acc, _mm_sad_epu8 (_mm_loadu_si128 ((const __m128i
+                    *) (a + x)), _mm_loadu_si128 ((const __m128i *) (b +
+                    x))));
+
+  _mm_storeu_si128 ((__m128i *) lanes, acc);
+  *sum += lanes[0] + lanes[1];
+
+  return x;
+}
+
+__attribute__ ((target ("avx2")))
+static gint
+sad_row_avx2 (const guint8 * a, const guint8 * b, gint width, guint64 * sum)
+{
+  __m256i acc = _mm256_setzero_si256 ();
+  guint64 lanes[4];
+  gint x;
+
+  for (x = 0; x + 32 <= width; x += 32)
+    acc = _mm256_add_epi64 (acc,
+        _mm256_sad_epu8 (_mm256_loadu_si256 ((const __m256i *) (a + x)),
+            _mm256_loadu_si256 ((const __m256i *) (b + x))));
+
+  _mm256_storeu_si256 ((__m256i *) lanes, acc);
+  *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+  return x;
+}
+#endif /* HAVE_X86 */
+
+#ifdef HAVE_NEON
+static gint
+sad_row_neon (const guint8 * a, const guint8 * b, gint width, guint64 * sum)
+{
+  uint32x4_t acc = vdupq_n_u32 (0);
+  gint x;
+
+  /* Pairwise widening adds, so no lane can overflow on any sane width */
+  for (x = 0; x + 16 <= width; x += 16)
+    acc = vpadalq_u16 (acc, vpaddlq_u8 (vabdq_u8 (vld1q_u8 (a + x),
+                vld1q_u8 (b + x))));
+
+  *sum += (guint64) vgetq_lane_u32 (acc, 0) + vgetq_lane_u32 (acc, 1) +
+      vgetq_lane_u32 (acc, 2) + vgetq_lane_u32 (acc, 3);
+
+  return x;
+}
+#endif /* HAVE_NEON */
+
+gboolean
+frame_diff_impl_from_string (const gchar * name, FrameDiffImpl * impl)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (impl_names); i++) {
+    if (g_str_equal (impl_names[i], name)) {
+      *impl = i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+const gchar *
+frame_diff_impl_name (FrameDiffImpl impl)
+{
+  if (impl == FRAME_DIFF_IMPL_AUTO)
+    impl = frame_diff_best_impl ();
+
+  return impl_names[impl];
+}
+
+gboolean
+frame_diff_impl_supported (FrameDiffImpl impl)
+{
+  switch (impl) {
+    case FRAME_DIFF_IMPL_AUTO:
+    case FRAME_DIFF_IMPL_SCALAR:
+      return TRUE;
+#ifdef HAVE_X86
+    case FRAME_DIFF_IMPL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case FRAME_DIFF_IMPL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+#ifdef HAVE_NEON
+    case FRAME_DIFF_IMPL_NEON:
+      return TRUE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+FrameDiffImpl
+frame_diff_best_impl (void)
+{
+  if (frame_diff_impl_supported (FRAME_DIFF_IMPL_AVX2))
+    return FRAME_DIFF_IMPL_AVX2;
+  if (frame_diff_impl_supported (FRAME_DIFF_IMPL_SSE2))
+    return FRAME_DIFF_IMPL_SSE2;
+  if (frame_diff_impl_supported (FRAME_DIFF_IMPL_NEON))
+    return FRAME_DIFF_IMPL_NEON;
+
+  return FRAME_DIFF_IMPL_SCALAR;
+}
+
+static SadRowFunc
+get_sad_row_func (FrameDiffImpl impl)
+{
+  if (impl == FRAME_DIFF_IMPL_AUTO)
+    impl = frame_diff_best_impl ();
+
+  switch (impl) {
+#ifdef HAVE_X86
+    case FRAME_DIFF_IMPL_SSE2:
+      return sad_row_sse2;
+    case FRAME_DIFF_IMPL_AVX2:
+      return sad_row_avx2;
+#endif
+#ifdef HAVE_NEON
+    case FRAME_DIFF_IMPL_NEON:
+      return sad_row_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+guint64
+frame_diff_sad (FrameDiffImpl impl, const guint8 * a, gint a_stride,
+    const guint8 * b, gint b_stride, gint width, gint height)
+{
+  SadRowFunc simd = get_sad_row_func (impl);
+  guint64 sum = 0;
+  gint x, y;
+
+  for (y = 0; y < height; y++) {
+    x = simd ? simd (a, b, width, &sum) : 0;
+    for (; x < width; x++)
+      sum += ABS (a[x] - b[x]);
+    a += a_stride;
+    b += b_stride;
+  }
+
+  return sum;
+}
+
+void
+frame_diff_histogram (const guint8 * p, gint stride, gint width,
+    gint height, guint32 * hist)
+{
+  guint32 tables[4][FRAME_DIFF_BINS];
+  gint x, y, i;
+
+  memset (tables, 0, sizeof (tables));
+  for (y = 0; y < height; y++) {
+    for (x = 0; x + 4 <= width; x += 4) {
+      tables[0][p[x] >> 2]++;
+      tables[1][p[x + 1] >> 2]++;
+      tables[2][p[x + 2] >> 2]++;
+      tables[3][p[x + 3] >> 2]++;
+    }
+    for (; x < width; x++)
+      tables[0][p[x] >> 2]++;
+    p += stride;
+  }
+
+  for (i = 0; i < FRAME_DIFF_BINS; i++)
+    hist[i] = tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+}
+
+gdouble
+frame_diff_histogram_distance (const guint32 * a, const guint32 * b,
+    guint64 pixels)
+{
+  guint64 sum = 0;
+  gint i;
+
+  if (pixels == 0)
+    return 0;
+
+  for (i = 0; i < FRAME_DIFF_BINS; i++)
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+  return sum / (2.0 * pixels);
+}
@@ -0,0 +1,41 @@
+#ifndef __FRAME_DIFF_H__
+#define __FRAME_DIFF_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Luma histograms have this many bins of 4 values each */
+#define FRAME_DIFF_BINS 64
+
+typedef enum
+{
+  FRAME_DIFF_IMPL_AUTO,
+  FRAME_DIFF_IMPL_SCALAR,
+  FRAME_DIFF_IMPL_SSE2,
+  FRAME_DIFF_IMPL_AVX2,
+  FRAME_DIFF_IMPL_NEON
+} FrameDiffImpl;
+
+gboolean frame_diff_impl_from_string (const gchar * name,
+    FrameDiffImpl * impl);
+const gchar *frame_diff_impl_name (FrameDiffImpl impl);
+FrameDiffImpl frame_diff_best_impl (void);
+gboolean frame_diff_impl_supported (FrameDiffImpl impl);
+
+/* Sum of the absolute differences of two 8 bit planes */
+guint64 frame_diff_sad (FrameDiffImpl impl, const guint8 * a, gint a_stride,
+    const guint8 * b, gint b_stride, gint width, gint height);
+
+/* Counts the pixels of an 8 bit plane into @hist, which has
+ * FRAME_DIFF_BINS entries */
+void frame_diff_histogram (const guint8 * p, gint stride, gint width,
+    gint height, guint32 * hist);
+
+/* The share of pixels that would have to move to another bin to turn
+ * one histogram into the other, from 0 to 1 */
+gdouble frame_diff_histogram_distance (const guint32 * a, const guint32 * b,
+    guint64 pixels);
+
+G_END_DECLS
+#endif /* __FRAME_DIFF_H__ */
@@ -0,0 +1,86 @@
+/* A fixed size buffer pool for appsink consumers. appsink doesn't
+ * answer allocation queries itself, so without this every decoder
+ * makes its own pool or allocates each frame fresh.
+ */
+#include <gst/video/video.h>
+
+#include "frame-pool.h"
+
+typedef struct
+{
+  guint n_buffers;
+  GstAllocator *allocator;
+} FramePool;
+
+static void
+frame_pool_free (FramePool * fp)
+{
+  if (fp->allocator)
+    gst_object_unref (fp->allocator);
+  g_free (fp);
+}
+
+static GstPadProbeReturn
+allocation_probe (GstPad * pad, GstPadProbeInfo * info, FramePool * fp)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  guint n_buffers = fp->n_buffers;
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstVideoInfo vinfo;
+  GstCaps *caps;
+
+  /* Only on the way in, not again with appsink's answer */
+  if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION ||
+      !(info->type & GST_PAD_PROBE_TYPE_PUSH))
+    return GST_PAD_PROBE_OK;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps == NULL || !gst_video_info_from_caps (&vinfo, caps))
+    return GST_PAD_PROBE_OK;
+
+  /* A new pool each time, the old one may still have frames out with
+   * the old caps */
+  pool = gst_video_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, vinfo.size, n_buffers,
+      n_buffers);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (fp->allocator)
+    gst_buffer_pool_config_set_allocator (config, fp->allocator, NULL);
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    gst_object_unref (pool);
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* We map frames with the video meta, so padded strides are fine */
+  gst_query_add_allocation_pool (query, pool, vinfo.size, n_buffers,
+      n_buffers);
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  if (fp->allocator)
+    gst_query_add_allocation_param (query, fp->allocator, NULL);
+  gst_object_unref (pool);
+
+  /* The answer is in the query, appsink needn't see it */
+  return GST_PAD_PROBE_HANDLED;
+}
+
+void
+frame_pool_attach (GstElement * appsink, guint n_buffers,
+    GstAllocator * allocator)
+{
+  GstPad *pad = gst_element_get_static_pad (appsink, "sink");
+  FramePool *fp = g_new0 (FramePool, 1);
+
+  fp->n_buffers = n_buffers;
+  if (allocator)
+    fp->allocator = gst_object_ref (allocator);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+      (GstPadProbeCallback) allocation_probe, fp,
+      (GDestroyNotify) frame_pool_free);
+  gst_object_unref (pad);
+
+  /* The last sample would keep one frame out of the pool for nothing */
+  g_object_set (appsink, "enable-last-sample", FALSE, NULL);
+}
@@ -0,0 +1,21 @@
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Answer the allocation queries reaching @appsink with a video buffer
+ * pool of exactly @n_buffers frames. Upstream then decodes into those
+ * frames, and each one goes back to the pool once the application
+ * drops its sample, instead of a new frame being allocated every time.
+ *
+ * @n_buffers has to cover what the application holds on to, the
+ * appsink's max-buffers and any queues on the way, or upstream waits
+ * for a frame forever. The frames come from @allocator, or from system
+ * memory if it's NULL */
+void frame_pool_attach (GstElement * appsink, guint n_buffers,
+    GstAllocator * allocator);
+
+G_END_DECLS
+#endif /* __FRAME_POOL_H__ */
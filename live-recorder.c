@@ -0,0 +1,449 @@
+/* The v4l2src ! x264enc ! mp4mux recipe from command-lines.txt as a
+ * recorder: the recording is rolled over into a new file every few
+ * seconds, always on a keyframe, and each file is a fragmented MP4 that
+ * stays playable up to its last fragment if we crash, so at most a
+ * second of video is ever lost.
+ *
+ *   ./live-recorder -D /dev/video0 -d 60 -o rec-%05d.mp4
+ *   ./live-recorder --test-source --compare-presets
+ *
+ * Encoder presets trade speed and latency against quality. The
+ * recorder measures how long each frame spent in the encoder, and how
+ * many frames had to be dropped in front of it because it didn't keep
+ * up with the live source.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gst/gst.h>
+
+/* Frames that can wait for the encoder before the oldest are dropped */
+#define MAX_QUEUED_FRAMES 5
+/* How long each preset runs for with --compare-presets */
+#define COMPARE_DURATION 10
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *speed_preset;
+  gboolean zerolatency;
+  gboolean sliced_threads;
+} EncoderPreset;
+
+static const EncoderPreset presets[] = {
+  {"realtime", "ultrafast", TRUE, TRUE},
+  {"low-latency", "superfast", TRUE, TRUE},
+  {"balanced", "veryfast", FALSE, FALSE},
+  {"quality", "medium", FALSE, FALSE},
+};
+
+static gchar *device = NULL;
+static gboolean test_source = FALSE;
+static gchar *video_caps = NULL;
+static gchar *location = NULL;
+static gint segment_duration = 60;
+static gint duration = 0;
+static gchar *preset_name = NULL;
+static gchar *speed_preset = NULL;
+static gint sliced_threads = -1;
+static gint threads = 0;
+static gint bitrate = 0;
+static gboolean compare_presets = FALSE;
+
+static GOptionEntry opt_entries[] = {
+  {"device", 'D', 0, G_OPTION_ARG_STRING, &device,
+      "Video device (default: /dev/video0)", "DEVICE"},
+  {"test-source", 't', 0, G_OPTION_ARG_NONE, &test_source,
+      "Record a live test pattern instead of a camera", NULL},
+  {"caps", 'c', 0, G_OPTION_ARG_STRING, &video_caps,
+      "Video to capture (default: video/x-raw,width=1280,height=720,"
+        "framerate=30/1)", "CAPS"},
+  {"output", 'o', 0, G_OPTION_ARG_STRING, &location,
+      "File name pattern for the segments (default: rec-%05d.mp4)",
+      "PATTERN"},
+  {"segment-duration", 'd', 0, G_OPTION_ARG_INT, &segment_duration,
+      "Start a new file every N seconds (default: 60)", "N"},
+  {"duration", 'n', 0, G_OPTION_ARG_INT, &duration,
+      "Stop after N seconds (default: until Ctrl-C)", "N"},
+  {"preset", 'p', 0, G_OPTION_ARG_STRING, &preset_name,
+      "Encoder preset: realtime, low-latency, balanced or quality "
+        "(default: low-latency)", "NAME"},
+  {"speed-preset", 0, 0, G_OPTION_ARG_STRING, &speed_preset,
+      "Override the x264 speed preset (ultrafast ... veryslow)", "NAME"},
+  {"sliced-threads", 0, 0, G_OPTION_ARG_INT, &sliced_threads,
+      "1 to encode each frame with several threads, 0 for a thread per "
+        "frame (default: from the preset)", "0|1"},
+  {"threads", 'j', 0, G_OPTION_ARG_INT, &threads,
+      "Encoder threads (default: 0, automatic)", "N"},
+  {"bitrate", 'b', 0, G_OPTION_ARG_INT, &bitrate,
+      "Bitrate in kbit/s (default: x264enc's)", "KBPS"},
+  {"compare-presets", 'C', 0, G_OPTION_ARG_NONE, &compare_presets,
+      "Record with every preset in turn and compare them", NULL},
+  {NULL}
+};
+
+typedef struct
+{
+  GMainLoop *loop;
+  GstElement *pipeline;
+  gboolean stopping;
+
+  /* The probes run on the streaming threads */
+  GMutex lock;
+  /* PTS -> monotonic time the frame went into the encoder */
+  GHashTable *in_encoder;
+  guint64 captured;
+  guint64 encoded;
+  gint64 latency_sum;
+  gint64 latency_max;
+} Recording;
+
+static GstElement *
+create_element (const gchar * type, const gchar * name)
+{
+  GstElement *e;
+
+  e = gst_element_factory_make (type, name);
+  if (!e) {
+    g_print ("Failed to create element %s\n", type);
+    exit (1);
+  }
+
+  return e;
+}
+
+static const EncoderPreset *
+find_preset (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (presets); i++)
+    if (g_str_equal (presets[i].name, name))
+      return &presets[i];
+
+  return NULL;
+}
+
+static GstPadProbeReturn
+capture_probe (GstPad * pad, GstPadProbeInfo * info, Recording * rec)
+{
+  g_mutex_lock (&rec->lock);
+  rec->captured++;
+  g_mutex_unlock (&rec->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+encoder_in_probe (GstPad * pad, GstPadProbeInfo * info, Recording * rec)
+{
+  GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 *key, *now;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return GST_PAD_PROBE_OK;
+
+  key = g_new (gint64, 1);
+  *key = pts;
+  now = g_new (gint64, 1);
+  *now = g_get_monotonic_time ();
+  g_mutex_lock (&rec->lock);
+  g_hash_table_insert (rec->in_encoder, key, now);
+  g_mutex_unlock (&rec->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Frames come out in a different order with B-frames, so match them
+ * up by PTS */
+static GstPadProbeReturn
+encoder_out_probe (GstPad * pad, GstPadProbeInfo * info, Recording * rec)
+{
+  GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 now = g_get_monotonic_time (), *in, latency;
+
+  g_mutex_lock (&rec->lock);
+  in = g_hash_table_lookup (rec->in_encoder, &pts);
+  if (in) {
+    latency = now - *in;
+    rec->latency_sum += latency;
+    rec->latency_max = MAX (rec->latency_max, latency);
+    rec->encoded++;
+    g_hash_table_remove (rec->in_encoder, &pts);
+  }
+  g_mutex_unlock (&rec->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_probe (GstElement * pipeline, const gchar * element, const gchar * pad,
+    GstPadProbeCallback callback, Recording * rec)
+{
+  GstElement *e;
+  GstPad *p;
+
+  e = gst_bin_get_by_name (GST_BIN (pipeline), element);
+  p = gst_element_get_static_pad (e, pad);
+  gst_pad_add_probe (p, GST_PAD_PROBE_TYPE_BUFFER, callback, rec, NULL);
+  gst_object_unref (p);
+  gst_object_unref (e);
+}
+
+/* EOS makes the muxer finish the last file properly */
+static gboolean
+stop_recording (Recording * rec)
+{
+  if (!rec->stopping) {
+    g_print ("Stopping\n");
+    rec->stopping = TRUE;
+    gst_element_send_event (rec->pipeline, gst_event_new_eos ());
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+handle_bus_msg (GstBus * bus, GstMessage * msg, Recording * rec)
+{
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:
+      g_main_loop_quit (rec->loop);
+      break;
+    case GST_MESSAGE_ERROR:{
+      GError *err = NULL;
+      gchar *dbg_info = NULL;
+
+      gst_message_parse_error (msg, &err, &dbg_info);
+      g_printerr ("ERROR from element %s: %s\n",
+          GST_OBJECT_NAME (msg->src), err->message);
+      g_printerr ("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+      g_error_free (err);
+      g_free (dbg_info);
+
+      g_main_loop_quit (rec->loop);
+      break;
+    }
+    case GST_MESSAGE_ELEMENT:{
+      const GstStructure *s = gst_message_get_structure (msg);
+
+      /* From splitmuxsink */
+      if (gst_structure_has_name (s, "splitmuxsink-fragment-opened"))
+        g_print ("Recording to %s\n",
+            gst_structure_get_string (s, "location"));
+      break;
+    }
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static GstElement *
+build_pipeline (const EncoderPreset * preset, const gchar * pattern,
+    Recording * rec)
+{
+  GstElement *pipeline, *enc, *sink, *mux;
+  GError *err = NULL;
+  gchar *desc, *source;
+  gboolean sliced;
+
+  if (test_source)
+    source = g_strdup ("videotestsrc is-live=true");
+  else
+    source = g_strdup_printf ("v4l2src device=%s", device);
+
+  /* A leaky queue in front of the encoder: if it falls behind, the
+   * oldest frames go, not the live source */
+  desc = g_strdup_printf ("%s name=src ! %s ! videoconvert ! "
+      "queue leaky=downstream max-size-buffers=%d max-size-bytes=0 "
+      "max-size-time=0 ! x264enc name=enc ! h264parse ! "
+      "splitmuxsink name=sink", source, video_caps, MAX_QUEUED_FRAMES);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (source);
+  if (pipeline == NULL) {
+    g_print ("Failed to create pipeline '%s': %s\n", desc, err->message);
+    exit (1);
+  }
+  g_free (desc);
+
+  sliced = sliced_threads >= 0 ? sliced_threads : preset->sliced_threads;
+  enc = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  gst_util_set_object_arg (G_OBJECT (enc), "speed-preset",
+      speed_preset ? speed_preset : preset->speed_preset);
+  if (preset->zerolatency)
+    gst_util_set_object_arg (G_OBJECT (enc), "tune", "zerolatency");
+  g_object_set (enc, "sliced-threads", sliced, "threads", threads, NULL);
+  if (bitrate > 0)
+    g_object_set (enc, "bitrate", bitrate, NULL);
+  gst_object_unref (enc);
+
+  /* With fragments, the file header is written up front and everything
+   * up to the last fragment survives a crash */
+  mux = create_element ("mp4mux", NULL);
+  g_object_set (mux, "fragment-duration", 1000, NULL);
+
+  /* Ask the encoder for a keyframe where each file has to start, so
+   * the files come out at the length we asked for */
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (sink, "location", pattern, "muxer", mux,
+      "max-size-time", (guint64) segment_duration * GST_SECOND,
+      "send-keyframe-requests", TRUE, NULL);
+  gst_object_unref (sink);
+
+  add_probe (pipeline, "src", "src", (GstPadProbeCallback) capture_probe,
+      rec);
+  add_probe (pipeline, "enc", "sink", (GstPadProbeCallback) encoder_in_probe,
+      rec);
+  add_probe (pipeline, "enc", "src", (GstPadProbeCallback) encoder_out_probe,
+      rec);
+
+  return pipeline;
+}
+
+/* Record until Ctrl-C or @seconds are up, and report how it went */
+static gboolean
+record (const EncoderPreset * preset, const gchar * pattern, gint seconds,
+    Recording * rec)
+{
+  GstBus *bus;
+  guint bus_watch, sigint_watch, timeout = 0;
+  gboolean ok;
+
+  memset (rec, 0, sizeof (Recording));
+  g_mutex_init (&rec->lock);
+  rec->in_encoder = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, g_free);
+  rec->loop = g_main_loop_new (NULL, FALSE);
+  rec->pipeline = build_pipeline (preset, pattern, rec);
+
+  bus = gst_element_get_bus (rec->pipeline);
+  bus_watch = gst_bus_add_watch (bus, (GstBusFunc) handle_bus_msg, rec);
+  gst_object_unref (bus);
+
+  sigint_watch = g_unix_signal_add (SIGINT, (GSourceFunc) stop_recording,
+      rec);
+  if (seconds > 0)
+    timeout = g_timeout_add_seconds (seconds, (GSourceFunc) stop_recording,
+        rec);
+
+  ok = gst_element_set_state (rec->pipeline, GST_STATE_PLAYING) !=
+      GST_STATE_CHANGE_FAILURE;
+  if (ok)
+    g_main_loop_run (rec->loop);
+  else
+    g_printerr ("Could not start recording\n");
+
+  g_source_remove (bus_watch);
+  g_source_remove (sigint_watch);
+  if (timeout)
+    g_source_remove (timeout);
+  gst_element_set_state (rec->pipeline, GST_STATE_NULL);
+  gst_object_unref (rec->pipeline);
+  g_main_loop_unref (rec->loop);
+  g_hash_table_unref (rec->in_encoder);
+  g_mutex_clear (&rec->lock);
+
+  /* Only a recording we stopped ourselves ran to the end */
+  return ok && rec->stopping;
+}
+
+static void
+print_recording (const EncoderPreset * preset, Recording * rec)
+{
+  guint64 dropped = rec->captured > rec->encoded ?
+      rec->captured - rec->encoded : 0;
+
+  g_print ("%-12s %-10s %5" G_GUINT64_FORMAT " frames, %4" G_GUINT64_FORMAT
+      " dropped (%.1f%%), encode latency mean %.1f ms, max %.1f ms\n",
+      preset->name, speed_preset ? speed_preset : preset->speed_preset,
+      rec->captured, dropped, rec->captured ?
+      100.0 * dropped / rec->captured : 0.0,
+      rec->encoded ? rec->latency_sum / 1000.0 / rec->encoded : 0.0,
+      rec->latency_max / 1000.0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  const EncoderPreset *preset;
+  Recording rec;
+  guint i;
+
+  opt_ctx = g_option_context_new ("- Record a camera into segmented MP4s");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (device == NULL)
+    device = g_strdup ("/dev/video0");
+  if (video_caps == NULL)
+    video_caps = g_strdup ("video/x-raw,width=1280,height=720,"
+        "framerate=30/1");
+  if (location == NULL)
+    location = g_strdup ("rec-%05d.mp4");
+  if (preset_name == NULL)
+    preset_name = g_strdup ("low-latency");
+  if (segment_duration <= 0)
+    segment_duration = 60;
+
+  if (compare_presets) {
+    gchar *tmpdir, *pattern;
+
+    /* Nobody wants these files, just the numbers */
+    tmpdir = g_dir_make_tmp ("live-recorder-XXXXXX", &err);
+    if (tmpdir == NULL)
+      g_error ("Could not create a temporary directory: %s", err->message);
+
+    for (i = 0; i < G_N_ELEMENTS (presets); i++) {
+      gchar *name;
+      GDir *dir;
+      const gchar *f;
+
+      g_print ("Recording %d s with preset %s\n",
+          duration > 0 ? duration : COMPARE_DURATION, presets[i].name);
+      pattern = g_build_filename (tmpdir, "rec-%05d.mp4", NULL);
+      if (!record (&presets[i], pattern, duration > 0 ? duration :
+              COMPARE_DURATION, &rec))
+        return 1;
+      print_recording (&presets[i], &rec);
+      g_free (pattern);
+
+      dir = g_dir_open (tmpdir, 0, NULL);
+      while (dir && (f = g_dir_read_name (dir))) {
+        name = g_build_filename (tmpdir, f, NULL);
+        g_unlink (name);
+        g_free (name);
+      }
+      if (dir)
+        g_dir_close (dir);
+    }
+    g_rmdir (tmpdir);
+    g_free (tmpdir);
+  } else {
+    preset = find_preset (preset_name);
+    if (preset == NULL) {
+      g_printerr ("Unknown preset %s\n", preset_name);
+      return 1;
+    }
+    record (preset, location, duration, &rec);
+    print_recording (preset, &rec);
+  }
+
+  g_free (device);
+  g_free (video_caps);
+  g_free (location);
+  g_free (preset_name);
+  g_free (speed_preset);
+
+  return 0;
+}
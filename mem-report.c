@@ -0,0 +1,541 @@
+/* Memory accounting for playbin based players: the process RSS, the
+ * buffers held by buffer pools, the data waiting in queues and the
+ * downloaded data, sampled over time with the peak of each kept.
+ *
+ * Pools are found from the buffers leaving each element, a pool's
+ * buffers are counted as they come by, since a pool keeps reusing the
+ * same ones. The same src pad probes see the answered allocation
+ * queries, which is where the number of buffers in a pool can be
+ * capped. An element that gets no pool proposed from downstream makes
+ * its own, unlimited one, and that can't be capped from outside.
+ *
+ * The same probes count allocations per element: a buffer leaving an
+ * element that no src pad has seen before was allocated by it, be it
+ * fresh or the first use of a pool buffer. Buffers passed through or
+ * recycled by a pool were seen already.
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "mem-report.h"
+
+/* How often to sample, and apply the queue limits decodebin may have
+ * reset */
+#define SAMPLE_INTERVAL 250
+
+typedef struct
+{
+  MemReport *report;
+  gchar *name;
+  guint64 buffers;
+  guint64 allocations;
+  /* At the last print */
+  guint64 last_buffers;
+  guint64 last_allocations;
+} AllocStats;
+
+typedef struct
+{
+  GstBufferPool *pool;
+  /* Every buffer seen from it */
+  GHashTable *buffers;
+} TrackedPool;
+
+struct _MemReport
+{
+  GstElement *playbin;
+  gulong added_id;
+  gulong removed_id;
+
+  guint max_queue_bytes;
+  guint max_pool_buffers;
+
+  guint timeout_id;
+  guint print_interval;
+  gint64 last_print;
+
+  /* Filled from the streaming threads, under the lock */
+  GMutex lock;
+  GPtrArray *queues;
+  GPtrArray *pools;
+  GPtrArray *elements;
+
+  gboolean print_allocations;
+  MemSample peak;
+};
+
+static GQuark seen_quark;
+
+static void
+alloc_stats_free (AllocStats * stats)
+{
+  g_free (stats->name);
+  g_free (stats);
+}
+
+static void
+tracked_pool_free (TrackedPool * tp)
+{
+  g_hash_table_unref (tp->buffers);
+  gst_object_unref (tp->pool);
+  g_free (tp);
+}
+
+/* Call with the lock held */
+static void
+track_pool_buffer (MemReport * report, GstBuffer * buf)
+{
+  TrackedPool *tp = NULL;
+  guint i;
+
+  for (i = 0; i < report->pools->len; i++) {
+    tp = g_ptr_array_index (report->pools, i);
+    if (tp->pool == buf->pool)
+      break;
+    tp = NULL;
+  }
+  if (tp == NULL) {
+    tp = g_new0 (TrackedPool, 1);
+    tp->pool = gst_object_ref (buf->pool);
+    tp->buffers = g_hash_table_new (NULL, NULL);
+    g_ptr_array_add (report->pools, tp);
+  }
+  g_hash_table_add (tp->buffers, buf);
+}
+
+/* Lower the maximum of the pools downstream proposes. A pool can't go
+ * below the minimum downstream needs to work */
+static void
+limit_pools (MemReport * report, GstQuery * query)
+{
+  GstBufferPool *pool;
+  guint i, size, min, max;
+
+  for (i = 0; i < gst_query_get_n_allocation_pools (query); i++) {
+    gst_query_parse_nth_allocation_pool (query, i, &pool, &size, &min, &max);
+    if (max == 0 || max > report->max_pool_buffers) {
+      max = MAX (min, report->max_pool_buffers);
+      gst_query_set_nth_allocation_pool (query, i, pool, size, min, max);
+    }
+    if (pool)
+      gst_object_unref (pool);
+  }
+}
+
+static GstPadProbeReturn
+src_pad_probe (GstPad * pad, GstPadProbeInfo * info, AllocStats * stats)
+{
+  MemReport *report = stats->report;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstMiniObject *buf = GST_PAD_PROBE_INFO_DATA (info);
+    gboolean fresh = gst_mini_object_get_qdata (buf, seen_quark) == NULL;
+
+    /* Pool buffers keep this while they're in the pool */
+    if (fresh)
+      gst_mini_object_set_qdata (buf, seen_quark, GINT_TO_POINTER (1), NULL);
+
+    g_mutex_lock (&report->lock);
+    stats->buffers++;
+    if (fresh)
+      stats->allocations++;
+    if (GST_BUFFER (buf)->pool)
+      track_pool_buffer (report, GST_BUFFER (buf));
+    g_mutex_unlock (&report->lock);
+  } else if ((info->type & GST_PAD_PROBE_TYPE_PULL) &&
+      GST_QUERY_TYPE (GST_PAD_PROBE_INFO_QUERY (info)) == GST_QUERY_ALLOCATION
+      && report->max_pool_buffers) {
+    /* On the way back, with downstream's answer filled in */
+    limit_pools (report, GST_PAD_PROBE_INFO_QUERY (info));
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+watch_pad (GstPad * pad, AllocStats * stats)
+{
+  /* A pad can show up both from the signal and the iterator */
+  GST_OBJECT_LOCK (pad);
+  if (g_object_get_data (G_OBJECT (pad), "mem-report")) {
+    GST_OBJECT_UNLOCK (pad);
+    return;
+  }
+  g_object_set_data (G_OBJECT (pad), "mem-report", stats);
+  GST_OBJECT_UNLOCK (pad);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+      (GstPadProbeCallback) src_pad_probe, stats, NULL);
+}
+
+static void
+watch_pad_value (const GValue * value, AllocStats * stats)
+{
+  watch_pad (g_value_get_object (value), stats);
+}
+
+static void
+pad_added (GstElement * element, GstPad * pad, AllocStats * stats)
+{
+  if (GST_PAD_IS_SRC (pad))
+    watch_pad (pad, stats);
+}
+
+static gboolean
+is_queue (GstElement * element)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+
+  return g_str_equal (name, "multiqueue") || g_str_equal (name, "queue") ||
+      g_str_equal (name, "queue2") || g_str_equal (name, "downloadbuffer");
+}
+
+static void
+deep_element_added (GstBin * playbin, GstBin * bin, GstElement * element,
+    MemReport * report)
+{
+  AllocStats *stats;
+  GstIterator *it;
+
+  if (GST_IS_BIN (element))
+    return;
+
+  stats = g_new0 (AllocStats, 1);
+  stats->report = report;
+  stats->name = gst_element_get_name (element);
+
+  g_mutex_lock (&report->lock);
+  g_ptr_array_add (report->elements, stats);
+  if (is_queue (element))
+    g_ptr_array_add (report->queues, gst_object_ref (element));
+  g_mutex_unlock (&report->lock);
+
+  /* Connect first, so no pad is missed */
+  g_signal_connect (element, "pad-added", G_CALLBACK (pad_added), stats);
+  it = gst_element_iterate_src_pads (element);
+  gst_iterator_foreach (it, (GstIteratorForeachFunction) watch_pad_value,
+      stats);
+  gst_iterator_free (it);
+}
+
+static void
+deep_element_removed (GstBin * playbin, GstBin * bin, GstElement * element,
+    MemReport * report)
+{
+  g_mutex_lock (&report->lock);
+  g_ptr_array_remove (report->queues, element);
+  g_mutex_unlock (&report->lock);
+}
+
+static guint64
+get_level (GObject * queue)
+{
+  guint level = 0;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (queue),
+          "current-level-bytes"))
+    g_object_get (queue, "current-level-bytes", &level, NULL);
+
+  return level;
+}
+
+/* multiqueue keeps the levels on its pads */
+static guint64
+get_multiqueue_level (GstElement * mq)
+{
+  GstIterator *it = gst_element_iterate_sink_pads (mq);
+  GValue item = G_VALUE_INIT;
+  guint64 level = 0;
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    level += get_level (g_value_get_object (&item));
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return level;
+}
+
+/* The byte ranges a download queue has stored, capped at the size of
+ * its ring buffer if it has one */
+static guint64
+get_downloaded (GstElement * queue)
+{
+  GstQuery *query = gst_query_new_buffering (GST_FORMAT_BYTES);
+  guint64 total = 0, ring_size = 0;
+  gint64 start, stop;
+  guint i;
+
+  if (gst_element_query (queue, query)) {
+    for (i = 0; i < gst_query_get_n_buffering_ranges (query); i++) {
+      if (gst_query_parse_nth_buffering_range (query, i, &start, &stop) &&
+          stop > start)
+        total += stop - start;
+    }
+  }
+  gst_query_unref (query);
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (queue),
+          "ring-buffer-max-size"))
+    g_object_get (queue, "ring-buffer-max-size", &ring_size, NULL);
+  if (ring_size > 0)
+    total = MIN (total, ring_size);
+
+  return total;
+}
+
+static gboolean
+is_download (GstElement * queue)
+{
+  GstElementFactory *factory = gst_element_get_factory (queue);
+  gchar *temp_location = NULL;
+  gboolean ret;
+
+  if (g_str_equal (GST_OBJECT_NAME (factory), "downloadbuffer"))
+    return TRUE;
+  if (!g_str_equal (GST_OBJECT_NAME (factory), "queue2"))
+    return FALSE;
+
+  /* queue2 only downloads to a file when playbin asked for it */
+  g_object_get (queue, "temp-location", &temp_location, NULL);
+  ret = temp_location != NULL;
+  g_free (temp_location);
+
+  return ret;
+}
+
+static void
+apply_queue_limit (MemReport * report, GstElement * queue)
+{
+  guint cur;
+
+  g_object_get (queue, "max-size-bytes", &cur, NULL);
+  if (cur != report->max_queue_bytes)
+    g_object_set (queue, "max-size-bytes", report->max_queue_bytes, NULL);
+}
+
+static guint64
+get_rss (void)
+{
+  gchar *status, *line;
+  guint64 rss = 0;
+
+  if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+    return 0;
+  line = strstr (status, "VmRSS:");
+  if (line)
+    rss = g_ascii_strtoull (line + strlen ("VmRSS:"), NULL, 10) * 1024;
+  g_free (status);
+
+  return rss;
+}
+
+void
+mem_report_sample (MemReport * report, MemSample * sample)
+{
+  GPtrArray *queues;
+  guint i, size, min, max;
+
+  memset (sample, 0, sizeof (MemSample));
+  sample->rss = get_rss ();
+
+  g_mutex_lock (&report->lock);
+  for (i = 0; i < report->pools->len;) {
+    TrackedPool *tp = g_ptr_array_index (report->pools, i);
+    GstStructure *config;
+    guint n;
+
+    /* Nobody else has it any more */
+    if (GST_OBJECT_REFCOUNT_VALUE (tp->pool) == 1) {
+      g_ptr_array_remove_index_fast (report->pools, i);
+      continue;
+    }
+    i++;
+
+    /* A stopped pool freed its buffers */
+    if (!gst_buffer_pool_is_active (tp->pool)) {
+      g_hash_table_remove_all (tp->buffers);
+      continue;
+    }
+
+    config = gst_buffer_pool_get_config (tp->pool);
+    gst_buffer_pool_config_get_params (config, NULL, &size, &min, &max);
+    gst_structure_free (config);
+
+    n = g_hash_table_size (tp->buffers);
+    if (max > 0)
+      n = MIN (n, max);
+    sample->pool_buffers += n;
+    sample->pool_bytes += (guint64) n *size;
+    sample->n_pools++;
+  }
+  queues = g_ptr_array_new_with_free_func (gst_object_unref);
+  for (i = 0; i < report->queues->len; i++)
+    g_ptr_array_add (queues, gst_object_ref (g_ptr_array_index
+            (report->queues, i)));
+  g_mutex_unlock (&report->lock);
+
+  /* The queues take their own locks, so without ours */
+  for (i = 0; i < queues->len; i++) {
+    GstElement *queue = g_ptr_array_index (queues, i);
+    GstElementFactory *factory = gst_element_get_factory (queue);
+
+    if (is_download (queue)) {
+      sample->download_bytes += get_downloaded (queue);
+      continue;
+    }
+
+    if (g_str_equal (GST_OBJECT_NAME (factory), "multiqueue"))
+      sample->queue_bytes += get_multiqueue_level (queue);
+    else
+      sample->queue_bytes += get_level (G_OBJECT (queue));
+    if (report->max_queue_bytes)
+      apply_queue_limit (report, queue);
+  }
+  g_ptr_array_free (queues, TRUE);
+
+  report->peak.rss = MAX (report->peak.rss, sample->rss);
+  report->peak.pool_bytes = MAX (report->peak.pool_bytes, sample->pool_bytes);
+  report->peak.pool_buffers =
+      MAX (report->peak.pool_buffers, sample->pool_buffers);
+  report->peak.n_pools = MAX (report->peak.n_pools, sample->n_pools);
+  report->peak.queue_bytes =
+      MAX (report->peak.queue_bytes, sample->queue_bytes);
+  report->peak.download_bytes =
+      MAX (report->peak.download_bytes, sample->download_bytes);
+}
+
+static void
+print_sample (const gchar * what, const MemSample * s)
+{
+  g_print ("%s: RSS %" G_GUINT64_FORMAT " kB, %u pools with %u buffers %"
+      G_GUINT64_FORMAT " kB, queues %" G_GUINT64_FORMAT " kB, download %"
+      G_GUINT64_FORMAT " kB\n", what, s->rss / 1024, s->n_pools,
+      s->pool_buffers, s->pool_bytes / 1024, s->queue_bytes / 1024,
+      s->download_bytes / 1024);
+}
+
+/* Per element, since the last time, or in total */
+static void
+print_allocations (MemReport * report, gboolean total)
+{
+  guint i;
+
+  g_print (total ? "Allocations in total:\n" :
+      "Allocations since the last report:\n");
+  g_mutex_lock (&report->lock);
+  for (i = 0; i < report->elements->len; i++) {
+    AllocStats *stats = g_ptr_array_index (report->elements, i);
+    guint64 buffers = stats->buffers, allocations = stats->allocations;
+
+    if (!total) {
+      buffers -= stats->last_buffers;
+      allocations -= stats->last_allocations;
+      stats->last_buffers = stats->buffers;
+      stats->last_allocations = stats->allocations;
+    }
+    if (buffers == 0)
+      continue;
+    g_print ("  %-24s %8" G_GUINT64_FORMAT " of %8" G_GUINT64_FORMAT
+        " buffers, %.2f per buffer\n", stats->name, allocations, buffers,
+        (gdouble) allocations / buffers);
+  }
+  g_mutex_unlock (&report->lock);
+}
+
+static gboolean
+sample_timeout (MemReport * report)
+{
+  gint64 now = g_get_monotonic_time ();
+  MemSample sample;
+
+  mem_report_sample (report, &sample);
+  if (report->print_interval &&
+      now - report->last_print >= report->print_interval * G_USEC_PER_SEC) {
+    print_sample ("Memory", &sample);
+    if (report->print_allocations)
+      print_allocations (report, FALSE);
+    report->last_print = now;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+MemReport *
+mem_report_new (GstElement * playbin)
+{
+  MemReport *report = g_new0 (MemReport, 1);
+
+  report->playbin = gst_object_ref (playbin);
+  g_mutex_init (&report->lock);
+  report->queues = g_ptr_array_new_with_free_func (gst_object_unref);
+  report->pools = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      tracked_pool_free);
+  report->elements = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      alloc_stats_free);
+  seen_quark = g_quark_from_static_string ("mem-report-seen");
+
+  report->added_id = g_signal_connect (playbin, "deep-element-added",
+      G_CALLBACK (deep_element_added), report);
+  report->removed_id = g_signal_connect (playbin, "deep-element-removed",
+      G_CALLBACK (deep_element_removed), report);
+
+  return report;
+}
+
+void
+mem_report_set_limits (MemReport * report, guint max_queue_bytes,
+    guint max_pool_buffers, guint64 max_download_bytes)
+{
+  report->max_queue_bytes = max_queue_bytes;
+  report->max_pool_buffers = max_pool_buffers;
+
+  /* playbin passes these on to its buffering and download queues */
+  if (max_queue_bytes)
+    g_object_set (report->playbin, "buffer-size",
+        (gint) MIN (max_queue_bytes, G_MAXINT), NULL);
+  if (max_download_bytes)
+    g_object_set (report->playbin, "ring-buffer-max-size",
+        max_download_bytes, NULL);
+}
+
+void
+mem_report_start (MemReport * report, guint print_interval,
+    gboolean print_allocations)
+{
+  report->print_interval = print_interval;
+  report->print_allocations = print_allocations;
+  report->last_print = g_get_monotonic_time ();
+  report->timeout_id = g_timeout_add (SAMPLE_INTERVAL,
+      (GSourceFunc) sample_timeout, report);
+}
+
+void
+mem_report_print_peaks (MemReport * report)
+{
+  MemSample sample;
+
+  /* One more, for whatever happened since the last */
+  mem_report_sample (report, &sample);
+  print_sample ("Memory peaks", &report->peak);
+  if (report->print_allocations)
+    print_allocations (report, TRUE);
+}
+
+void
+mem_report_free (MemReport * report)
+{
+  if (report->timeout_id)
+    g_source_remove (report->timeout_id);
+  g_signal_handler_disconnect (report->playbin, report->added_id);
+  g_signal_handler_disconnect (report->playbin, report->removed_id);
+  gst_object_unref (report->playbin);
+  g_ptr_array_free (report->queues, TRUE);
+  g_ptr_array_free (report->pools, TRUE);
+  g_ptr_array_free (report->elements, TRUE);
+  g_mutex_clear (&report->lock);
+  g_free (report);
+}
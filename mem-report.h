@@ -0,0 +1,43 @@
+#ifndef __MEM_REPORT_H__
+#define __MEM_REPORT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Where a playbin's memory goes, in bytes */
+typedef struct
+{
+  guint64 rss;
+  /* Buffers the buffer pools allocated, and how many pools there are */
+  guint64 pool_bytes;
+  guint pool_buffers;
+  guint n_pools;
+  /* Data waiting in multiqueue, queue and in-memory queue2 */
+  guint64 queue_bytes;
+  /* Downloaded data kept by queue2 and downloadbuffer */
+  guint64 download_bytes;
+} MemSample;
+
+typedef struct _MemReport MemReport;
+
+/* Create before the pipeline leaves NULL, to see every element */
+MemReport *mem_report_new (GstElement * playbin);
+
+/* Caps on every queue's size, every buffer pool's number of buffers
+ * and playbin's download buffer. 0 leaves that one alone */
+void mem_report_set_limits (MemReport * report, guint max_queue_bytes,
+    guint max_pool_buffers, guint64 max_download_bytes);
+
+/* Sample a few times a second, printing every @print_interval seconds
+ * (0 = never). With @print_allocations, also print how many buffers
+ * each element allocated against how many it pushed */
+void mem_report_start (MemReport * report, guint print_interval,
+    gboolean print_allocations);
+
+void mem_report_sample (MemReport * report, MemSample * sample);
+void mem_report_print_peaks (MemReport * report);
+void mem_report_free (MemReport * report);
+
+G_END_DECLS
+#endif /* __MEM_REPORT_H__ */
@@ -0,0 +1,620 @@
+/* An on-disk cache for HTTP media, shared by all the playback-sync
+ * instances on one host, so a group only downloads each file once.
+ *
+ * Entries are keyed by a hash of the URI together with the length and
+ * ETag the server reports, so a changed file gets a new entry instead
+ * of mixing old and new data. Each entry is two files in the user
+ * cache directory:
+ *
+ *   <key>.data  the file contents, filled in chunk by chunk
+ *   <key>.map   one byte per chunk, non-zero once the chunk is complete
+ *
+ * Whoever wants a missing chunk takes a fcntl() lock on its byte in
+ * the map, fetches it with a range request and marks it complete.
+ * Other instances skip locked chunks and read them once they appear,
+ * so several players starting together share the work instead of
+ * racing for it.
+ */
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <gst/app/gstappsrc.h>
+
+#include "download-cache.h"
+
+#define CHUNK_SIZE (1024 * 1024)
+/* How long to leave a chunk another instance is fetching alone */
+#define BUSY_RETRY (200 * G_TIME_SPAN_MILLISECOND)
+/* How often waiting readers look for chunks other instances wrote */
+#define POLL_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+#define READ_BLOCKSIZE (64 * 1024)
+
+struct _DownloadCache
+{
+  gchar *uri;
+  GSocketConnectable *address;
+  gchar *host;
+  gchar *path;
+  gboolean tls;
+
+  guint64 size;
+  guint n_chunks;
+  gint data_fd;
+  gint map_fd;
+
+  GMutex lock;
+  GCond cond;
+  /* Copy of the map file, refreshed whenever we wait */
+  guint8 *chunks;
+  /* Chunks we downloaded ourselves, and chunks we handed out */
+  guint8 *fetched;
+  guint8 *served;
+  gint64 *busy_until;
+  guint wanted_chunk;
+  gboolean stop;
+
+  GThread *fetch_thread;
+  guint64 read_offset;
+
+  /* Statistics */
+  guint initial_chunks;
+  guint hit_chunks;
+  guint miss_chunks;
+  guint64 hit_bytes;
+  guint64 fetched_bytes;
+};
+
+typedef struct
+{
+  GSocketConnection *conn;
+  GDataInputStream *body;
+  gint status;
+  guint64 content_length;
+  guint64 total_length;
+  gchar *etag;
+} HttpResponse;
+
+static void
+http_response_free (HttpResponse * resp)
+{
+  g_clear_object (&resp->body);
+  g_clear_object (&resp->conn);
+  g_free (resp->etag);
+  g_free (resp);
+}
+
+/* Send a request and read the headers, leaving the body in @resp->body.
+ * A @start of G_MAXUINT64 means no Range header */
+static HttpResponse *
+http_request (DownloadCache * cache, const gchar * method, guint64 start,
+    guint64 end, GError ** err)
+{
+  GSocketClient *client;
+  GOutputStream *out;
+  HttpResponse *resp;
+  gchar *request, *range, *line;
+
+  client = g_socket_client_new ();
+  g_socket_client_set_tls (client, cache->tls);
+
+  resp = g_new0 (HttpResponse, 1);
+  resp->conn = g_socket_client_connect (client, cache->address, NULL, err);
+  g_object_unref (client);
+  if (resp->conn == NULL)
+    goto fail;
+
+  if (start != G_MAXUINT64)
+    range = g_strdup_printf ("Range: bytes=%" G_GUINT64_FORMAT "-%"
+        G_GUINT64_FORMAT "\r\n", start, end);
+  else
+    range = g_strdup ("");
+
+  request = g_strdup_printf ("%s %s HTTP/1.1\r\nHost: %s\r\n"
+      "User-Agent: playback-sync\r\n%sConnection: close\r\n\r\n", method,
+      cache->path, cache->host, range);
+  g_free (range);
+
+  out = g_io_stream_get_output_stream (G_IO_STREAM (resp->conn));
+  if (!g_output_stream_write_all (out, request, strlen (request), NULL, NULL,
+          err)) {
+    g_free (request);
+    goto fail;
+  }
+  g_free (request);
+
+  resp->body = g_data_input_stream_new (g_io_stream_get_input_stream
+      (G_IO_STREAM (resp->conn)));
+
+  /* Status line, eg. "HTTP/1.1 206 Partial Content" */
+  line = g_data_input_stream_read_line (resp->body, NULL, NULL, err);
+  if (line == NULL || sscanf (line, "HTTP/%*s %d", &resp->status) != 1) {
+    if (err == NULL || *err == NULL)
+      g_set_error (err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Bad HTTP response from %s", cache->host);
+    g_free (line);
+    goto fail;
+  }
+  g_free (line);
+
+  resp->total_length = G_MAXUINT64;
+  while ((line = g_data_input_stream_read_line (resp->body, NULL, NULL,
+              NULL))) {
+    g_strchomp (line);
+    if (*line == '\0') {
+      g_free (line);
+      break;
+    }
+    if (g_ascii_strncasecmp (line, "Content-Length:", 15) == 0) {
+      resp->content_length = g_ascii_strtoull (line + 15, NULL, 10);
+    } else if (g_ascii_strncasecmp (line, "Content-Range:", 14) == 0) {
+      const gchar *slash = strrchr (line, '/');
+      if (slash && slash[1] != '*')
+        resp->total_length = g_ascii_strtoull (slash + 1, NULL, 10);
+    } else if (g_ascii_strncasecmp (line, "ETag:", 5) == 0) {
+      resp->etag = g_strdup (g_strstrip (line + 5));
+    }
+    g_free (line);
+  }
+
+  return resp;
+
+fail:
+  http_response_free (resp);
+  return NULL;
+}
+
+/* Find the length and identity of the file, without downloading it */
+static gboolean
+http_probe (DownloadCache * cache, gchar ** etag, GError ** err)
+{
+  HttpResponse *resp;
+
+  resp = http_request (cache, "HEAD", G_MAXUINT64, 0, err);
+  if (resp == NULL)
+    return FALSE;
+
+  if (resp->status != 200 || resp->content_length == 0) {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Server answered %d with length %" G_GUINT64_FORMAT
+        ", can't cache this", resp->status, resp->content_length);
+    http_response_free (resp);
+    return FALSE;
+  }
+
+  cache->size = resp->content_length;
+  *etag = g_strdup (resp->etag ? resp->etag : "");
+  http_response_free (resp);
+
+  return TRUE;
+}
+
+static gboolean
+lock_chunk (DownloadCache * cache, guint chunk, gboolean lock)
+{
+  struct flock fl = { 0, };
+
+  fl.l_type = lock ? F_WRLCK : F_UNLCK;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = chunk;
+  fl.l_len = 1;
+
+  return fcntl (cache->map_fd, F_SETLK, &fl) == 0;
+}
+
+/* Pick up chunks other instances completed. Call with the lock held */
+static void
+refresh_map (DownloadCache * cache)
+{
+  if (pread (cache->map_fd, cache->chunks, cache->n_chunks, 0) !=
+      (gssize) cache->n_chunks)
+    g_printerr ("Failed to read the cache map: %s\n", g_strerror (errno));
+}
+
+static guint64
+chunk_length (DownloadCache * cache, guint chunk)
+{
+  guint64 start = (guint64) chunk * CHUNK_SIZE;
+
+  return MIN (CHUNK_SIZE, cache->size - start);
+}
+
+static gboolean
+fetch_chunk (DownloadCache * cache, guint chunk)
+{
+  guint64 start = (guint64) chunk * CHUNK_SIZE;
+  guint64 length = chunk_length (cache, chunk);
+  guint64 done = 0;
+  HttpResponse *resp;
+  GError *err = NULL;
+  gchar *buf;
+  guint8 complete = 1;
+
+  resp = http_request (cache, "GET", start, start + length - 1, &err);
+  if (resp == NULL) {
+    g_printerr ("Cache fetch of chunk %u failed: %s\n", chunk, err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+  if (resp->status != 206 || resp->total_length != cache->size) {
+    g_printerr ("Cache fetch of chunk %u got status %d, expected a range of "
+        "a %" G_GUINT64_FORMAT " byte file\n", chunk, resp->status,
+        cache->size);
+    http_response_free (resp);
+    return FALSE;
+  }
+
+  buf = g_malloc (READ_BLOCKSIZE);
+  while (done < length) {
+    gssize n;
+
+    n = g_input_stream_read (G_INPUT_STREAM (resp->body), buf,
+        MIN (READ_BLOCKSIZE, length - done), NULL, NULL);
+    if (n <= 0)
+      break;
+    if (pwrite (cache->data_fd, buf, n, start + done) != n)
+      break;
+    done += n;
+  }
+  g_free (buf);
+  http_response_free (resp);
+
+  if (done < length) {
+    g_printerr ("Cache fetch of chunk %u stopped after %" G_GUINT64_FORMAT
+        " of %" G_GUINT64_FORMAT " bytes\n", chunk, done, length);
+    return FALSE;
+  }
+
+  /* The data has to be on disk before anyone else is told about it */
+  if (fdatasync (cache->data_fd) != 0 ||
+      pwrite (cache->map_fd, &complete, 1, chunk) != 1)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* The first incomplete chunk from where the reader is, wrapping around so
+ * the whole file ends up in the cache. Call with the lock held */
+static gint
+next_missing_chunk (DownloadCache * cache, gboolean * busy)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  *busy = FALSE;
+  for (i = 0; i < cache->n_chunks; i++) {
+    guint chunk = (cache->wanted_chunk + i) % cache->n_chunks;
+
+    if (cache->chunks[chunk])
+      continue;
+    if (cache->busy_until[chunk] > now) {
+      *busy = TRUE;
+      continue;
+    }
+    return chunk;
+  }
+
+  return -1;
+}
+
+static gpointer
+fetch_thread_func (DownloadCache * cache)
+{
+  g_mutex_lock (&cache->lock);
+  while (!cache->stop) {
+    gboolean busy, ok;
+    gint chunk;
+
+    refresh_map (cache);
+    chunk = next_missing_chunk (cache, &busy);
+    if (chunk < 0) {
+      /* All done, or only waiting for other instances */
+      if (!busy)
+        break;
+      g_cond_wait_until (&cache->cond, &cache->lock,
+          g_get_monotonic_time () + POLL_INTERVAL);
+      continue;
+    }
+
+    if (!lock_chunk (cache, chunk, TRUE)) {
+      /* Someone else is already on it */
+      cache->busy_until[chunk] = g_get_monotonic_time () + BUSY_RETRY;
+      continue;
+    }
+
+    /* They may have finished it just before we got the lock */
+    refresh_map (cache);
+    if (cache->chunks[chunk]) {
+      lock_chunk (cache, chunk, FALSE);
+      continue;
+    }
+
+    g_mutex_unlock (&cache->lock);
+    ok = fetch_chunk (cache, chunk);
+    lock_chunk (cache, chunk, FALSE);
+    g_mutex_lock (&cache->lock);
+
+    if (ok) {
+      cache->chunks[chunk] = 1;
+      cache->fetched[chunk] = 1;
+      cache->fetched_bytes += chunk_length (cache, chunk);
+    } else {
+      /* Back off, then try again */
+      cache->busy_until[chunk] = g_get_monotonic_time () + G_TIME_SPAN_SECOND;
+    }
+    g_cond_broadcast (&cache->cond);
+  }
+  g_mutex_unlock (&cache->lock);
+
+  return NULL;
+}
+
+/* Wait until every chunk of the range is there. Call with the lock held */
+static gboolean
+wait_for_range (DownloadCache * cache, guint64 offset, guint64 length)
+{
+  guint first = offset / CHUNK_SIZE;
+  guint last = (offset + length - 1) / CHUNK_SIZE;
+  guint chunk;
+
+  for (chunk = first; chunk <= last; chunk++) {
+    /* Steer the fetcher to where we're reading */
+    cache->wanted_chunk = chunk;
+    while (!cache->chunks[chunk] && !cache->stop) {
+      g_cond_broadcast (&cache->cond);
+      g_cond_wait_until (&cache->cond, &cache->lock,
+          g_get_monotonic_time () + POLL_INTERVAL);
+      refresh_map (cache);
+    }
+    if (cache->stop)
+      return FALSE;
+
+    if (!cache->served[chunk]) {
+      cache->served[chunk] = 1;
+      if (cache->fetched[chunk]) {
+        cache->miss_chunks++;
+      } else {
+        cache->hit_chunks++;
+        cache->hit_bytes += chunk_length (cache, chunk);
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+need_data (GstAppSrc * appsrc, guint length, DownloadCache * cache)
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  guint64 offset = cache->read_offset;
+  gssize n;
+
+  if (offset >= cache->size) {
+    gst_app_src_end_of_stream (appsrc);
+    return;
+  }
+  if (length == 0)
+    length = READ_BLOCKSIZE;
+  length = MIN (length, cache->size - offset);
+
+  g_mutex_lock (&cache->lock);
+  if (!wait_for_range (cache, offset, length)) {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+  g_mutex_unlock (&cache->lock);
+
+  buffer = gst_buffer_new_allocate (NULL, length, NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  n = pread (cache->data_fd, map.data, length, offset);
+  gst_buffer_unmap (buffer, &map);
+
+  if (n != (gssize) length) {
+    g_printerr ("Failed to read the cache: %s\n", g_strerror (errno));
+    gst_buffer_unref (buffer);
+    gst_app_src_end_of_stream (appsrc);
+    return;
+  }
+
+  GST_BUFFER_OFFSET (buffer) = offset;
+  cache->read_offset = offset + length;
+  gst_app_src_push_buffer (appsrc, buffer);
+}
+
+static gboolean
+seek_data (GstAppSrc * appsrc, guint64 offset, DownloadCache * cache)
+{
+  cache->read_offset = offset;
+  return offset <= cache->size;
+}
+
+void
+download_cache_setup_source (GstElement * playbin, GstElement * source,
+    DownloadCache * cache)
+{
+  GstAppSrcCallbacks callbacks = { 0, };
+
+  if (!GST_IS_APP_SRC (source))
+    return;
+
+  callbacks.need_data = (gpointer) need_data;
+  callbacks.seek_data = (gpointer) seek_data;
+
+  g_object_set (source, "format", GST_FORMAT_BYTES, "blocksize",
+      READ_BLOCKSIZE, NULL);
+  gst_app_src_set_stream_type (GST_APP_SRC (source),
+      GST_APP_STREAM_TYPE_RANDOM_ACCESS);
+  gst_app_src_set_size (GST_APP_SRC (source), cache->size);
+  gst_app_src_set_callbacks (GST_APP_SRC (source), &callbacks, cache, NULL);
+  /* A new source always starts from the beginning */
+  cache->read_offset = 0;
+}
+
+static gint
+open_cache_file (const gchar * dir, const gchar * key, const gchar * ext,
+    off_t size, GError ** err)
+{
+  gchar *name, *path;
+  struct stat st;
+  gint fd;
+
+  name = g_strconcat (key, ext, NULL);
+  path = g_build_filename (dir, name, NULL);
+  g_free (name);
+
+  fd = g_open (path, O_RDWR | O_CREAT, 0644);
+  /* Instances may race to create it, but all grow it to the same size */
+  if (fd >= 0 && fstat (fd, &st) == 0 && st.st_size < size &&
+      ftruncate (fd, size) != 0) {
+    close (fd);
+    fd = -1;
+  }
+  if (fd < 0)
+    g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errno),
+        "Can't open cache file %s: %s", path, g_strerror (errno));
+  g_free (path);
+
+  return fd;
+}
+
+DownloadCache *
+download_cache_open (const gchar * uri, GError ** err)
+{
+  DownloadCache *cache;
+  gchar *scheme, *host_start, *path_start, *etag = NULL, *id, *key, *dir;
+  guint16 port;
+  guint i;
+
+  scheme = g_uri_parse_scheme (uri);
+  if (scheme == NULL || (!g_str_equal (scheme, "http")
+          && !g_str_equal (scheme, "https"))) {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Only http and https URIs can be cached");
+    g_free (scheme);
+    return NULL;
+  }
+
+  cache = g_new0 (DownloadCache, 1);
+  cache->uri = g_strdup (uri);
+  cache->tls = g_str_equal (scheme, "https");
+  cache->data_fd = cache->map_fd = -1;
+  g_mutex_init (&cache->lock);
+  g_cond_init (&cache->cond);
+  g_free (scheme);
+
+  cache->address = g_network_address_parse_uri (uri, cache->tls ? 443 : 80,
+      err);
+  if (cache->address == NULL)
+    goto fail;
+  port = g_network_address_get_port (G_NETWORK_ADDRESS (cache->address));
+  cache->host = g_strdup_printf ("%s:%u",
+      g_network_address_get_hostname (G_NETWORK_ADDRESS (cache->address)),
+      port);
+
+  host_start = strstr (uri, "://") + 3;
+  path_start = strchr (host_start, '/');
+  cache->path = g_strdup (path_start ? path_start : "/");
+  if (strchr (cache->path, '#'))
+    *strchr (cache->path, '#') = '\0';
+
+  if (!http_probe (cache, &etag, err))
+    goto fail;
+
+  cache->n_chunks = (cache->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  id = g_strdup_printf ("%s\n%" G_GUINT64_FORMAT "\n%s", uri, cache->size,
+      etag);
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA256, id, -1);
+  g_free (id);
+  g_clear_pointer (&etag, g_free);
+
+  dir = g_build_filename (g_get_user_cache_dir (), "playback-sync", NULL);
+  g_mkdir_with_parents (dir, 0755);
+  cache->data_fd = open_cache_file (dir, key, ".data", cache->size, err);
+  if (cache->data_fd >= 0)
+    cache->map_fd = open_cache_file (dir, key, ".map", cache->n_chunks, err);
+  g_free (key);
+  g_free (dir);
+  if (cache->map_fd < 0)
+    goto fail;
+
+  cache->chunks = g_malloc0 (cache->n_chunks);
+  cache->fetched = g_malloc0 (cache->n_chunks);
+  cache->served = g_malloc0 (cache->n_chunks);
+  cache->busy_until = g_new0 (gint64, cache->n_chunks);
+
+  refresh_map (cache);
+  for (i = 0; i < cache->n_chunks; i++)
+    if (cache->chunks[i])
+      cache->initial_chunks++;
+
+  g_print ("Cache: %u of %u chunks of %s already on disk\n",
+      cache->initial_chunks, cache->n_chunks, uri);
+
+  cache->fetch_thread = g_thread_new ("cache-fetch",
+      (GThreadFunc) fetch_thread_func, cache);
+
+  return cache;
+
+fail:
+  g_free (etag);
+  download_cache_free (cache);
+  return NULL;
+}
+
+/* Wake up and finish any waiting reader, so the pipeline can shut down */
+void
+download_cache_stop (DownloadCache * cache)
+{
+  g_mutex_lock (&cache->lock);
+  cache->stop = TRUE;
+  g_cond_broadcast (&cache->cond);
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+download_cache_print_stats (DownloadCache * cache)
+{
+  guint served;
+
+  g_mutex_lock (&cache->lock);
+  served = cache->hit_chunks + cache->miss_chunks;
+  g_print ("Cache: %u of %u chunks read came from the cache (%.1f%%), "
+      "%.1f MB saved, %.1f MB downloaded\n", cache->hit_chunks, served,
+      served ? 100.0 * cache->hit_chunks / served : 0.0,
+      cache->hit_bytes / (1024.0 * 1024.0),
+      cache->fetched_bytes / (1024.0 * 1024.0));
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+download_cache_free (DownloadCache * cache)
+{
+  download_cache_stop (cache);
+  if (cache->fetch_thread)
+    g_thread_join (cache->fetch_thread);
+
+  if (cache->data_fd >= 0)
+    close (cache->data_fd);
+  if (cache->map_fd >= 0)
+    close (cache->map_fd);
+
+  g_free (cache->chunks);
+  g_free (cache->fetched);
+  g_free (cache->served);
+  g_free (cache->busy_until);
+  g_clear_object (&cache->address);
+  g_free (cache->host);
+  g_free (cache->path);
+  g_free (cache->uri);
+  g_mutex_clear (&cache->lock);
+  g_cond_clear (&cache->cond);
+  g_free (cache);
+}
@@ -0,0 +1,21 @@
+#ifndef __DOWNLOAD_CACHE_H__
+#define __DOWNLOAD_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DownloadCache DownloadCache;
+
+DownloadCache *download_cache_open (const gchar * uri, GError ** err);
+
+/* Connect to playbin's "source-setup" when playing "appsrc://" */
+void download_cache_setup_source (GstElement * playbin, GstElement * source,
+    DownloadCache * cache);
+
+void download_cache_stop (DownloadCache * cache);
+void download_cache_print_stats (DownloadCache * cache);
+void download_cache_free (DownloadCache * cache);
+
+G_END_DECLS
+#endif /* __DOWNLOAD_CACHE_H__ */
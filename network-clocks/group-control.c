@@ -0,0 +1,176 @@
+/* A tiny side channel next to the network clock, used by the
+ * playback-sync instances of a group to talk to the netclock-server.
+ *
+ * Every message is a GstStructure serialised to a string and sent
+ * in a single UDP datagram, eg:
+ *
+ *   latency-report, min-latency=(guint64)20000000, clock-uncertainty=...
+ *
+ * Clients only ever talk to the server. The server replies to, or
+ * broadcasts to, the clients it has heard from.
+ */
+#include <string.h>
+
+#include "group-control.h"
+
+#define MAX_MESSAGE_SIZE 2048
+
+struct _GroupControl
+{
+  GSocket *socket;
+  /* Where client messages go. NULL on the server */
+  GSocketAddress *server_addr;
+  GSource *source;
+
+  GroupControlFunc func;
+  gpointer user_data;
+};
+
+static gboolean
+group_control_readable (GSocket * socket, GIOCondition condition,
+    GroupControl * ctl)
+{
+  gchar buf[MAX_MESSAGE_SIZE];
+  GSocketAddress *from = NULL;
+  GstStructure *msg;
+  GError *err = NULL;
+  gssize len;
+
+  len = g_socket_receive_from (socket, &from, buf, sizeof (buf) - 1, NULL,
+      &err);
+  if (len < 0) {
+    g_printerr ("Group control receive failed: %s\n", err->message);
+    g_clear_error (&err);
+    return G_SOURCE_CONTINUE;
+  }
+  buf[len] = '\0';
+
+  msg = gst_structure_from_string (buf, NULL);
+  if (msg != NULL) {
+    ctl->func (ctl, msg, from, ctl->user_data);
+    gst_structure_free (msg);
+  } else {
+    g_printerr ("Ignoring malformed group control message '%s'\n", buf);
+  }
+
+  g_clear_object (&from);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GroupControl *
+group_control_new (GSocketFamily family, guint port, GroupControlFunc func,
+    gpointer user_data, GError ** err)
+{
+  GroupControl *ctl;
+  GInetAddress *any;
+  GSocketAddress *bind_addr;
+  gboolean ret;
+
+  ctl = g_new0 (GroupControl, 1);
+  ctl->func = func;
+  ctl->user_data = user_data;
+
+  ctl->socket = g_socket_new (family, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, err);
+  if (ctl->socket == NULL)
+    goto fail;
+
+  any = g_inet_address_new_any (family);
+  bind_addr = g_inet_socket_address_new (any, port);
+  ret = g_socket_bind (ctl->socket, bind_addr, TRUE, err);
+  g_object_unref (bind_addr);
+  g_object_unref (any);
+  if (!ret)
+    goto fail;
+
+  ctl->source = g_socket_create_source (ctl->socket, G_IO_IN, NULL);
+  g_source_set_callback (ctl->source, (GSourceFunc) group_control_readable,
+      ctl, NULL);
+  g_source_attach (ctl->source, NULL);
+
+  return ctl;
+
+fail:
+  group_control_free (ctl);
+  return NULL;
+}
+
+GroupControl *
+group_control_new_server (guint port, GroupControlFunc func,
+    gpointer user_data, GError ** err)
+{
+  GroupControl *ctl;
+
+  /* An IPv6 socket also accepts IPv4 clients on most systems, but
+   * fall back to plain IPv4 if there's no IPv6 support at all */
+  ctl = group_control_new (G_SOCKET_FAMILY_IPV6, port, func, user_data, NULL);
+  if (ctl == NULL)
+    ctl = group_control_new (G_SOCKET_FAMILY_IPV4, port, func, user_data, err);
+
+  return ctl;
+}
+
+GroupControl *
+group_control_new_client (const gchar * host, guint port,
+    GroupControlFunc func, gpointer user_data, GError ** err)
+{
+  GroupControl *ctl;
+  GResolver *resolver;
+  GList *addrs;
+  GInetAddress *addr;
+
+  resolver = g_resolver_get_default ();
+  addrs = g_resolver_lookup_by_name (resolver, host, NULL, err);
+  g_object_unref (resolver);
+  if (addrs == NULL)
+    return NULL;
+
+  addr = G_INET_ADDRESS (addrs->data);
+
+  ctl = group_control_new (g_inet_address_get_family (addr), 0, func,
+      user_data, err);
+  if (ctl != NULL)
+    ctl->server_addr = g_inet_socket_address_new (addr, port);
+
+  g_resolver_free_addresses (addrs);
+
+  return ctl;
+}
+
+gboolean
+group_control_send (GroupControl * ctl, GSocketAddress * to,
+    const GstStructure * msg)
+{
+  GError *err = NULL;
+  gchar *str;
+  gssize ret;
+
+  if (to == NULL)
+    to = ctl->server_addr;
+  g_return_val_if_fail (to != NULL, FALSE);
+
+  str = gst_structure_to_string (msg);
+  ret = g_socket_send_to (ctl->socket, to, str, strlen (str), NULL, &err);
+  g_free (str);
+
+  if (ret < 0) {
+    g_printerr ("Group control send failed: %s\n", err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void
+group_control_free (GroupControl * ctl)
+{
+  if (ctl->source) {
+    g_source_destroy (ctl->source);
+    g_source_unref (ctl->source);
+  }
+  g_clear_object (&ctl->server_addr);
+  g_clear_object (&ctl->socket);
+  g_free (ctl);
+}
@@ -0,0 +1,31 @@
+#ifndef __GROUP_CONTROL_H__
+#define __GROUP_CONTROL_H__
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Unless told otherwise, the group control channel lives on the port
+ * right after the network clock port */
+#define GROUP_CONTROL_PORT_OFFSET 1
+
+typedef struct _GroupControl GroupControl;
+
+/* Called from the main loop for every message received. @from is
+ * the address of the sender, which the server uses to reply */
+typedef void (*GroupControlFunc) (GroupControl * ctl,
+    const GstStructure * msg, GSocketAddress * from, gpointer user_data);
+
+GroupControl *group_control_new_server (guint port, GroupControlFunc func,
+    gpointer user_data, GError ** err);
+GroupControl *group_control_new_client (const gchar * host, guint port,
+    GroupControlFunc func, gpointer user_data, GError ** err);
+
+gboolean group_control_send (GroupControl * ctl, GSocketAddress * to,
+    const GstStructure * msg);
+
+void group_control_free (GroupControl * ctl);
+
+G_END_DECLS
+#endif /* __GROUP_CONTROL_H__ */
@@ -0,0 +1,253 @@
+/* Relay UDP packets between clients and one server through a pair of
+ * netimpair elements, to see how the network clock copes with loss,
+ * jitter and asymmetric delay without touching the real network.
+ *
+ *   GST_PLUGIN_PATH=../plugin ./impair-relay -l 6000 -s 127.0.0.1 -p 5637 \
+ *       -u "delay=20 jitter=5" -d "delay=40 loss=2"
+ *   ./playback-sync -c 127.0.0.1 -p 6000 -C 5638 -b base-time <file>
+ *
+ * Replies go back to the last client heard from, so use one relay per
+ * player.
+ */
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <gst/net/gstnetaddressmeta.h>
+#include <gio/gio.h>
+
+static gint listen_port = 6000;
+static gchar *server_host = NULL;
+static gint server_port = 5637;
+static gchar *up_settings = NULL;
+static gchar *down_settings = NULL;
+static gint stats_interval = 5;
+
+static GOptionEntry opt_entries[] = {
+  {"listen", 'l', 0, G_OPTION_ARG_INT, &listen_port,
+      "Port clients send to (default: 6000)", "PORT"},
+  {"server", 's', 0, G_OPTION_ARG_STRING, &server_host,
+      "Server to relay to (default: 127.0.0.1)", "HOST"},
+  {"port", 'p', 0, G_OPTION_ARG_INT, &server_port,
+      "Server port (default: 5637)", "PORT"},
+  {"up", 'u', 0, G_OPTION_ARG_STRING, &up_settings,
+      "netimpair properties for client to server packets", "PROPS"},
+  {"down", 'd', 0, G_OPTION_ARG_STRING, &down_settings,
+      "netimpair properties for server to client packets", "PROPS"},
+  {"stats", 'i', 0, G_OPTION_ARG_INT, &stats_interval,
+      "Print packet counts every N seconds (default: 5, 0 = never)", "N"},
+  {NULL}
+};
+
+typedef struct
+{
+  GstElement *pipeline;
+  GstElement *up;
+  GstElement *down;
+
+  GMutex lock;
+  GSocketAddress *client;
+} RelayData;
+
+/* Remember who to send the replies to */
+static GstPadProbeReturn
+client_probe (GstPad * pad, GstPadProbeInfo * info, RelayData * data)
+{
+  GstNetAddressMeta *meta;
+
+  meta = gst_buffer_get_net_address_meta (GST_PAD_PROBE_INFO_BUFFER (info));
+  if (meta) {
+    g_mutex_lock (&data->lock);
+    g_clear_object (&data->client);
+    data->client = g_object_ref (meta->addr);
+    g_mutex_unlock (&data->lock);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Replies carry the server's address, and dynudpsink sends to whatever
+ * address the buffer carries, so swap in the client's */
+static GstPadProbeReturn
+reply_probe (GstPad * pad, GstPadProbeInfo * info, RelayData * data)
+{
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstNetAddressMeta *meta;
+
+  g_mutex_lock (&data->lock);
+  if (data->client == NULL) {
+    g_mutex_unlock (&data->lock);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  buf = gst_buffer_make_writable (buf);
+  while ((meta = gst_buffer_get_net_address_meta (buf)))
+    gst_buffer_remove_meta (buf, (GstMeta *) meta);
+  gst_buffer_add_net_address_meta (buf, data->client);
+  g_mutex_unlock (&data->lock);
+
+  GST_PAD_PROBE_INFO_DATA (info) = buf;
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+print_direction (const gchar * name, GstElement * impair)
+{
+  GstStructure *s;
+  guint64 forwarded = 0, dropped = 0, reordered = 0, overflowed = 0;
+
+  g_object_get (impair, "stats", &s, NULL);
+  gst_structure_get_uint64 (s, "forwarded", &forwarded);
+  gst_structure_get_uint64 (s, "dropped", &dropped);
+  gst_structure_get_uint64 (s, "reordered", &reordered);
+  gst_structure_get_uint64 (s, "overflowed", &overflowed);
+  gst_structure_free (s);
+
+  g_print ("%s: %" G_GUINT64_FORMAT " forwarded, %" G_GUINT64_FORMAT
+      " lost, %" G_GUINT64_FORMAT " reordered, %" G_GUINT64_FORMAT
+      " overflowed\n", name, forwarded, dropped, reordered, overflowed);
+}
+
+static gboolean
+print_stats (RelayData * data)
+{
+  print_direction ("Up", data->up);
+  print_direction ("Down", data->down);
+  return TRUE;
+}
+
+static gboolean
+handle_message (GstBus * bus, GstMessage * msg, GMainLoop * loop)
+{
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    GError *err;
+    gchar *debug;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("Error: %s\n%s\n", err->message, debug ? debug : "");
+    g_error_free (err);
+    g_free (debug);
+    g_main_loop_quit (loop);
+  }
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  RelayData data = { 0, };
+  GSocket *front, *back;
+  GInetAddress *any;
+  GSocketAddress *addr;
+  GstElement *e;
+  GstPad *pad;
+  GstBus *bus;
+  GMainLoop *loop;
+  gchar *desc;
+
+  opt_ctx = g_option_context_new ("- impair UDP traffic to a server");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (opt_ctx);
+
+  if (server_host == NULL)
+    server_host = g_strdup ("127.0.0.1");
+
+  /* One socket faces the clients, the other the server. Each direction
+   * receives on one and sends from the other */
+  any = g_inet_address_new_any (G_SOCKET_FAMILY_IPV4);
+  front = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, &err);
+  addr = g_inet_socket_address_new (any, listen_port);
+  if (front == NULL || !g_socket_bind (front, addr, TRUE, &err)) {
+    g_printerr ("Could not listen on port %d: %s\n", listen_port,
+        err->message);
+    return 1;
+  }
+  g_object_unref (addr);
+
+  back = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, &err);
+  addr = g_inet_socket_address_new (any, 0);
+  if (back == NULL || !g_socket_bind (back, addr, FALSE, &err)) {
+    g_printerr ("Could not open socket: %s\n", err->message);
+    return 1;
+  }
+  g_object_unref (addr);
+  g_object_unref (any);
+
+  desc = g_strdup_printf ("udpsrc name=fsrc ! netimpair name=up %s ! "
+      "udpsink name=bsink host=%s port=%d sync=false async=false "
+      "udpsrc name=bsrc ! netimpair name=down %s ! "
+      "dynudpsink name=fsink sync=false async=false",
+      up_settings ? up_settings : "", server_host, server_port,
+      down_settings ? down_settings : "");
+  data.pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (data.pipeline == NULL) {
+    g_printerr ("Could not create pipeline: %s\n", err->message);
+    g_printerr ("Is GST_PLUGIN_PATH pointing at the plugin directory?\n");
+    return 1;
+  }
+  g_mutex_init (&data.lock);
+
+  data.up = gst_bin_get_by_name (GST_BIN (data.pipeline), "up");
+  data.down = gst_bin_get_by_name (GST_BIN (data.pipeline), "down");
+
+  e = gst_bin_get_by_name (GST_BIN (data.pipeline), "fsrc");
+  g_object_set (e, "socket", front, "close-socket", FALSE, NULL);
+  pad = gst_element_get_static_pad (e, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) client_probe, &data, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (e);
+
+  e = gst_bin_get_by_name (GST_BIN (data.pipeline), "bsink");
+  g_object_set (e, "socket", back, "close-socket", FALSE, NULL);
+  gst_object_unref (e);
+
+  e = gst_bin_get_by_name (GST_BIN (data.pipeline), "bsrc");
+  g_object_set (e, "socket", back, "close-socket", FALSE, NULL);
+  pad = gst_element_get_static_pad (e, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) reply_probe, &data, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (e);
+
+  e = gst_bin_get_by_name (GST_BIN (data.pipeline), "fsink");
+  g_object_set (e, "socket", front, "close-socket", FALSE, NULL);
+  gst_object_unref (e);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  bus = gst_element_get_bus (data.pipeline);
+  gst_bus_add_watch (bus, (GstBusFunc) handle_message, loop);
+  gst_object_unref (bus);
+
+  if (stats_interval > 0)
+    g_timeout_add_seconds (stats_interval, (GSourceFunc) print_stats, &data);
+
+  g_print ("Relaying port %d to %s:%d\n", listen_port, server_host,
+      server_port);
+  gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (loop);
+
+  gst_element_set_state (data.pipeline, GST_STATE_NULL);
+  print_stats (&data);
+
+  gst_object_unref (data.up);
+  gst_object_unref (data.down);
+  gst_object_unref (data.pipeline);
+  g_clear_object (&data.client);
+  g_mutex_clear (&data.lock);
+  g_object_unref (front);
+  g_object_unref (back);
+  g_main_loop_unref (loop);
+  g_free (server_host);
+
+  return 0;
+}
@@ -2,6 +2,343 @@
 #include <gst/gst.h>
 #include <gst/net/gstnettimeprovider.h>
 
+#include "group-control.h"
+
+/* Forget about group members we haven't heard from in this long */
+#define MEMBER_TIMEOUT (5 * G_USEC_PER_SEC)
+/* Extra safety margin added on top of the slowest member's needs */
+#define GROUP_LATENCY_MARGIN (10 * GST_MSECOND)
+/* How far in the future group commands take effect. Seeks need the
+ * time to preroll, pausing and resuming only to reach everyone */
+#define SEEK_LEAD (1 * GST_SECOND)
+#define PAUSE_LEAD (250 * GST_MSECOND)
+
+typedef struct
+{
+  GSocketAddress *addr;
+  GstClockTime min_latency;
+  GstClockTime uncertainty;
+  gint64 last_seen;
+} GroupMember;
+
+typedef struct
+{
+  GstClock *clock;
+  GroupControl *ctl;
+
+  /* Address string -> GroupMember */
+  GHashTable *members;
+  GstClockTime group_latency;
+
+  gboolean paused;
+
+  /* Reports about when the last group command took effect */
+  guint switch_seqnum;
+  guint switch_reports;
+  GstClockTime switch_min;
+  GstClockTime switch_max;
+  GstClockTime switch_uncertainty;
+
+  /* Reports about the last playlist item cut-over */
+  guint item;
+  GstClockTime item_start_time;
+  guint item_reports;
+  GstClockTime item_min;
+  GstClockTime item_max;
+  GstClockTime frame_duration;
+} ServerData;
+
+static void
+group_member_free (GroupMember * member)
+{
+  g_object_unref (member->addr);
+  g_free (member);
+}
+
+static gchar *
+address_to_string (GSocketAddress * addr)
+{
+  GInetSocketAddress *inet_addr = G_INET_SOCKET_ADDRESS (addr);
+  gchar *host, *ret;
+
+  host = g_inet_address_to_string (g_inet_socket_address_get_address
+      (inet_addr));
+  ret = g_strdup_printf ("%s:%u", host,
+      g_inet_socket_address_get_port (inet_addr));
+  g_free (host);
+
+  return ret;
+}
+
+static void
+send_group_latency (ServerData * data, GSocketAddress * to)
+{
+  GstStructure *s;
+
+  s = gst_structure_new ("group-latency",
+      "latency", G_TYPE_UINT64, data->group_latency, NULL);
+  group_control_send (data->ctl, to, s);
+  gst_structure_free (s);
+}
+
+/* The group has to run at the latency the slowest member needs: its
+ * own pipeline latency plus however far its clock might be off */
+static void
+update_group_latency (ServerData * data)
+{
+  GHashTableIter iter;
+  GroupMember *member;
+  GstClockTime latency = 0;
+
+  if (g_hash_table_size (data->members) == 0)
+    return;
+
+  g_hash_table_iter_init (&iter, data->members);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & member))
+    latency = MAX (latency, member->min_latency + member->uncertainty);
+
+  latency += GROUP_LATENCY_MARGIN;
+  /* Round up to a whole millisecond so small clock jitter doesn't
+   * make us re-announce all the time */
+  latency = gst_util_uint64_scale_ceil (latency, 1, GST_MSECOND) *
+      GST_MSECOND;
+
+  if (latency == data->group_latency)
+    return;
+
+  g_print ("\nGroup latency now %" GST_TIME_FORMAT " for %u player(s)\n",
+      GST_TIME_ARGS (latency), g_hash_table_size (data->members));
+  data->group_latency = latency;
+
+  g_hash_table_iter_init (&iter, data->members);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & member))
+    send_group_latency (data, member->addr);
+}
+
+/* Send @s to every player, to take effect @lead from now */
+static void
+start_group_command (ServerData * data, GstStructure * s, GstClockTime lead)
+{
+  GHashTableIter iter;
+  GroupMember *member;
+  GstClockTime switch_time;
+
+  switch_time = gst_clock_get_time (data->clock) + lead;
+
+  data->switch_seqnum++;
+  data->switch_reports = 0;
+  data->switch_min = GST_CLOCK_TIME_NONE;
+  data->switch_max = 0;
+  data->switch_uncertainty = 0;
+
+  gst_structure_set (s, "seqnum", G_TYPE_UINT, data->switch_seqnum,
+      "switch-time", G_TYPE_UINT64, switch_time, NULL);
+
+  g_print ("\nSwitch %u: %s at %" G_GUINT64_FORMAT "\n", data->switch_seqnum,
+      gst_structure_get_name (s), switch_time);
+
+  g_hash_table_iter_init (&iter, data->members);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & member))
+    group_control_send (data->ctl, member->addr, s);
+
+  gst_structure_free (s);
+}
+
+/* Collect when each player really switched, and show the spread */
+static void
+handle_switch_report (ServerData * data, const GstStructure * msg)
+{
+  guint seqnum;
+  guint64 actual, uncertainty;
+
+  if (!gst_structure_get_uint (msg, "seqnum", &seqnum) ||
+      !gst_structure_get_uint64 (msg, "actual-time", &actual))
+    return;
+
+  /* Too late, there's been another command since */
+  if (seqnum != data->switch_seqnum)
+    return;
+
+  data->switch_reports++;
+  if (!GST_CLOCK_TIME_IS_VALID (data->switch_min) || actual < data->switch_min)
+    data->switch_min = actual;
+  if (actual > data->switch_max)
+    data->switch_max = actual;
+  if (gst_structure_get_uint64 (msg, "clock-uncertainty", &uncertainty) &&
+      GST_CLOCK_TIME_IS_VALID (uncertainty))
+    data->switch_uncertainty = MAX (data->switch_uncertainty, uncertainty);
+
+  g_print ("Switch %u: %u of %u player(s) reported, spread %" G_GUINT64_FORMAT
+      " us (clock uncertainty up to %" G_GUINT64_FORMAT " us)\n", seqnum,
+      data->switch_reports, g_hash_table_size (data->members),
+      (data->switch_max - data->switch_min) / GST_USECOND,
+      data->switch_uncertainty / GST_USECOND);
+}
+
+/* Players move on to the next playlist item by themselves, all at the
+ * same running time. Check they really showed it together */
+static void
+handle_item_started (ServerData * data, const GstStructure * msg)
+{
+  guint item;
+  guint64 start_time, actual, frame_duration = GST_CLOCK_TIME_NONE;
+
+  if (!gst_structure_get_uint (msg, "item", &item) ||
+      !gst_structure_get_uint64 (msg, "start-time", &start_time) ||
+      !gst_structure_get_uint64 (msg, "actual-time", &actual))
+    return;
+  gst_structure_get_uint64 (msg, "frame-duration", &frame_duration);
+
+  /* The same item comes round again when looping, so a report that's
+   * far off the last one starts a new cut-over */
+  if (item != data->item || data->item_reports == 0 ||
+      ABS (GST_CLOCK_DIFF (data->item_start_time, start_time)) > GST_SECOND) {
+    data->item = item;
+    data->item_start_time = start_time;
+    data->item_reports = 0;
+    data->item_min = GST_CLOCK_TIME_NONE;
+    data->item_max = 0;
+    data->frame_duration = GST_CLOCK_TIME_NONE;
+  }
+
+  data->item_reports++;
+  if (!GST_CLOCK_TIME_IS_VALID (data->item_min) || actual < data->item_min)
+    data->item_min = actual;
+  if (actual > data->item_max)
+    data->item_max = actual;
+  if (GST_CLOCK_TIME_IS_VALID (frame_duration))
+    data->frame_duration = frame_duration;
+
+  g_print ("Playlist item %u: %u of %u player(s) cut over, spread %"
+      G_GUINT64_FORMAT " us", item + 1, data->item_reports,
+      g_hash_table_size (data->members),
+      (data->item_max - data->item_min) / GST_USECOND);
+  if (GST_CLOCK_TIME_IS_VALID (data->frame_duration))
+    g_print (" (%s one frame)", data->item_max - data->item_min <=
+        data->frame_duration ? "within" : "more than");
+  g_print ("\n");
+}
+
+/* One line per player, so drifting screens stand out */
+static void
+handle_sync_stats (ServerData * data, const GstStructure * msg,
+    GSocketAddress * from)
+{
+  gint64 offset = 0, video_mean = 0, video_max = 0, audio_mean = 0,
+      audio_max = 0;
+  guint64 video_count = 0, audio_count = 0;
+  gchar *key;
+
+  gst_structure_get_int64 (msg, "clock-offset", &offset);
+  gst_structure_get_uint64 (msg, "video-count", &video_count);
+  gst_structure_get_int64 (msg, "video-mean", &video_mean);
+  gst_structure_get_int64 (msg, "video-max", &video_max);
+  gst_structure_get_uint64 (msg, "audio-count", &audio_count);
+  gst_structure_get_int64 (msg, "audio-mean", &audio_mean);
+  gst_structure_get_int64 (msg, "audio-max", &audio_max);
+
+  key = address_to_string (from);
+  g_print ("\n%s: clock offset %+" G_GINT64_FORMAT "us", key,
+      offset / GST_USECOND);
+  if (video_count > 0)
+    g_print (", video %+" G_GINT64_FORMAT "us (worst %" G_GINT64_FORMAT
+        "us)", video_mean / GST_USECOND, video_max / GST_USECOND);
+  if (audio_count > 0)
+    g_print (", audio %+" G_GINT64_FORMAT "us (worst %" G_GINT64_FORMAT
+        "us)", audio_mean / GST_USECOND, audio_max / GST_USECOND);
+  if (video_count > 0 && audio_count > 0)
+    g_print (", A/V skew %+" G_GINT64_FORMAT "us",
+        (audio_mean - video_mean) / GST_USECOND);
+  g_print ("\n");
+  g_free (key);
+}
+
+static void
+handle_control_msg (GroupControl * ctl, const GstStructure * msg,
+    GSocketAddress * from, ServerData * data)
+{
+  if (gst_structure_has_name (msg, "seek-request")) {
+    GstClockTime lead = SEEK_LEAD;
+    guint64 position;
+
+    if (!gst_structure_get_uint64 (msg, "position", &position))
+      return;
+
+    if (GST_CLOCK_TIME_IS_VALID (data->group_latency))
+      lead += data->group_latency;
+
+    start_group_command (data, gst_structure_new ("group-seek",
+            "position", G_TYPE_UINT64, position, NULL), lead);
+  } else if (gst_structure_has_name (msg, "pause-request")) {
+    if (data->paused)
+      return;
+    data->paused = TRUE;
+    start_group_command (data, gst_structure_new_empty ("group-pause"),
+        PAUSE_LEAD);
+  } else if (gst_structure_has_name (msg, "resume-request")) {
+    if (!data->paused)
+      return;
+    data->paused = FALSE;
+    start_group_command (data, gst_structure_new_empty ("group-resume"),
+        PAUSE_LEAD);
+  } else if (gst_structure_has_name (msg, "switch-done")) {
+    handle_switch_report (data, msg);
+  } else if (gst_structure_has_name (msg, "item-started")) {
+    handle_item_started (data, msg);
+  } else if (gst_structure_has_name (msg, "sync-stats")) {
+    handle_sync_stats (data, msg, from);
+  } else if (gst_structure_has_name (msg, "latency-report")) {
+    GroupMember *member;
+    gchar *key;
+
+    key = address_to_string (from);
+    member = g_hash_table_lookup (data->members, key);
+    if (member == NULL) {
+      g_print ("\nPlayer %s joined the group\n", key);
+      member = g_new0 (GroupMember, 1);
+      member->addr = g_object_ref (from);
+      g_hash_table_insert (data->members, key, member);
+    } else {
+      g_free (key);
+    }
+
+    member->last_seen = g_get_monotonic_time ();
+    gst_structure_get_uint64 (msg, "min-latency", &member->min_latency);
+    gst_structure_get_uint64 (msg, "clock-uncertainty", &member->uncertainty);
+
+    update_group_latency (data);
+
+    /* Always answer, so a new player learns the current latency
+     * even when it didn't change anything */
+    send_group_latency (data, from);
+  }
+}
+
+static gboolean
+expire_members (ServerData * data)
+{
+  GHashTableIter iter;
+  GroupMember *member;
+  const gchar *key;
+  gint64 now = g_get_monotonic_time ();
+  gboolean changed = FALSE;
+
+  g_hash_table_iter_init (&iter, data->members);
+  while (g_hash_table_iter_next (&iter, (gpointer *) & key,
+          (gpointer *) & member)) {
+    if (now - member->last_seen > MEMBER_TIMEOUT) {
+      g_print ("\nPlayer %s left the group\n", key);
+      g_hash_table_iter_remove (&iter);
+      changed = TRUE;
+    }
+  }
+
+  if (changed)
+    update_group_latency (data);
+
+  return G_SOURCE_CONTINUE;
+}
+
 gboolean print_time (gpointer user_data)
 {
   GstClock *clock = GST_CLOCK (user_data);
@@ -17,12 +354,17 @@ main (gint argc, gchar * argv[])
   GMainLoop *loop;
   GstClock *clock;
   GstNetTimeProvider *net_clock;
+  ServerData data = { 0, };
+  GError *err = NULL;
   int clock_port = 0;
+  int control_port = 0;
 
   gst_init (&argc, &argv);
 
   if (argc > 1)
     clock_port = atoi (argv[1]);
+  if (argc > 2)
+    control_port = atoi (argv[2]);
 
   loop = g_main_loop_new (NULL, FALSE);
 
@@ -33,10 +375,30 @@ main (gint argc, gchar * argv[])
 
   g_print ("Published network clock on port %u\n", clock_port);
 
+  /* Players report to us on the group control port */
+  if (control_port == 0)
+    control_port = clock_port + GROUP_CONTROL_PORT_OFFSET;
+
+  data.clock = clock;
+  data.members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) group_member_free);
+  data.group_latency = GST_CLOCK_TIME_NONE;
+  data.ctl = group_control_new_server (control_port,
+      (GroupControlFunc) handle_control_msg, &data, &err);
+  if (data.ctl == NULL)
+    g_error ("Failed to open group control port %d: %s", control_port,
+        err->message);
+
+  g_print ("Group control on port %u\n", control_port);
+
   g_timeout_add_seconds (1, print_time, clock);
+  g_timeout_add_seconds (1, (GSourceFunc) expire_members, &data);
   g_main_loop_run (loop);
 
   /* cleanup */
+  group_control_free (data.ctl);
+  g_hash_table_unref (data.members);
+  gst_object_unref (net_clock);
   gst_object_unref (clock);
   g_main_loop_unref (loop);
 
@@ -4,12 +4,61 @@
 #include <stdio.h>
 
 #include <gst/gst.h>
+#include <gst/audio/audio.h>
 #include <gst/pbutils/pbutils.h>
 #include <gst/net/gstnetclientclock.h>
 
+#include "download-cache.h"
+#include "group-control.h"
+#include "mem-report.h"
+#include "sync-stats.h"
+
+/* Latency to use if the group doesn't answer */
+#define DEFAULT_LATENCY (100 * GST_MSECOND)
+/* How long to wait for the group to tell us the latency to use */
+#define GROUP_LATENCY_TIMEOUT 2
+/* If no sink reports QoS after a switch, report it this long after
+ * we reached PLAYING */
+#define SWITCH_REPORT_TIMEOUT 1
+/* When joining late, how far ahead to seek to, to have time to
+ * preroll there. If that wasn't enough, we retry with twice as long
+ * as the preroll really took */
+#define JOIN_LEAD (500 * GST_MSECOND)
+/* Switch numbers used for our own late join and buffering recovery */
+#define JOIN_SEQNUM G_MAXUINT
+#define RESYNC_SEQNUM (G_MAXUINT - 1)
+/* After a buffering stall, how far ahead of the group to rejoin */
+#define RESYNC_LEAD (500 * GST_MSECOND)
+/* After losing the clock, we're back once this many frames in a row
+ * render this close to their time. One on-time frame can be a lucky
+ * one in the middle of the glitch */
+#define GLITCH_THRESHOLD (20 * GST_MSECOND)
+#define GLITCH_ON_TIME_FRAMES 10
+/* How often to check where the audio sinks really are */
+#define AUDIO_SAMPLE_INTERVAL 50
+/* Adaptive buffering only counts on this much of the measured download
+ * rate, always wants at least this fraction of the file before
+ * starting, and once playing only re-buffers below the low watermark */
+#define DOWNLOAD_RATE_HEADROOM 0.8
+#define MIN_PREBUFFER 0.02
+#define LOW_WATERMARK 5
+
 static gchar *clock_host = NULL;
 static gint clock_port = 0;
+static gint control_port = 0;
 static GstClockTime base_time = GST_CLOCK_TIME_NONE;
+static gint latency_ms = 0;
+static gint stats_interval = 0;
+static gchar *buffering_mode = NULL;
+static gchar *rebuffer_mode = NULL;
+static gchar *clock_lost_mode = NULL;
+static gboolean shared_cache = FALSE;
+static gboolean stream_selection = FALSE;
+static gboolean loop_playlist = FALSE;
+static gint memory_report = 0;
+static gint max_queue_bytes = 0;
+static gint max_pool_buffers = 0;
+static gint64 max_download_bytes = 0;
 
 static GOptionEntry opt_entries[] = {
   {"clock-host", 'c', 0, G_OPTION_ARG_STRING, &clock_host,
@@ -18,6 +67,39 @@ static GOptionEntry opt_entries[] = {
       "Network clock provider port", NULL},
   {"base-time", 'b', 0, G_OPTION_ARG_INT64, &base_time,
       "Playback base time to sync to", NULL},
+  {"control-port", 'C', 0, G_OPTION_ARG_INT, &control_port,
+      "Group control port (default: clock port + 1)", NULL},
+  {"latency", 'l', 0, G_OPTION_ARG_INT, &latency_ms,
+      "Fixed pipeline latency in ms, instead of negotiating it with the group",
+      NULL},
+  {"stats-interval", 's', 0, G_OPTION_ARG_INT, &stats_interval,
+      "Report sync error statistics every N seconds (default: off)", "N"},
+  {"buffering", 0, 0, G_OPTION_ARG_STRING, &buffering_mode,
+      "Download buffering policy: adaptive (default) or simple", "MODE"},
+  {"rebuffer", 0, 0, G_OPTION_ARG_STRING, &rebuffer_mode,
+      "What to do when running out of data while playing: pause (default), "
+        "or resync to keep playing on the group clock", "MODE"},
+  {"clock-lost", 0, 0, G_OPTION_ARG_STRING, &clock_lost_mode,
+      "How to recover a lost clock: reselect (default) re-applies the "
+        "network clock and base time in place, cycle goes through PAUSED",
+      "MODE"},
+  {"shared-cache", 0, 0, G_OPTION_ARG_NONE, &shared_cache,
+      "Share HTTP downloads with the other players on this host", NULL},
+  {"stream-selection", 0, 0, G_OPTION_ARG_NONE, &stream_selection,
+      "Use playbin3 and switch audio and subtitle tracks by selecting "
+        "streams, without a flush", NULL},
+  {"loop", 'L', 0, G_OPTION_ARG_NONE, &loop_playlist,
+      "Go back to the first item at the end of the playlist", NULL},
+  {"memory-report", 'm', 0, G_OPTION_ARG_INT, &memory_report,
+      "Report memory use every N seconds, and the peaks at the end", "N"},
+  {"max-queue-bytes", 0, 0, G_OPTION_ARG_INT, &max_queue_bytes,
+      "Cap every queue at this many bytes", "BYTES"},
+  {"max-pool-buffers", 0, 0, G_OPTION_ARG_INT, &max_pool_buffers,
+      "Cap buffer pools at this many buffers, where downstream allows",
+      "N"},
+  {"max-download-bytes", 0, 0, G_OPTION_ARG_INT64, &max_download_bytes,
+      "Keep at most this much of the download, in a ring buffer", "BYTES"},
+  {NULL}
 };
 
 enum
@@ -38,12 +120,153 @@ typedef struct
 
   gboolean buffering;
   gboolean is_live;
+
+  GroupControl *ctl;
+  guint report_timeout_id;
+
+  MemReport *mem_report;
+
+  /* Latency negotiation. We report our own minimum latency and how
+   * far off our clock may be, and the group tells us what to use */
+  GstClockTime min_latency;
+  GstClockTime clock_uncertainty;
+  gboolean latency_measured;
+  gboolean latency_configured;
+  guint latency_timeout_id;
+
+  /* Group seek/pause/resume */
+  GstClock *net_clock;
+  gboolean group_paused;
+  /* Running time the pipeline stands at while paused by the group */
+  GstClockTime paused_running_time;
+  /* A group seek is waiting for preroll */
+  gboolean switch_pending;
+  GstClockID pause_id;
+
+  /* Measuring when the first buffer after a switch actually got
+   * rendered. Accessed from the streaming threads, so protected by
+   * the lock */
+  GMutex lock;
+  gboolean switch_measuring;
+  guint switch_seqnum;
+  GstClockTime switch_time;
+
+  /* Fallback report when no sink tells us about the render */
+  guint switch_report_id;
+  GstClockTime playing_time;
+
+  /* The switch waiting for the pending group seek */
+  guint pending_seqnum;
+  GstClockTime pending_switch_time;
+  /* The scheduled group pause */
+  guint pause_seqnum;
+  GstClockTime pause_time;
+
+  /* The server answered us, so group commands go through it */
+  gboolean in_group;
+
+  /* Late join. The monotonic time we started at, and when the
+   * catch-up seek was made */
+  gint64 start_time;
+  gboolean joining;
+  GstClockTime join_seek_time;
+
+  /* Sync telemetry. SinkInfo for every audio and video sink, under
+   * the lock */
+  GPtrArray *sinks;
+  GstClockTimeDiff clock_offset;
+  guint audio_sample_id;
+  guint stats_id;
+
+  /* Adaptive buffering. Rates are in bytes per second */
+  gboolean adaptive_buffering;
+  gboolean prebuffered;
+  guint64 download_rate;
+  guint64 media_rate;
+  gint high_watermark;
+  guint rebuffer_count;
+
+  /* Buffering recovery that stays in PLAYING. When the data ran out,
+   * and what the rejoin skipped */
+  gboolean resync_rebuffering;
+  gboolean recovering;
+  gboolean rejoining;
+  GstClockTime stall_time;
+  GstClockTime skipped;
+  guint64 skipped_frames;
+
+  /* Clock-lost recovery, and measuring the glitch it causes. The
+   * measuring part is under the lock */
+  gboolean cycle_on_clock_lost;
+  gboolean glitch_measuring;
+  guint glitch_on_time;
+  GstClockTime glitch_end;
+  GstClockTime clock_lost_time;
+  GstClockTime clock_lost_base_time;
+
+  /* The playlist. The item playing, and the one queued up after it
+   * with its first frame still to be shown. Queued item and pending
+   * flag are under the lock, and so is measuring the cut-over */
+  gchar **items;
+  guint n_items;
+  guint current_item;
+  guint queued_item;
+  gboolean item_pending;
+  gboolean item_measuring;
+
+  /* Host-wide download cache for each item, or NULL */
+  DownloadCache **caches;
+
+  /* Track switching. With stream selection, playbin3 tells us about
+   * the streams and we pick them by id */
+  gboolean stream_selection;
+  GstStreamCollection *collection;
+  gchar *selected_video;
+  gchar *selected_audio;
+  gchar *selected_text;
+  /* When the last audio and subtitle switches were asked for, until
+   * the new track shows up. Under the lock */
+  GstClockTime audio_switch_time;
+  GstClockTime text_switch_time;
 } GlobalData;
 
+typedef struct
+{
+  GlobalData *data;
+  GstStreamType type;
+} TrackSwitch;
+
+typedef struct
+{
+  GlobalData *data;
+  GstElement *sink;
+  gboolean is_audio;
+  /* The current segment, to turn positions into running time */
+  GstSegment segment;
+  SyncStats stats;
+} SinkInfo;
+
 static gboolean handle_bus_msg (GstBus * bus, GstMessage * msg,
     GlobalData * data);
+static void handle_control_msg (GroupControl * ctl, const GstStructure * msg,
+    GSocketAddress * from, GlobalData * data);
+static gboolean report_timeout (GlobalData * data);
+static void measure_latency (GlobalData * data);
+static void deep_element_added (GstBin * bin, GstBin * sub_bin,
+    GstElement * element, GlobalData * data);
+static void sink_info_free (SinkInfo * info);
+static gboolean sample_audio_sinks (GlobalData * data);
+static gboolean report_sync_stats (GlobalData * data);
 static gboolean io_callback (GIOChannel * io, GIOCondition condition,
     GlobalData * data);
+static guint find_playlist_start (GlobalData * data, GstClock * clock);
+static void open_cache (GlobalData * data, guint item);
+static void close_caches (GlobalData * data);
+static const gchar *item_uri (GlobalData * data, guint item);
+static void source_setup (GstElement * playbin, GstElement * source,
+    GlobalData * data);
+static void about_to_finish (GstElement * playbin, GlobalData * data);
+static void cancel_group_pause (GlobalData * data);
 
 static GstElement *
 create_element (const gchar * type, const gchar * name)
@@ -74,12 +297,14 @@ main (int argc, char *argv[])
   GOptionContext *opt_ctx;
   GstClock *net_clock;
   GError *err = NULL;
-  GlobalData data;
+  GlobalData data = { 0, };
   GIOChannel *io = NULL;
   GstBus *bus;
-  gchar *uri;
   GstStateChangeReturn sret;
   gint flags;
+  guint i;
+
+  data.start_time = g_get_monotonic_time ();
 
   /* Initialize GStreamer */
   opt_ctx = g_option_context_new ("- Network clock playback");
@@ -91,10 +316,11 @@ main (int argc, char *argv[])
   g_option_context_free (opt_ctx);
 
   if (argc < 2 || clock_host == NULL || clock_port == 0) {
-    g_print ("Usage: %s -c netclock-host-IP -p netclock-host-port -b base-time <file>\n", argv[0]);
+    g_print ("Usage: %s -c netclock-host-IP -p netclock-host-port -b base-time [-l latency-ms] <file> [<file> ...]\n", argv[0]);
     g_print ("When running, pressing 'q' quits the application\n"
         "'f' seeks backwards 10 seconds\n"
         "'g' seeks forwards 10 seconds\n"
+        "'p' pauses/resumes the whole group\n"
         "'a' switches to the next audio track\n"
         "'d' enables/disables subtitles\n"
         "'s' switches to the next subtitle track\n"
@@ -109,14 +335,42 @@ main (int argc, char *argv[])
   g_print ("Network clock is synched to master\n");
 
   /* Build the pipeline */
-  data.playbin = create_element ("playbin", "playbin");
+  data.stream_selection = stream_selection;
+  data.audio_switch_time = data.text_switch_time = GST_CLOCK_TIME_NONE;
+  data.playbin = create_element (stream_selection ? "playbin3" : "playbin",
+      "playbin");
 
   /* Tell the pipeline to always use this clock, and disable
    * automatic selection */
   gst_pipeline_use_clock (GST_PIPELINE (data.playbin), net_clock);
 
-  /* We can release the clock now - the pipeline has a handle already */
-  gst_object_unref (GST_OBJECT (net_clock));
+  /* Have the clock post its statistics on our bus, so we know how
+   * far off our idea of the master time might be */
+  bus = gst_element_get_bus (data.playbin);
+  g_object_set (net_clock, "bus", bus, NULL);
+  gst_object_unref (bus);
+
+  /* Keep our handle on the clock, group commands are scheduled on it */
+  data.net_clock = net_clock;
+  g_mutex_init (&data.lock);
+
+  /* Watch the sinks, to see when things actually get rendered */
+  data.sinks = g_ptr_array_new_with_free_func ((GDestroyNotify) sink_info_free);
+  g_signal_connect (data.playbin, "deep-element-added",
+      G_CALLBACK (deep_element_added), &data);
+
+  /* Make sure the input filenames or uris are uris */
+  data.n_items = argc - 1;
+  data.items = g_new0 (gchar *, data.n_items + 1);
+  for (i = 0; i < data.n_items; i++)
+    data.items[i] = canonicalise_uri (argv[i + 1]);
+  data.caches = g_new0 (DownloadCache *, data.n_items);
+
+  /* The group may be well into the playlist already */
+  if (data.n_items > 1 || loop_playlist)
+    data.current_item = data.queued_item =
+        find_playlist_start (&data, net_clock);
+  open_cache (&data, data.current_item);
 
   /* If a base-time was supplied, pass that to the pipeline */
   if (base_time != GST_CLOCK_TIME_NONE) {
@@ -124,20 +378,62 @@ main (int argc, char *argv[])
     gst_element_set_base_time (GST_ELEMENT (data.playbin), base_time);
   }
 
-  /* Make everyone try and play with 100ms latency */
-  gst_pipeline_set_latency (GST_PIPELINE (data.playbin), 100 * GST_MSECOND);
+  /* Talk to the rest of the group through the clock server */
+  data.clock_uncertainty = GST_CLOCK_TIME_NONE;
+  if (control_port == 0)
+    control_port = clock_port + GROUP_CONTROL_PORT_OFFSET;
+  data.ctl = group_control_new_client (clock_host, control_port,
+      (GroupControlFunc) handle_control_msg, &data, &err);
+  if (data.ctl == NULL) {
+    g_printerr ("Failed to open group control channel: %s\n", err->message);
+    g_clear_error (&err);
+  } else {
+    data.report_timeout_id =
+        g_timeout_add_seconds (1, (GSourceFunc) report_timeout, &data);
+  }
 
-  /* Make sure the input filename or uri is a uri */
-  uri = canonicalise_uri (argv[1]);
+  /* Set the uri property on playbin, and queue up the next item each
+   * time one is about to finish */
+  g_signal_connect (data.playbin, "source-setup", G_CALLBACK (source_setup),
+      &data);
+  g_signal_connect (data.playbin, "about-to-finish",
+      G_CALLBACK (about_to_finish), &data);
+  g_object_set (data.playbin, "uri", item_uri (&data, data.current_item),
+      NULL);
+
+  if (buffering_mode == NULL || g_str_equal (buffering_mode, "adaptive"))
+    data.adaptive_buffering = TRUE;
+  else if (!g_str_equal (buffering_mode, "simple"))
+    g_error ("Unknown buffering mode '%s'", buffering_mode);
+
+  if (rebuffer_mode == NULL || g_str_equal (rebuffer_mode, "pause"))
+    data.resync_rebuffering = FALSE;
+  else if (g_str_equal (rebuffer_mode, "resync"))
+    data.resync_rebuffering = TRUE;
+  else
+    g_error ("Unknown rebuffer mode '%s'", rebuffer_mode);
 
-  /* Set the uri property on playbin */
-  g_object_set (data.playbin, "uri", uri, NULL);
+  if (clock_lost_mode == NULL || g_str_equal (clock_lost_mode, "reselect"))
+    data.cycle_on_clock_lost = FALSE;
+  else if (g_str_equal (clock_lost_mode, "cycle"))
+    data.cycle_on_clock_lost = TRUE;
+  else
+    g_error ("Unknown clock-lost mode '%s'", clock_lost_mode);
 
   /* Set the playbin download flag */
   g_object_get (data.playbin, "flags", &flags, NULL);
   flags |= PLAY_FLAGS_DOWNLOAD;
   g_object_set (data.playbin, "flags", flags, NULL);
 
+  /* Where the memory goes, and keeping it within limits */
+  if (memory_report > 0 || max_queue_bytes > 0 || max_pool_buffers > 0 ||
+      max_download_bytes > 0) {
+    data.mem_report = mem_report_new (data.playbin);
+    mem_report_set_limits (data.mem_report, MAX (max_queue_bytes, 0),
+        MAX (max_pool_buffers, 0), MAX (max_download_bytes, 0));
+    mem_report_start (data.mem_report, MAX (memory_report, 0), FALSE);
+  }
+
   /* Connect to the bus to receive callbacks */
   bus = gst_element_get_bus (data.playbin);
 
@@ -148,11 +444,11 @@ main (int argc, char *argv[])
   /* Set up the main loop */
   data.loop = g_main_loop_new (NULL, FALSE);
 
-  /* Start playing */
-  sret = gst_element_set_state (data.playbin, GST_STATE_PLAYING);
+  /* Preroll first. We go to PLAYING once we know what latency
+   * the group is going to play at */
+  sret = gst_element_set_state (data.playbin, GST_STATE_PAUSED);
 
-  g_print ("Now playing %s\n", uri);
-  g_free (uri);
+  g_print ("Now playing %s\n", data.items[data.current_item]);
 
   switch (sret) {
     case GST_STATE_CHANGE_FAILURE:
@@ -161,6 +457,8 @@ main (int argc, char *argv[])
     case GST_STATE_CHANGE_NO_PREROLL:
       g_print ("Pipeline is live.\n");
       data.is_live = TRUE;
+      /* There won't be a preroll, so measure the latency now */
+      measure_latency (&data);
       break;
     case GST_STATE_CHANGE_ASYNC:
       g_print ("Prerolling...\r");
@@ -169,6 +467,13 @@ main (int argc, char *argv[])
       break;
   }
 
+  if (stats_interval > 0) {
+    data.audio_sample_id = g_timeout_add (AUDIO_SAMPLE_INTERVAL,
+        (GSourceFunc) sample_audio_sinks, &data);
+    data.stats_id = g_timeout_add_seconds (stats_interval,
+        (GSourceFunc) report_sync_stats, &data);
+  }
+
   /* Listen to stdin input */
   io = g_io_channel_unix_new (fileno (stdin));
   data.io_watch_id = g_io_add_watch (io, G_IO_IN, (GIOFunc) (io_callback),
@@ -181,19 +486,1303 @@ main (int argc, char *argv[])
   /* Clean everything up before exiting */
   g_source_remove (data.bus_watch);
   g_source_remove (data.io_watch_id);
+  if (data.report_timeout_id)
+    g_source_remove (data.report_timeout_id);
+  if (data.latency_timeout_id)
+    g_source_remove (data.latency_timeout_id);
+  if (data.switch_report_id)
+    g_source_remove (data.switch_report_id);
+  if (data.audio_sample_id)
+    g_source_remove (data.audio_sample_id);
+  if (data.stats_id)
+    g_source_remove (data.stats_id);
+  cancel_group_pause (&data);
+  if (data.ctl)
+    group_control_free (data.ctl);
+  /* Release the streaming thread if it's waiting for the cache */
+  for (i = 0; i < data.n_items; i++)
+    if (data.caches[i])
+      download_cache_stop (data.caches[i]);
   gst_element_set_state (data.playbin, GST_STATE_NULL);
+  if (data.mem_report) {
+    if (memory_report > 0)
+      mem_report_print_peaks (data.mem_report);
+    mem_report_free (data.mem_report);
+  }
   gst_object_unref (data.playbin);
+  for (i = 0; i < data.n_items; i++) {
+    if (data.caches[i]) {
+      download_cache_print_stats (data.caches[i]);
+      download_cache_free (data.caches[i]);
+    }
+  }
+  g_free (data.caches);
+  g_strfreev (data.items);
+  g_ptr_array_unref (data.sinks);
+  if (data.collection)
+    gst_object_unref (data.collection);
+  g_free (data.selected_video);
+  g_free (data.selected_audio);
+  g_free (data.selected_text);
+  gst_object_unref (data.net_clock);
+  g_mutex_clear (&data.lock);
   g_main_loop_unref (data.loop);
 
   return 0;
 }
 
+/* When joining a playlist that's already going, start on the item the
+ * group is on, and act as if we had played the ones before it by
+ * moving our base time on by their duration */
+static guint
+find_playlist_start (GlobalData * data, GstClock * clock)
+{
+  GstDiscoverer *discoverer;
+  GstClockTime *durations, total = 0, elapsed, now;
+  guint i, item = 0;
+
+  now = gst_clock_get_time (clock);
+  if (!GST_CLOCK_TIME_IS_VALID (base_time) || now <= base_time)
+    return 0;
+
+  discoverer = gst_discoverer_new (10 * GST_SECOND, NULL);
+  if (discoverer == NULL)
+    return 0;
+
+  durations = g_new0 (GstClockTime, data->n_items);
+  for (i = 0; i < data->n_items; i++) {
+    GstDiscovererInfo *info;
+
+    info = gst_discoverer_discover_uri (discoverer, data->items[i], NULL);
+    if (info) {
+      durations[i] = gst_discoverer_info_get_duration (info);
+      gst_discoverer_info_unref (info);
+    }
+    if (!GST_CLOCK_TIME_IS_VALID (durations[i]) || durations[i] == 0) {
+      g_print ("Can't tell how long %s is, starting the playlist from the "
+          "top\n", data->items[i]);
+      goto done;
+    }
+    total += durations[i];
+  }
+
+  elapsed = now - base_time;
+  if (loop_playlist) {
+    base_time += elapsed / total * total;
+    elapsed %= total;
+  }
+  for (item = 0; item < data->n_items - 1 && elapsed >= durations[item];
+      item++) {
+    elapsed -= durations[item];
+    base_time += durations[item];
+  }
+
+  if (item > 0)
+    g_print ("The group is on playlist item %u, starting there\n", item + 1);
+
+done:
+  g_free (durations);
+  g_object_unref (discoverer);
+
+  return item;
+}
+
+/* Other players on this host may be fetching the same files. Opening
+ * a cache starts downloading the whole file, so only the item playing
+ * and the one queued after it have one open. Anything more would take
+ * bandwidth from the item playing, and the prebuffering works that
+ * out from the download rate */
+static void
+open_cache (GlobalData * data, guint item)
+{
+  const gchar *uri = data->items[item];
+  DownloadCache *cache;
+  GError *err = NULL;
+
+  if (!shared_cache || (!gst_uri_has_protocol (uri, "http") &&
+          !gst_uri_has_protocol (uri, "https")))
+    return;
+
+  g_mutex_lock (&data->lock);
+  cache = data->caches[item];
+  g_mutex_unlock (&data->lock);
+  if (cache)
+    return;
+
+  /* This asks the server about the file, so don't hold the lock */
+  cache = download_cache_open (uri, &err);
+  if (cache == NULL) {
+    g_printerr ("Not using the shared cache for %s: %s\n", uri,
+        err->message);
+    g_clear_error (&err);
+    return;
+  }
+
+  g_mutex_lock (&data->lock);
+  data->caches[item] = cache;
+  g_mutex_unlock (&data->lock);
+}
+
+/* Once an item has started, the ones before it are done with, and
+ * their sources have all had EOS. Their caches can go, and get opened
+ * again if the playlist loops back round to them */
+static void
+close_caches (GlobalData * data)
+{
+  DownloadCache *cache;
+  guint i;
+
+  for (i = 0; i < data->n_items; i++) {
+    g_mutex_lock (&data->lock);
+    cache = NULL;
+    if (i != data->current_item && i != data->queued_item) {
+      cache = data->caches[i];
+      data->caches[i] = NULL;
+    }
+    g_mutex_unlock (&data->lock);
+
+    if (cache) {
+      download_cache_print_stats (cache);
+      download_cache_free (cache);
+    }
+  }
+}
+
+/* What to give playbin for @item. Going through the shared cache, the
+ * data comes from an appsrc reading the cache instead */
+static const gchar *
+item_uri (GlobalData * data, guint item)
+{
+  gboolean cached;
+
+  g_mutex_lock (&data->lock);
+  cached = data->caches[item] != NULL;
+  g_mutex_unlock (&data->lock);
+
+  return cached ? "appsrc://" : data->items[item];
+}
+
+static void
+source_setup (GstElement * playbin, GstElement * source, GlobalData * data)
+{
+  DownloadCache *cache;
+
+  g_mutex_lock (&data->lock);
+  cache = data->caches[data->queued_item];
+  g_mutex_unlock (&data->lock);
+
+  if (cache)
+    download_cache_setup_source (playbin, source, cache);
+}
+
+/* Called from a streaming thread when the current item is nearly done.
+ * Setting the next uri now lets playbin preroll it and play it right
+ * after, so the running time just carries on and every player in the
+ * group gets to the next item at the same clock time */
+static void
+about_to_finish (GstElement * playbin, GlobalData * data)
+{
+  guint next;
+
+  g_mutex_lock (&data->lock);
+  next = data->queued_item + 1;
+  g_mutex_unlock (&data->lock);
+
+  if (next >= data->n_items) {
+    if (!loop_playlist)
+      return;
+    next = 0;
+  }
+
+  /* Start fetching the next item only now, so there's only ever one
+   * download ahead of the one playing */
+  open_cache (data, next);
+
+  g_mutex_lock (&data->lock);
+  data->queued_item = next;
+  data->item_pending = TRUE;
+  g_mutex_unlock (&data->lock);
+
+  g_object_set (playbin, "uri", item_uri (data, next), NULL);
+}
+
+static GstClockTime
+get_latency (GlobalData * data)
+{
+  GstClockTime latency;
+
+  latency = gst_pipeline_get_latency (GST_PIPELINE (data->playbin));
+  if (!GST_CLOCK_TIME_IS_VALID (latency))
+    return 0;
+
+  return latency;
+}
+
+/* Go to PLAYING, unless something still holds us back */
+static void
+maybe_start_playback (GlobalData * data)
+{
+  if (!data->latency_configured || data->buffering || data->group_paused ||
+      data->switch_pending)
+    return;
+
+  gst_element_set_state (data->playbin, GST_STATE_PLAYING);
+}
+
+static void group_seek (GlobalData * data, guint seqnum,
+    GstClockTime position, GstClockTime switch_time);
+
+/* If the group started playing before us, skip straight to where it
+ * will be a little from now, instead of rendering everything late
+ * until we catch up */
+static gboolean
+join_late (GlobalData * data, GstClockTime lead)
+{
+  GstClockTime now, switch_time, start;
+
+  if (!GST_CLOCK_TIME_IS_VALID (base_time) || data->is_live)
+    return FALSE;
+
+  now = gst_clock_get_time (data->net_clock);
+  start = base_time + get_latency (data);
+  if (now + lead / 2 < start)
+    return FALSE;
+
+  switch_time = now + lead;
+  g_print ("Joining %" GST_TIME_FORMAT " late, seeking ahead\n",
+      GST_TIME_ARGS (now > start ? now - start : 0));
+
+  data->joining = TRUE;
+  data->join_seek_time = now;
+  group_seek (data, JOIN_SEQNUM, switch_time - start, switch_time);
+
+  return TRUE;
+}
+
+/* Going through PAUSED to pick a new clock prerolls again and picks a
+ * new base time, which throws away the one the group agreed on. We
+ * only ever want the network clock anyway, so hand it and the base
+ * time we had straight to every element */
+static void
+set_element_base_time (const GValue * item, GstClockTime * base)
+{
+  gst_element_set_base_time (GST_ELEMENT (g_value_get_object (item)), *base);
+}
+
+static void
+reselect_clock (GlobalData * data)
+{
+  GstClockTime base = gst_element_get_base_time (data->playbin);
+  GstIterator *it;
+
+  gst_pipeline_use_clock (GST_PIPELINE (data->playbin), data->net_clock);
+  gst_element_set_clock (data->playbin, data->net_clock);
+
+  it = gst_bin_iterate_recurse (GST_BIN (data->playbin));
+  gst_iterator_foreach (it, (GstIteratorForeachFunction) set_element_base_time,
+      &base);
+  gst_iterator_free (it);
+}
+
+/* The segment the sinks are playing, preferring a video sink */
+static gboolean
+get_playback_segment (GlobalData * data, GstSegment * segment,
+    gint * fps_n, gint * fps_d)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  *fps_n = 0;
+  *fps_d = 1;
+
+  g_mutex_lock (&data->lock);
+  for (i = 0; i < data->sinks->len; i++) {
+    SinkInfo *sink_info = g_ptr_array_index (data->sinks, i);
+    GstStructure *s;
+    GstCaps *caps;
+    GstPad *pad;
+
+    if (sink_info->segment.format != GST_FORMAT_TIME)
+      continue;
+    if (ret && sink_info->is_audio)
+      continue;
+
+    gst_segment_copy_into (&sink_info->segment, segment);
+    ret = TRUE;
+    if (sink_info->is_audio)
+      continue;
+
+    pad = gst_element_get_static_pad (sink_info->sink, "sink");
+    caps = gst_pad_get_current_caps (pad);
+    if (caps) {
+      s = gst_caps_get_structure (caps, 0);
+      gst_structure_get_fraction (s, "framerate", fps_n, fps_d);
+      gst_caps_unref (caps);
+    }
+    gst_object_unref (pad);
+    break;
+  }
+  g_mutex_unlock (&data->lock);
+
+  return ret;
+}
+
+/* Pick up where the group will be a little from now, without ever
+ * leaving PLAYING. Setting the base time before the flushing seek
+ * makes the new position render exactly at the rejoin time, and
+ * anything that comes too late still gets dropped against the group
+ * clock */
+static void
+resync_to_group (GlobalData * data)
+{
+  GstSegment segment;
+  GstClockTime now, switch_time, start, position, stall_position;
+  gint fps_n, fps_d;
+
+  if (!get_playback_segment (data, &segment, &fps_n, &fps_d)) {
+    g_printerr ("Don't know where we are, can't resync\n");
+    return;
+  }
+
+  now = gst_clock_get_time (data->net_clock);
+  switch_time = now + RESYNC_LEAD;
+  start = gst_element_get_base_time (data->playbin) + get_latency (data);
+  if (switch_time < start || data->stall_time < start)
+    return;
+
+  position = gst_segment_to_stream_time (&segment, GST_FORMAT_TIME,
+      gst_segment_position_from_running_time (&segment, GST_FORMAT_TIME,
+          switch_time - start));
+  stall_position = gst_segment_to_stream_time (&segment, GST_FORMAT_TIME,
+      gst_segment_position_from_running_time (&segment, GST_FORMAT_TIME,
+          data->stall_time - start));
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    return;
+
+  data->skipped = 0;
+  if (GST_CLOCK_TIME_IS_VALID (stall_position) && position > stall_position)
+    data->skipped = position - stall_position;
+  data->skipped_frames = fps_n > 0 ?
+      gst_util_uint64_scale (data->skipped, fps_n, fps_d * GST_SECOND) : 0;
+
+  g_print ("Rejoining the group at %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (position));
+  data->rejoining = TRUE;
+
+  gst_element_set_start_time (data->playbin, GST_CLOCK_TIME_NONE);
+  gst_element_set_base_time (data->playbin, switch_time - get_latency (data));
+
+  g_mutex_lock (&data->lock);
+  data->switch_measuring = TRUE;
+  data->switch_seqnum = RESYNC_SEQNUM;
+  data->switch_time = switch_time;
+  g_mutex_unlock (&data->lock);
+
+  gst_element_seek_simple (data->playbin, GST_FORMAT_TIME,
+      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, position);
+}
+
+static void
+start_rebuffering (GlobalData * data)
+{
+  data->buffering = TRUE;
+
+  /* The rejoin seek itself empties the queues. That's no new stall */
+  if (data->rejoining)
+    return;
+
+  /* Pausing would leave us behind the group for good. Keep running
+   * on the group clock instead, and rejoin once there's data */
+  if (data->resync_rebuffering &&
+      GST_STATE (data->playbin) == GST_STATE_PLAYING) {
+    data->recovering = TRUE;
+    data->stall_time = gst_clock_get_time (data->net_clock);
+    return;
+  }
+
+  gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+}
+
+static void
+finish_rebuffering (GlobalData * data)
+{
+  data->buffering = FALSE;
+
+  if (data->recovering) {
+    data->recovering = FALSE;
+    resync_to_group (data);
+    return;
+  }
+
+  maybe_start_playback (data);
+}
+
+/* Bytes per second the media needs, from its size and duration */
+static gboolean
+update_media_rate (GlobalData * data)
+{
+  gint64 bytes, duration;
+
+  if (data->media_rate > 0)
+    return TRUE;
+
+  if (!gst_element_query_duration (data->playbin, GST_FORMAT_BYTES, &bytes) ||
+      bytes <= 0 ||
+      !gst_element_query_duration (data->playbin, GST_FORMAT_TIME, &duration)
+      || duration <= 0)
+    return FALSE;
+
+  data->media_rate = gst_util_uint64_scale (bytes, GST_SECOND, duration);
+  g_print ("\nMedia needs %" G_GUINT64_FORMAT " kB/s\n",
+      data->media_rate / 1000);
+
+  return TRUE;
+}
+
+/* How much of the file we need to have before starting, so that the
+ * download stays ahead of playback all the way to the end. If we get
+ * R bytes/s of a file needing M bytes/s, that's 1 - R/M of it */
+static gdouble
+required_prebuffer (GlobalData * data)
+{
+  gdouble ratio;
+
+  ratio = DOWNLOAD_RATE_HEADROOM * data->download_rate / data->media_rate;
+
+  return CLAMP (1.0 - ratio, MIN_PREBUFFER, 1.0);
+}
+
+/* How much of the file is downloaded, from 0 to 1 */
+static gdouble
+query_downloaded (GlobalData * data)
+{
+  GstQuery *query;
+  GstFormat format;
+  gint64 start, stop;
+  gdouble ret = 0.0;
+
+  query = gst_query_new_buffering (GST_FORMAT_PERCENT);
+  if (gst_element_query (data->playbin, query)) {
+    gst_query_parse_buffering_range (query, &format, &start, &stop, NULL);
+    if (format == GST_FORMAT_PERCENT && stop > 0)
+      ret = (gdouble) stop / GST_FORMAT_PERCENT_MAX;
+  }
+  gst_query_unref (query);
+
+  return ret;
+}
+
+/* Rather than pausing below 100% and resuming at 100% all the time,
+ * prebuffer once as much as the link speed says we need, and after
+ * that only stop when really about to run dry */
+static void
+handle_download_buffering (GlobalData * data, gint percent)
+{
+  gdouble have, need;
+
+  if (data->prebuffered) {
+    if (!data->buffering && percent < LOW_WATERMARK) {
+      data->rebuffer_count++;
+      g_print ("\nRe-buffering, download can't keep up\n");
+      start_rebuffering (data);
+    } else if (data->buffering && percent >= data->high_watermark) {
+      finish_rebuffering (data);
+    }
+    return;
+  }
+
+  /* Until we know both rates, wait for the queue to fill up */
+  if (data->download_rate == 0 || !update_media_rate (data)) {
+    data->buffering = (percent < 100);
+    need = 1.0;
+  } else {
+    have = query_downloaded (data);
+    need = required_prebuffer (data);
+    g_print ("Prebuffering %.1f%% of %.1f%% at %" G_GUINT64_FORMAT
+        " kB/s  \r", have * 100, need * 100, data->download_rate / 1000);
+    data->buffering = (have < need);
+  }
+
+  if (data->buffering)
+    return;
+
+  data->prebuffered = TRUE;
+  data->high_watermark = CLAMP ((gint) (need * 100), LOW_WATERMARK + 10, 100);
+  g_print ("\nPrebuffered, re-buffering below %d%% until %d%%\n",
+      LOW_WATERMARK, data->high_watermark);
+  maybe_start_playback (data);
+}
+
+static void
+apply_latency (GlobalData * data, GstClockTime latency)
+{
+  if (data->latency_configured &&
+      latency == gst_pipeline_get_latency (GST_PIPELINE (data->playbin)))
+    return;
+
+  g_print ("Using pipeline latency %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (latency));
+  gst_pipeline_set_latency (GST_PIPELINE (data->playbin), latency);
+
+  if (data->latency_configured) {
+    /* Already running, so the sinks need to hear about the change */
+    gst_bin_recalculate_latency (GST_BIN (data->playbin));
+    return;
+  }
+
+  data->latency_configured = TRUE;
+  if (data->latency_timeout_id) {
+    g_source_remove (data->latency_timeout_id);
+    data->latency_timeout_id = 0;
+  }
+
+  if (join_late (data, JOIN_LEAD))
+    return;
+
+  maybe_start_playback (data);
+}
+
+static void
+report_latency (GlobalData * data)
+{
+  GstStructure *s;
+
+  /* Wait until we know both our own latency and the clock quality */
+  if (data->ctl == NULL || !data->latency_measured ||
+      !GST_CLOCK_TIME_IS_VALID (data->clock_uncertainty))
+    return;
+
+  s = gst_structure_new ("latency-report",
+      "min-latency", G_TYPE_UINT64, data->min_latency,
+      "clock-uncertainty", G_TYPE_UINT64, data->clock_uncertainty, NULL);
+  group_control_send (data->ctl, NULL, s);
+  gst_structure_free (s);
+}
+
+/* Keeps us known to the group, and keeps our numbers current */
+static gboolean
+report_timeout (GlobalData * data)
+{
+  report_latency (data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+group_latency_timeout (GlobalData * data)
+{
+  data->latency_timeout_id = 0;
+
+  g_print ("No latency from the group, using %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (DEFAULT_LATENCY));
+  apply_latency (data, DEFAULT_LATENCY);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+measure_latency (GlobalData * data)
+{
+  GstQuery *query;
+  gboolean live;
+  GstClockTime min_latency, max_latency;
+
+  if (data->latency_measured)
+    return;
+
+  data->min_latency = 0;
+  query = gst_query_new_latency ();
+  if (gst_element_query (data->playbin, query)) {
+    gst_query_parse_latency (query, &live, &min_latency, &max_latency);
+    if (GST_CLOCK_TIME_IS_VALID (min_latency))
+      data->min_latency = min_latency;
+  }
+  gst_query_unref (query);
+  data->latency_measured = TRUE;
+
+  g_print ("Pipeline minimum latency %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (data->min_latency));
+
+  if (latency_ms > 0) {
+    apply_latency (data, latency_ms * GST_MSECOND);
+    return;
+  }
+
+  if (data->ctl == NULL) {
+    apply_latency (data, DEFAULT_LATENCY);
+    return;
+  }
+
+  report_latency (data);
+  data->latency_timeout_id = g_timeout_add_seconds (GROUP_LATENCY_TIMEOUT,
+      (GSourceFunc) group_latency_timeout, data);
+}
+
+static void
+send_switch_report (GlobalData * data, guint seqnum,
+    GstClockTime switch_time, GstClockTime actual_time)
+{
+  GstStructure *s;
+
+  g_print ("Switch %u happened %" G_GINT64_FORMAT " us from its target\n",
+      seqnum, GST_CLOCK_DIFF (switch_time, actual_time) / GST_USECOND);
+
+  if (seqnum == RESYNC_SEQNUM) {
+    data->rejoining = FALSE;
+    g_print ("Recovered from buffering in %" G_GUINT64_FORMAT " ms, skipped %"
+        G_GUINT64_FORMAT " ms (%" G_GUINT64_FORMAT " frames)\n",
+        (actual_time - data->stall_time) / GST_MSECOND,
+        data->skipped / GST_MSECOND, data->skipped_frames);
+    return;
+  }
+
+  if (seqnum == JOIN_SEQNUM) {
+    g_print ("Joined the group in sync %" G_GINT64_FORMAT " ms after start\n",
+        (g_get_monotonic_time () - data->start_time) / 1000);
+    return;
+  }
+
+  if (!data->in_group)
+    return;
+
+  s = gst_structure_new ("switch-done",
+      "seqnum", G_TYPE_UINT, seqnum,
+      "switch-time", G_TYPE_UINT64, switch_time,
+      "actual-time", G_TYPE_UINT64, actual_time,
+      "clock-uncertainty", G_TYPE_UINT64, data->clock_uncertainty, NULL);
+  group_control_send (data->ctl, NULL, s);
+  gst_structure_free (s);
+}
+
+/* Tell the group when our first frame of the next playlist item was
+ * meant to be shown, and when it really was */
+static void
+report_item_start (GlobalData * data, GstPad * pad, guint item,
+    GstClockTime start_time, GstClockTime actual_time)
+{
+  GstClockTime frame_duration = GST_CLOCK_TIME_NONE;
+  GstStructure *s;
+  GstCaps *caps;
+  gint fps_n, fps_d;
+
+  caps = gst_pad_get_current_caps (pad);
+  if (caps) {
+    if (gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+            "framerate", &fps_n, &fps_d) && fps_n > 0)
+      frame_duration = gst_util_uint64_scale_int (GST_SECOND, fps_d, fps_n);
+    gst_caps_unref (caps);
+  }
+
+  g_print ("Playlist item %u shown %" G_GINT64_FORMAT " us from its target\n",
+      item + 1, GST_CLOCK_DIFF (start_time, actual_time) / GST_USECOND);
+
+  if (!data->in_group)
+    return;
+
+  s = gst_structure_new ("item-started",
+      "item", G_TYPE_UINT, item,
+      "start-time", G_TYPE_UINT64, start_time,
+      "actual-time", G_TYPE_UINT64, actual_time,
+      "frame-duration", G_TYPE_UINT64, frame_duration,
+      "clock-uncertainty", G_TYPE_UINT64, data->clock_uncertainty, NULL);
+  group_control_send (data->ctl, NULL, s);
+  gst_structure_free (s);
+}
+
+/* The first buffer of the new track plays at base time + its running
+ * time + latency, or right away if that's already past */
+static GstPadProbeReturn
+track_switch_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    TrackSwitch * ts)
+{
+  GlobalData *data = ts->data;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime *requested, running_time, shown, now;
+  GstSegment segment;
+  GstEvent *event;
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event == NULL)
+    return GST_PAD_PROBE_OK;
+  gst_event_copy_segment (event, &segment);
+  gst_event_unref (event);
+
+  running_time = gst_segment_to_running_time (&segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buf));
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return GST_PAD_PROBE_OK;
+
+  now = gst_clock_get_time (data->net_clock);
+  shown = gst_element_get_base_time (data->playbin) + running_time +
+      get_latency (data);
+  shown = MAX (shown, now);
+
+  g_mutex_lock (&data->lock);
+  requested = ts->type == GST_STREAM_TYPE_AUDIO ?
+      &data->audio_switch_time : &data->text_switch_time;
+  if (GST_CLOCK_TIME_IS_VALID (*requested)) {
+    g_print ("%s track switch took %" G_GUINT64_FORMAT " ms (%s)\n",
+        ts->type == GST_STREAM_TYPE_AUDIO ? "Audio" : "Subtitle",
+        (shown - *requested) / GST_MSECOND,
+        data->stream_selection ? "stream selection" : "playbin properties");
+    *requested = GST_CLOCK_TIME_NONE;
+  }
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* A new stream starting on @pad after a track switch was asked for
+ * means the next buffer is from the new track */
+static void
+watch_track_switch (GlobalData * data, GstPad * pad, GstStreamType type)
+{
+  TrackSwitch *ts;
+  gboolean pending;
+
+  g_mutex_lock (&data->lock);
+  pending = GST_CLOCK_TIME_IS_VALID (type == GST_STREAM_TYPE_AUDIO ?
+      data->audio_switch_time : data->text_switch_time);
+  g_mutex_unlock (&data->lock);
+
+  if (!pending)
+    return;
+
+  ts = g_new (TrackSwitch, 1);
+  ts->data = data;
+  ts->type = type;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) track_switch_buffer_probe, ts, g_free);
+}
+
+static GstPadProbeReturn
+subtitle_event_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) ==
+      GST_EVENT_STREAM_START)
+    watch_track_switch (data, pad, GST_STREAM_TYPE_TEXT);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sinks report how late (or early) each buffer was rendered with an
+ * upstream QoS event. That feeds the sync statistics, and the first
+ * one after a switch tells us when the switch really happened */
+static GstPadProbeReturn
+sink_event_probe (GstPad * pad, GstPadProbeInfo * info, SinkInfo * sink_info)
+{
+  GlobalData *data = sink_info->data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstClockTimeDiff jitter;
+  GstClockTime timestamp, rendered, switch_time;
+  gboolean measuring, item_measuring;
+  guint seqnum, item;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+    g_mutex_lock (&data->lock);
+    gst_event_copy_segment (event, &sink_info->segment);
+    g_mutex_unlock (&data->lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START) {
+    if (sink_info->is_audio) {
+      watch_track_switch (data, pad, GST_STREAM_TYPE_AUDIO);
+    } else {
+      /* The next playlist item reached the video sink, its first QoS
+       * tells us when it was shown */
+      g_mutex_lock (&data->lock);
+      if (data->item_pending) {
+        data->item_pending = FALSE;
+        data->item_measuring = TRUE;
+      }
+      g_mutex_unlock (&data->lock);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_QOS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_qos (event, NULL, NULL, &jitter, &timestamp);
+
+  g_mutex_lock (&data->lock);
+  sync_stats_add (&sink_info->stats, jitter);
+
+  if (data->glitch_measuring && ABS (jitter) >= GLITCH_THRESHOLD) {
+    data->glitch_on_time = 0;
+  } else if (data->glitch_measuring) {
+    GstClockTime base = gst_element_get_base_time (sink_info->sink);
+
+    /* Recovered at the first frame of the run */
+    rendered = base + timestamp + get_latency (data) + jitter;
+    if (data->glitch_on_time++ == 0)
+      data->glitch_end = rendered;
+
+    if (data->glitch_on_time >= GLITCH_ON_TIME_FRAMES) {
+      data->glitch_measuring = FALSE;
+      g_print ("Recovered from clock loss by %s in %" G_GINT64_FORMAT
+          " ms, base time moved by %" G_GINT64_FORMAT " ms\n",
+          data->cycle_on_clock_lost ? "cycling" : "reselecting",
+          GST_CLOCK_DIFF (data->clock_lost_time,
+              data->glitch_end) / GST_MSECOND,
+          GST_CLOCK_DIFF (data->clock_lost_base_time, base) / GST_MSECOND);
+    }
+  }
+
+  measuring = data->switch_measuring;
+  data->switch_measuring = FALSE;
+  seqnum = data->switch_seqnum;
+  switch_time = data->switch_time;
+  item_measuring = data->item_measuring;
+  data->item_measuring = FALSE;
+  item = data->queued_item;
+  g_mutex_unlock (&data->lock);
+
+  if (!measuring && !item_measuring)
+    return GST_PAD_PROBE_OK;
+
+  /* The sink aimed for base time + running time + latency, and missed
+   * it by the jitter */
+  rendered = gst_element_get_base_time (sink_info->sink) + timestamp +
+      get_latency (data) + jitter;
+
+  if (measuring)
+    send_switch_report (data, seqnum, switch_time, rendered);
+  if (item_measuring)
+    report_item_start (data, pad, item, rendered - jitter, rendered);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+sink_info_free (SinkInfo * info)
+{
+  gst_object_unref (info->sink);
+  g_free (info);
+}
+
+static void
+deep_element_added (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    GlobalData * data)
+{
+  SinkInfo *sink_info;
+  GstElementFactory *factory;
+  const gchar *klass;
+  GstPad *pad;
+
+  /* Subtitles end up in an overlay rather than a sink of their own */
+  factory = gst_element_get_factory (element);
+  if (factory && g_str_equal (GST_OBJECT_NAME (factory), "subtitleoverlay")) {
+    pad = gst_element_get_static_pad (element, "subtitle_sink");
+    if (pad) {
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+          (GstPadProbeCallback) subtitle_event_probe, data, NULL);
+      gst_object_unref (pad);
+    }
+    return;
+  }
+
+  if (GST_IS_BIN (element) ||
+      !GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK))
+    return;
+
+  /* Only real audio and video outputs, not fakesinks */
+  klass = gst_element_get_metadata (element, GST_ELEMENT_METADATA_KLASS);
+  if (klass == NULL ||
+      (strstr (klass, "Audio") == NULL && strstr (klass, "Video") == NULL))
+    return;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  if (pad == NULL)
+    return;
+
+  sink_info = g_new0 (SinkInfo, 1);
+  sink_info->data = data;
+  sink_info->sink = gst_object_ref (element);
+  sink_info->is_audio = strstr (klass, "Audio") != NULL;
+  gst_segment_init (&sink_info->segment, GST_FORMAT_UNDEFINED);
+
+  g_mutex_lock (&data->lock);
+  g_ptr_array_add (data->sinks, sink_info);
+  g_mutex_unlock (&data->lock);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) sink_event_probe, sink_info, NULL);
+  gst_object_unref (pad);
+}
+
+/* Audio sinks don't send QoS. Their own clock counts the samples the
+ * device has really played, and the sink maps it onto the pipeline
+ * clock with a calibration that it only corrects once the drift is
+ * past its tolerance. Where that puts the device against the network
+ * clock now is how far the audio really is off */
+static gboolean
+sample_audio_sinks (GlobalData * data)
+{
+  GstClockTime now, internal, played;
+  GstClockTime cinternal, cexternal, rate_num, rate_denom;
+  guint i, n_sinks;
+
+  if (GST_STATE (data->playbin) != GST_STATE_PLAYING)
+    return G_SOURCE_CONTINUE;
+
+  g_mutex_lock (&data->lock);
+  n_sinks = data->sinks->len;
+  g_mutex_unlock (&data->lock);
+
+  for (i = 0; i < n_sinks; i++) {
+    SinkInfo *sink_info;
+    GstClock *clock;
+
+    g_mutex_lock (&data->lock);
+    sink_info = g_ptr_array_index (data->sinks, i);
+    g_mutex_unlock (&data->lock);
+
+    if (!sink_info->is_audio)
+      continue;
+    clock = gst_element_provide_clock (sink_info->sink);
+    if (clock == NULL)
+      continue;
+    /* Only an audio clock is driven by the device */
+    if (!GST_IS_AUDIO_CLOCK (clock)) {
+      gst_object_unref (clock);
+      continue;
+    }
+
+    internal = gst_clock_get_internal_time (clock);
+    gst_clock_get_calibration (clock, &cinternal, &cexternal, &rate_num,
+        &rate_denom);
+    now = gst_clock_get_time (data->net_clock);
+    gst_object_unref (clock);
+
+    /* Not started yet */
+    if (!GST_CLOCK_TIME_IS_VALID (internal) || internal == 0 ||
+        cexternal == 0)
+      continue;
+
+    played = gst_clock_adjust_with_calibration (NULL, internal, cinternal,
+        cexternal, rate_num, rate_denom);
+
+    g_mutex_lock (&data->lock);
+    sync_stats_add (&sink_info->stats, GST_CLOCK_DIFF (played, now));
+    g_mutex_unlock (&data->lock);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+report_sync_stats (GlobalData * data)
+{
+  SyncStats audio, video;
+  GstStructure *s;
+  gchar *str;
+  guint i;
+
+  sync_stats_reset (&audio);
+  sync_stats_reset (&video);
+
+  g_print ("\nSync error over the last %ds, clock offset %+" G_GINT64_FORMAT
+      "us, uncertainty %" G_GUINT64_FORMAT "us\n", stats_interval,
+      data->clock_offset / GST_USECOND,
+      GST_CLOCK_TIME_IS_VALID (data->clock_uncertainty) ?
+      data->clock_uncertainty / GST_USECOND : 0);
+
+  g_mutex_lock (&data->lock);
+  for (i = 0; i < data->sinks->len; i++) {
+    SinkInfo *sink_info = g_ptr_array_index (data->sinks, i);
+    SyncStats *total = sink_info->is_audio ? &audio : &video;
+
+    if (sink_info->stats.count == 0)
+      continue;
+
+    str = sync_stats_to_string (&sink_info->stats);
+    g_print ("  %s: %s\n", GST_OBJECT_NAME (sink_info->sink), str);
+    g_free (str);
+
+    if (total->count == 0 || sink_info->stats.min < total->min)
+      total->min = sink_info->stats.min;
+    if (total->count == 0 || sink_info->stats.max > total->max)
+      total->max = sink_info->stats.max;
+    total->sum += sink_info->stats.sum;
+    total->count += sink_info->stats.count;
+
+    sync_stats_reset (&sink_info->stats);
+  }
+  g_mutex_unlock (&data->lock);
+
+  if (audio.count > 0 && video.count > 0)
+    g_print ("  A/V skew %+" G_GINT64_FORMAT "us\n",
+        (sync_stats_mean (&audio) - sync_stats_mean (&video)) / GST_USECOND);
+
+  /* Let the operator see it on the server too */
+  if (data->in_group) {
+    s = gst_structure_new ("sync-stats",
+        "clock-offset", G_TYPE_INT64, data->clock_offset,
+        "video-count", G_TYPE_UINT64, video.count,
+        "video-mean", G_TYPE_INT64, sync_stats_mean (&video),
+        "video-max", G_TYPE_INT64, MAX (ABS (video.min), ABS (video.max)),
+        "audio-count", G_TYPE_UINT64, audio.count,
+        "audio-mean", G_TYPE_INT64, sync_stats_mean (&audio),
+        "audio-max", G_TYPE_INT64, MAX (ABS (audio.min), ABS (audio.max)),
+        NULL);
+    group_control_send (data->ctl, NULL, s);
+    gst_structure_free (s);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Without a sink telling us, the best we know is when the pipeline
+ * went to PLAYING */
+static gboolean
+switch_report_timeout (GlobalData * data)
+{
+  gboolean measuring;
+  guint seqnum;
+  GstClockTime switch_time;
+
+  data->switch_report_id = 0;
+
+  g_mutex_lock (&data->lock);
+  measuring = data->switch_measuring;
+  data->switch_measuring = FALSE;
+  seqnum = data->switch_seqnum;
+  switch_time = data->switch_time;
+  g_mutex_unlock (&data->lock);
+
+  if (measuring)
+    send_switch_report (data, seqnum, switch_time,
+        MAX (switch_time, data->playing_time));
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Play on from @running_time, exactly at @switch_time on the group
+ * clock, by picking a new base time */
+static void
+start_switch (GlobalData * data, guint seqnum, GstClockTime switch_time,
+    GstClockTime running_time)
+{
+  GstClockTime now;
+
+  now = gst_clock_get_time (data->net_clock);
+  if (now > switch_time)
+    g_print ("Ready %" G_GUINT64_FORMAT " us too late for switch %u\n",
+        (now - switch_time) / GST_USECOND, seqnum);
+
+  gst_element_set_start_time (data->playbin, GST_CLOCK_TIME_NONE);
+  gst_element_set_base_time (data->playbin,
+      switch_time - get_latency (data) - running_time);
+
+  g_mutex_lock (&data->lock);
+  data->switch_measuring = TRUE;
+  data->switch_seqnum = seqnum;
+  data->switch_time = switch_time;
+  g_mutex_unlock (&data->lock);
+
+  maybe_start_playback (data);
+}
+
+/* Called on ASYNC_DONE, once the group seek prerolled */
+static void
+complete_switch (GlobalData * data)
+{
+  data->switch_pending = FALSE;
+
+  if (data->joining) {
+    GstClockTime now = gst_clock_get_time (data->net_clock);
+
+    data->joining = FALSE;
+
+    /* Prerolling took longer than we allowed for. Try again, giving
+     * it twice as long as it really needed */
+    if (now > data->pending_switch_time) {
+      g_print ("Catch-up seek took %" GST_TIME_FORMAT ", retrying\n",
+          GST_TIME_ARGS (now - data->join_seek_time));
+      if (join_late (data, 2 * (now - data->join_seek_time)))
+        return;
+    }
+  }
+
+  /* Stay paused at the new position, which starts at running time 0 */
+  if (data->group_paused) {
+    data->paused_running_time = 0;
+    return;
+  }
+
+  start_switch (data, data->pending_seqnum, data->pending_switch_time, 0);
+}
+
+static void
+group_seek (GlobalData * data, guint seqnum, GstClockTime position,
+    GstClockTime switch_time)
+{
+  g_print ("Group seek to %" GST_TIME_FORMAT "\n", GST_TIME_ARGS (position));
+
+  data->switch_pending = TRUE;
+  data->pending_seqnum = seqnum;
+  data->pending_switch_time = switch_time;
+
+  /* Preroll the new position in PAUSED, then switch at the given time */
+  gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+  if (!gst_element_seek_simple (data->playbin, GST_FORMAT_TIME,
+          GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, position)) {
+    g_printerr ("Group seek failed\n");
+    data->switch_pending = FALSE;
+    maybe_start_playback (data);
+  }
+}
+
+static gboolean
+do_group_pause (GlobalData * data)
+{
+  /* Resumed again before we got here */
+  if (!data->group_paused)
+    return G_SOURCE_REMOVE;
+
+  gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+  send_switch_report (data, data->pause_seqnum, data->pause_time,
+      gst_clock_get_time (data->net_clock));
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+pause_time_reached (GstClock * clock, GstClockTime time, GstClockID id,
+    GlobalData * data)
+{
+  /* We're on the clock thread here */
+  g_main_context_invoke (NULL, (GSourceFunc) do_group_pause, data);
+
+  return TRUE;
+}
+
+static void
+cancel_group_pause (GlobalData * data)
+{
+  if (data->pause_id) {
+    gst_clock_id_unschedule (data->pause_id);
+    gst_clock_id_unref (data->pause_id);
+    data->pause_id = NULL;
+  }
+}
+
+static void
+group_pause (GlobalData * data, guint seqnum, GstClockTime switch_time)
+{
+  GstClockTime stop;
+
+  if (data->group_paused)
+    return;
+
+  g_print ("Group pause\n");
+  data->group_paused = TRUE;
+
+  /* Where the pipeline will stand once paused */
+  stop = gst_element_get_base_time (data->playbin) + get_latency (data);
+  data->paused_running_time = switch_time > stop ? switch_time - stop : 0;
+
+  data->pause_seqnum = seqnum;
+  data->pause_time = switch_time;
+  cancel_group_pause (data);
+  data->pause_id = gst_clock_new_single_shot_id (data->net_clock, switch_time);
+  gst_clock_id_wait_async (data->pause_id,
+      (GstClockCallback) pause_time_reached, data, NULL);
+}
+
+static void
+group_resume (GlobalData * data, guint seqnum, GstClockTime switch_time)
+{
+  if (!data->group_paused)
+    return;
+
+  g_print ("Group resume\n");
+  data->group_paused = FALSE;
+  cancel_group_pause (data);
+
+  /* A seek made while paused is still prerolling. Have it switch at
+   * the resume time instead */
+  if (data->switch_pending) {
+    data->pending_seqnum = seqnum;
+    data->pending_switch_time = switch_time;
+    return;
+  }
+
+  start_switch (data, seqnum, switch_time, data->paused_running_time);
+}
+
+static void
+handle_control_msg (GroupControl * ctl, const GstStructure * msg,
+    GSocketAddress * from, GlobalData * data)
+{
+  guint seqnum = 0;
+  guint64 switch_time = GST_CLOCK_TIME_NONE;
+
+  data->in_group = TRUE;
+
+  gst_structure_get_uint (msg, "seqnum", &seqnum);
+  gst_structure_get_uint64 (msg, "switch-time", &switch_time);
+
+  if (gst_structure_has_name (msg, "group-seek")) {
+    guint64 position;
+
+    if (gst_structure_get_uint64 (msg, "position", &position) &&
+        GST_CLOCK_TIME_IS_VALID (switch_time))
+      group_seek (data, seqnum, position, switch_time);
+  } else if (gst_structure_has_name (msg, "group-pause")) {
+    if (GST_CLOCK_TIME_IS_VALID (switch_time))
+      group_pause (data, seqnum, switch_time);
+  } else if (gst_structure_has_name (msg, "group-resume")) {
+    if (GST_CLOCK_TIME_IS_VALID (switch_time))
+      group_resume (data, seqnum, switch_time);
+  } else if (gst_structure_has_name (msg, "group-latency")) {
+    guint64 latency;
+
+    /* Until we reported our own latency, the group value doesn't
+     * account for us yet */
+    if (latency_ms > 0 || !data->latency_measured)
+      return;
+
+    if (gst_structure_get_uint64 (msg, "latency", &latency) &&
+        GST_CLOCK_TIME_IS_VALID (latency))
+      apply_latency (data, latency);
+  }
+}
+
+/* playbin3 has no get-video-pad signal, so take the video sink's
+ * sink pad there */
+static GstPad *
+get_video_pad (GlobalData * data)
+{
+  GstElement *sink = NULL;
+  GstPad *pad = NULL;
+
+  if (!data->stream_selection) {
+    g_signal_emit_by_name (data->playbin, "get-video-pad", 0, &pad);
+    return pad;
+  }
+
+  g_object_get (data->playbin, "video-sink", &sink, NULL);
+  if (sink) {
+    pad = gst_element_get_static_pad (sink, "sink");
+    gst_object_unref (sink);
+  }
+
+  return pad;
+}
+
 static gboolean
 handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
 {
   /* Wait until error or EOS */
   switch (GST_MESSAGE_TYPE (msg)) {
     case GST_MESSAGE_EOS:{
+      if (data->rebuffer_count > 0)
+        g_print ("Playback had to re-buffer %u time(s)\n",
+            data->rebuffer_count);
       g_print ("Finished playback. Exiting.\n");
       g_main_loop_quit (data->loop);
       break;
@@ -239,18 +1828,27 @@ handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
       break;
     }
     case GST_MESSAGE_ASYNC_DONE:{
-      GstPad *video_pad;
+      GstPad *video_pad = NULL;
+      gboolean switching = data->switch_pending;
       GstCaps *caps;
       GstStructure *s;
 
       g_print ("Prerolled.\r");
 
-      g_signal_emit_by_name (data->playbin, "get-video-pad", 0, &video_pad);
-      if (video_pad) {
+      /* The first preroll tells us how much latency we need. That can
+       * start a late join seek, whose own preroll is the one to
+       * complete the switch on, not this one */
+      measure_latency (data);
+
+      if (switching)
+        complete_switch (data);
+
+      video_pad = get_video_pad (data);
+      caps = video_pad ? gst_pad_get_current_caps (video_pad) : NULL;
+      if (caps) {
         gint width, height;
         gint par_n, par_d;
 
-        caps = gst_pad_get_current_caps (video_pad);
         s = gst_caps_get_structure (caps, 0);
 
         gst_structure_get_int (s, "width", &width);
@@ -261,13 +1859,16 @@ handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
         width = width * par_n / par_d;
         g_print ("Video size: %dx%d\n", width, height);
         gst_caps_unref (caps);
-        gst_object_unref (video_pad);
       }
+      if (video_pad)
+        gst_object_unref (video_pad);
 
       break;
     }
     case GST_MESSAGE_BUFFERING:{
-      gint percent;
+      GstBufferingMode mode;
+      gint64 left;
+      gint percent, avg_in, avg_out;
 
       if (!data->buffering)
         g_print ("\n");
@@ -279,22 +1880,41 @@ handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
       if (data->is_live)
         break;
 
+      gst_message_parse_buffering_stats (msg, &mode, &avg_in, &avg_out, &left);
+      if (avg_in > 0)
+        data->download_rate = avg_in;
+
+      if (mode == GST_BUFFERING_DOWNLOAD && data->adaptive_buffering) {
+        handle_download_buffering (data, percent);
+        break;
+      }
+
       if (percent == 100) {
         /* a 100% message means buffering is done */
-        if (data->buffering) {
-          data->buffering = FALSE;
-          gst_element_set_state (data->playbin, GST_STATE_PLAYING);
-        }
+        if (data->buffering)
+          finish_rebuffering (data);
       } else {
         /* buffering... */
-        if (!data->buffering) {
-          gst_element_set_state (data->playbin, GST_STATE_PAUSED);
-          data->buffering = TRUE;
-        }
+        if (!data->buffering)
+          start_rebuffering (data);
       }
       break;
     }
     case GST_MESSAGE_CLOCK_LOST:{
+      g_mutex_lock (&data->lock);
+      data->glitch_measuring = TRUE;
+      data->glitch_on_time = 0;
+      data->clock_lost_time = gst_clock_get_time (data->net_clock);
+      data->clock_lost_base_time =
+          gst_element_get_base_time (data->playbin);
+      g_mutex_unlock (&data->lock);
+
+      if (!data->cycle_on_clock_lost) {
+        g_print ("Clock lost, re-applying the network clock\n");
+        reselect_clock (data);
+        break;
+      }
+
       /* Clock-lost means the pipeline wants to select a new clock,
        * which is done by pausing/playing */
       g_print ("Clock lost, selecting a new one\n");
@@ -340,21 +1960,106 @@ handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
         if (old == GST_STATE_PAUSED && new == GST_STATE_PLAYING) {
           g_print ("Reached playing. Base time is %" G_GUINT64_FORMAT "\n",
               gst_element_get_base_time (GST_ELEMENT (data->playbin)));
+
+          data->playing_time = gst_clock_get_time (data->net_clock);
+          if (data->switch_report_id)
+            g_source_remove (data->switch_report_id);
+          data->switch_report_id =
+              g_timeout_add_seconds (SWITCH_REPORT_TIMEOUT,
+              (GSourceFunc) switch_report_timeout, data);
         }
       }
       break;
     }
-    default:{
-      if (gst_is_missing_plugin_message (msg)) {
+    case GST_MESSAGE_STREAM_START:{
+      guint item;
+
+      g_mutex_lock (&data->lock);
+      item = data->queued_item;
+      g_mutex_unlock (&data->lock);
+
+      if (item != data->current_item) {
+        data->current_item = item;
+        g_print ("Now playing item %u of %u: %s\n", item + 1, data->n_items,
+            data->items[item]);
+        close_caches (data);
+      }
+      break;
+    }
+    case GST_MESSAGE_STREAM_COLLECTION:{
+      GstStreamCollection *collection = NULL;
+
+      gst_message_parse_stream_collection (msg, &collection);
+      if (collection == NULL)
+        break;
+      if (data->collection)
+        gst_object_unref (data->collection);
+      data->collection = collection;
+      break;
+    }
+    case GST_MESSAGE_STREAMS_SELECTED:{
+      guint i, n;
+
+      g_clear_pointer (&data->selected_video, g_free);
+      g_clear_pointer (&data->selected_audio, g_free);
+      g_clear_pointer (&data->selected_text, g_free);
+
+      n = gst_message_streams_selected_get_size (msg);
+      for (i = 0; i < n; i++) {
+        GstStream *stream = gst_message_streams_selected_get_stream (msg, i);
+        GstStreamType type = gst_stream_get_stream_type (stream);
+        gchar **id = NULL;
+
+        if (type & GST_STREAM_TYPE_VIDEO)
+          id = &data->selected_video;
+        else if (type & GST_STREAM_TYPE_AUDIO)
+          id = &data->selected_audio;
+        else if (type & GST_STREAM_TYPE_TEXT)
+          id = &data->selected_text;
+        if (id && *id == NULL)
+          *id = g_strdup (gst_stream_get_stream_id (stream));
+        gst_object_unref (stream);
+      }
+      break;
+    }
+    case GST_MESSAGE_ELEMENT:{
+      const GstStructure *s = gst_message_get_structure (msg);
+
+      if (gst_structure_has_name (s, "gst-netclock-statistics")) {
+        GstClockTime rtt;
+        gboolean first;
+
+        if (!gst_structure_get_clock_time (s, "rtt-average", &rtt) ||
+            !GST_CLOCK_TIME_IS_VALID (rtt))
+          break;
+
+        /* We only know the master time to within half a round trip */
+        first = !GST_CLOCK_TIME_IS_VALID (data->clock_uncertainty);
+        data->clock_uncertainty = rtt / 2;
+        if (first)
+          report_latency (data);
+
+        /* How far our local clock is from the master */
+        if (!gst_structure_get_int64 (s, "local-clock-offset",
+                &data->clock_offset)) {
+          GstClockTime local, remote;
+
+          if (gst_structure_get_clock_time (s, "local", &local) &&
+              gst_structure_get_clock_time (s, "remote", &remote))
+            data->clock_offset = GST_CLOCK_DIFF (local, remote);
+        }
+      } else if (gst_is_missing_plugin_message (msg)) {
         gchar *desc;
 
         desc = gst_missing_plugin_message_get_description (msg);
         g_print ("Missing plugin: %s\n", desc);
         g_free (desc);
       }
-      /* Ignore messages we don't know about */
       break;
     }
+    default:
+      /* Ignore messages we don't know about */
+      break;
   }
 
   return TRUE;
@@ -375,15 +2080,125 @@ seek (GlobalData * data, gboolean forward)
   else
     position = 0;
 
+  /* In a group, everyone has to seek together */
+  if (data->in_group) {
+    GstStructure *s;
+
+    s = gst_structure_new ("seek-request",
+        "position", G_TYPE_UINT64, (guint64) position, NULL);
+    group_control_send (data->ctl, NULL, s);
+    gst_structure_free (s);
+    return;
+  }
+
   gst_element_seek_simple (data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
       position);
 }
 
+static void
+toggle_pause (GlobalData * data)
+{
+  GstStructure *s;
+  GstClockTime now;
+
+  if (data->in_group) {
+    s = gst_structure_new_empty (data->group_paused ?
+        "resume-request" : "pause-request");
+    group_control_send (data->ctl, NULL, s);
+    gst_structure_free (s);
+    return;
+  }
+
+  /* On our own, switch right away, but still keep the base time
+   * consistent with the position */
+  now = gst_clock_get_time (data->net_clock);
+  if (data->group_paused)
+    group_resume (data, 0, now);
+  else
+    group_pause (data, 0, now);
+}
+
+/* Re-select the current streams, with the @type one moved on to the
+ * next of its kind, or dropped if @next is FALSE. decodebin3 keeps all
+ * streams parsed and queued and only decodes the selected ones, so
+ * this swaps the decoder input in place instead of flushing */
+static void
+select_streams (GlobalData * data, GstStreamType type, gboolean next)
+{
+  const gchar *current, *first = NULL, *new_id = NULL, *audio, *text;
+  gboolean found = FALSE;
+  GList *ids = NULL;
+  guint i, n;
+
+  if (data->collection == NULL) {
+    g_print ("No streams to choose from yet\n");
+    return;
+  }
+
+  current = type == GST_STREAM_TYPE_AUDIO ?
+      data->selected_audio : data->selected_text;
+
+  if (next) {
+    n = gst_stream_collection_get_size (data->collection);
+    for (i = 0; i < n && new_id == NULL; i++) {
+      GstStream *stream = gst_stream_collection_get_stream (data->collection,
+          i);
+      const gchar *id = gst_stream_get_stream_id (stream);
+
+      if (id == NULL || !(gst_stream_get_stream_type (stream) & type))
+        continue;
+      if (first == NULL)
+        first = id;
+      if (found)
+        new_id = id;
+      else if (g_strcmp0 (id, current) == 0)
+        found = TRUE;
+    }
+    /* Wrap around, or start with the first one */
+    if (new_id == NULL)
+      new_id = first;
+    if (new_id == NULL) {
+      g_print ("No %s streams\n", gst_stream_type_get_name (type));
+      return;
+    }
+  }
+
+  audio = type == GST_STREAM_TYPE_AUDIO ? new_id : data->selected_audio;
+  text = type == GST_STREAM_TYPE_TEXT ? new_id : data->selected_text;
+  if (data->selected_video)
+    ids = g_list_append (ids, data->selected_video);
+  if (audio)
+    ids = g_list_append (ids, (gchar *) audio);
+  if (text)
+    ids = g_list_append (ids, (gchar *) text);
+
+  if (new_id) {
+    g_mutex_lock (&data->lock);
+    if (type == GST_STREAM_TYPE_AUDIO)
+      data->audio_switch_time = gst_clock_get_time (data->net_clock);
+    else
+      data->text_switch_time = gst_clock_get_time (data->net_clock);
+    g_mutex_unlock (&data->lock);
+    g_print ("Selecting %s stream %s\n", gst_stream_type_get_name (type),
+        new_id);
+  } else {
+    g_print ("Disabling %s\n", gst_stream_type_get_name (type));
+  }
+
+  gst_element_send_event (data->playbin, gst_event_new_select_streams (ids));
+  g_list_free (ids);
+}
+
 static void
 next_audio (GlobalData * data)
 {
   gint current, count;
 
+  if (data->stream_selection) {
+    select_streams (data, GST_STREAM_TYPE_AUDIO, TRUE);
+    return;
+  }
+
   /* Switch to the next audio track */
   g_object_get (data->playbin,
       "current-audio", &current, "n-audio", &count, NULL);
@@ -391,6 +2206,10 @@ next_audio (GlobalData * data)
   if (current >= count)
     current = 0;
 
+  g_mutex_lock (&data->lock);
+  data->audio_switch_time = gst_clock_get_time (data->net_clock);
+  g_mutex_unlock (&data->lock);
+
   g_object_set (data->playbin, "current-audio", current, NULL);
   g_print ("Now playing audio track %d of %d\n", current, count);
 }
@@ -400,6 +2219,11 @@ toggle_subtitle (GlobalData * data)
 {
   gint flags;
 
+  if (data->stream_selection) {
+    select_streams (data, GST_STREAM_TYPE_TEXT, data->selected_text == NULL);
+    return;
+  }
+
   g_object_get (data->playbin, "flags", &flags, NULL);
   if (flags & PLAY_FLAGS_SUBTITLES) {
     g_print ("Disabling subtitles\n");
@@ -418,12 +2242,22 @@ next_subtitle (GlobalData * data)
   gint flags;
   gint current, count;
 
+  if (data->stream_selection) {
+    select_streams (data, GST_STREAM_TYPE_TEXT, TRUE);
+    return;
+  }
+
   /* Switch to the next subtitle track */
   g_object_get (data->playbin,
       "current-text", &current, "n-text", &count, NULL);
   current += 1;
   if (current >= count)
     current = 0;
+
+  g_mutex_lock (&data->lock);
+  data->text_switch_time = gst_clock_get_time (data->net_clock);
+  g_mutex_unlock (&data->lock);
+
   g_object_set (data->playbin, "current-text", current, NULL);
 
   /* Make sure subtitles are enabled */
@@ -468,6 +2302,9 @@ io_callback (GIOChannel * io, GIOCondition condition, GlobalData * data)
         case 'g':
           seek (data, TRUE);
           break;
+        case 'p':
+          toggle_pause (data);
+          break;
         case 'a':
           next_audio (data);
           break;
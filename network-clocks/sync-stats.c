@@ -0,0 +1,73 @@
+#include <string.h>
+
+#include "sync-stats.h"
+
+static const GstClockTimeDiff bucket_limits[SYNC_STATS_N_BUCKETS - 1] = {
+  -20 * GST_MSECOND, -5 * GST_MSECOND, -1 * GST_MSECOND, -100 * GST_USECOND,
+  100 * GST_USECOND, 1 * GST_MSECOND, 5 * GST_MSECOND, 20 * GST_MSECOND
+};
+
+static const gchar *bucket_names[SYNC_STATS_N_BUCKETS] = {
+  "<-20ms", "-20..-5ms", "-5..-1ms", "-1..-0.1ms", "+-0.1ms",
+  "0.1..1ms", "1..5ms", "5..20ms", ">20ms"
+};
+
+void
+sync_stats_reset (SyncStats * stats)
+{
+  memset (stats, 0, sizeof (SyncStats));
+}
+
+void
+sync_stats_add (SyncStats * stats, GstClockTimeDiff error)
+{
+  guint i;
+
+  if (stats->count == 0 || error < stats->min)
+    stats->min = error;
+  if (stats->count == 0 || error > stats->max)
+    stats->max = error;
+  stats->sum += error;
+  stats->count++;
+
+  for (i = 0; i < SYNC_STATS_N_BUCKETS - 1; i++) {
+    if (error < bucket_limits[i])
+      break;
+  }
+  stats->buckets[i]++;
+}
+
+GstClockTimeDiff
+sync_stats_mean (const SyncStats * stats)
+{
+  if (stats->count == 0)
+    return 0;
+
+  return stats->sum / (GstClockTimeDiff) stats->count;
+}
+
+/* eg. "n=250 mean=+312us min=-80us max=+1890us | +-0.1ms:201 0.1..1ms:49" */
+gchar *
+sync_stats_to_string (const SyncStats * stats)
+{
+  GString *str;
+  guint i;
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, "n=%" G_GUINT64_FORMAT, stats->count);
+  if (stats->count == 0)
+    return g_string_free (str, FALSE);
+
+  g_string_append_printf (str, " mean=%+" G_GINT64_FORMAT "us min=%+"
+      G_GINT64_FORMAT "us max=%+" G_GINT64_FORMAT "us |",
+      sync_stats_mean (stats) / GST_USECOND, stats->min / GST_USECOND,
+      stats->max / GST_USECOND);
+
+  for (i = 0; i < SYNC_STATS_N_BUCKETS; i++) {
+    if (stats->buckets[i] > 0)
+      g_string_append_printf (str, " %s:%" G_GUINT64_FORMAT, bucket_names[i],
+          stats->buckets[i]);
+  }
+
+  return g_string_free (str, FALSE);
+}
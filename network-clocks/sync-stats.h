@@ -0,0 +1,28 @@
+#ifndef __SYNC_STATS_H__
+#define __SYNC_STATS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Histogram of sync errors, ie. how late (positive) or early
+ * (negative) something was rendered compared to when it should have
+ * been, on bucket boundaries of 0.1, 1, 5 and 20ms either way */
+#define SYNC_STATS_N_BUCKETS 9
+
+typedef struct
+{
+  guint64 count;
+  GstClockTimeDiff min;
+  GstClockTimeDiff max;
+  GstClockTimeDiff sum;
+  guint64 buckets[SYNC_STATS_N_BUCKETS];
+} SyncStats;
+
+void sync_stats_reset (SyncStats * stats);
+void sync_stats_add (SyncStats * stats, GstClockTimeDiff error);
+GstClockTimeDiff sync_stats_mean (const SyncStats * stats);
+gchar *sync_stats_to_string (const SyncStats * stats);
+
+G_END_DECLS
+#endif /* __SYNC_STATS_H__ */
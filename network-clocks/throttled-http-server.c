@@ -0,0 +1,222 @@
+/* A minimal HTTP server that serves the files in a directory at a
+ * capped rate, to try out the playback-sync buffering on a slow link
+ * without leaving the machine. It only knows HEAD, GET and a single
+ * byte range, which is all souphttpsrc needs.
+ *
+ *   ./throttled-http-server -r 300 -d ..
+ *   ./playback-sync -c 127.0.0.1 -p PORT http://127.0.0.1:8080/cooldance.ogg
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <gio/gio.h>
+
+#define DEFAULT_PORT 8080
+#define DEFAULT_RATE 500
+/* Data goes out in slices of this many ms worth of the rate */
+#define SLICE_MS 20
+
+static gint port = DEFAULT_PORT;
+static gint rate = DEFAULT_RATE;
+static gchar *root = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"port", 'p', 0, G_OPTION_ARG_INT, &port,
+      "Port to listen on (default: 8080)", "PORT"},
+  {"rate", 'r', 0, G_OPTION_ARG_INT, &rate,
+      "Maximum rate per connection in kB/s (default: 500)", "KBPS"},
+  {"dir", 'd', 0, G_OPTION_ARG_FILENAME, &root,
+      "Directory to serve (default: current directory)", "DIR"},
+  {NULL}
+};
+
+static void
+send_status (GOutputStream * out, const gchar * status)
+{
+  gchar *reply;
+
+  reply = g_strdup_printf ("HTTP/1.1 %s\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n", status);
+  g_output_stream_write_all (out, reply, strlen (reply), NULL, NULL, NULL);
+  g_free (reply);
+}
+
+/* Send @length bytes of @in, never faster than the configured rate */
+static void
+send_throttled (GInputStream * in, GOutputStream * out, guint64 length)
+{
+  gsize slice = MAX (1, rate * 1000 / (1000 / SLICE_MS));
+  gchar *buf = g_malloc (slice);
+  gint64 start = g_get_monotonic_time ();
+  guint64 sent = 0;
+
+  while (sent < length) {
+    gssize n;
+    gint64 due;
+
+    n = g_input_stream_read (in, buf, MIN (slice, length - sent), NULL, NULL);
+    if (n <= 0)
+      break;
+    if (!g_output_stream_write_all (out, buf, n, NULL, NULL, NULL))
+      break;
+    sent += n;
+
+    /* Sleep until the rate allows for what we sent so far */
+    due = start + (gint64) (sent * 1000 / rate);
+    if (due > g_get_monotonic_time ())
+      g_usleep (due - g_get_monotonic_time ());
+  }
+
+  g_free (buf);
+}
+
+static gboolean
+handle_connection (GThreadedSocketService * service,
+    GSocketConnection * connection, GObject * source_object,
+    gpointer user_data)
+{
+  GOutputStream *out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  GDataInputStream *in;
+  GFileInputStream *file_in = NULL;
+  GFileInfo *info = NULL;
+  GFile *file = NULL;
+  gchar *line, *path = NULL, *filename = NULL, *reply;
+  gchar **request = NULL;
+  guint64 size, range_start = 0, range_end = G_MAXUINT64;
+  gboolean ranged = FALSE;
+
+  in = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM
+          (connection)));
+
+  /* Request line, eg. "GET /file.webm HTTP/1.1" */
+  line = g_data_input_stream_read_line (in, NULL, NULL, NULL);
+  if (line == NULL)
+    goto done;
+  request = g_strsplit (g_strchomp (line), " ", 3);
+  g_free (line);
+
+  /* Headers, we only care about Range */
+  while ((line = g_data_input_stream_read_line (in, NULL, NULL, NULL))) {
+    g_strchomp (line);
+    if (*line == '\0') {
+      g_free (line);
+      break;
+    }
+    if (g_ascii_strncasecmp (line, "Range:", 6) == 0) {
+      gint n = sscanf (line + 6, " bytes=%" G_GUINT64_FORMAT "-%"
+          G_GUINT64_FORMAT, &range_start, &range_end);
+      ranged = (n >= 1);
+    }
+    g_free (line);
+  }
+
+  if (g_strv_length (request) < 2 || (!g_str_equal (request[0], "GET")
+          && !g_str_equal (request[0], "HEAD"))) {
+    send_status (out, "400 Bad Request");
+    goto done;
+  }
+
+  path = g_uri_unescape_string (request[1], NULL);
+  if (path == NULL || strstr (path, "..") != NULL) {
+    send_status (out, "403 Forbidden");
+    goto done;
+  }
+  if (strchr (path, '?'))
+    *strchr (path, '?') = '\0';
+
+  filename = g_build_filename (root, path, NULL);
+  file = g_file_new_for_path (filename);
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  file_in = g_file_read (file, NULL, NULL);
+  if (info == NULL || file_in == NULL) {
+    send_status (out, "404 Not Found");
+    goto done;
+  }
+
+  size = g_file_info_get_size (info);
+  if (size == 0) {
+    send_status (out, "204 No Content");
+    goto done;
+  }
+  if (range_end >= size)
+    range_end = size - 1;
+  if (ranged && range_start >= size) {
+    send_status (out, "416 Range Not Satisfiable");
+    goto done;
+  }
+
+  if (ranged) {
+    reply = g_strdup_printf ("HTTP/1.1 206 Partial Content\r\n"
+        "Content-Range: bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT
+        "/%" G_GUINT64_FORMAT "\r\n", range_start, range_end, size);
+  } else {
+    reply = g_strdup ("HTTP/1.1 200 OK\r\n");
+  }
+  line = g_strdup_printf ("%sContent-Type: application/octet-stream\r\n"
+      "Content-Length: %" G_GUINT64_FORMAT "\r\nAccept-Ranges: bytes\r\n"
+      "Connection: close\r\n\r\n", reply, range_end - range_start + 1);
+  g_free (reply);
+  g_output_stream_write_all (out, line, strlen (line), NULL, NULL, NULL);
+  g_free (line);
+
+  g_print ("%s %s bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "\n",
+      request[0], path, range_start, range_end);
+
+  if (g_str_equal (request[0], "GET") &&
+      g_seekable_seek (G_SEEKABLE (file_in), range_start, G_SEEK_SET, NULL,
+          NULL))
+    send_throttled (G_INPUT_STREAM (file_in), out,
+        range_end - range_start + 1);
+
+done:
+  g_clear_object (&file_in);
+  g_clear_object (&info);
+  g_clear_object (&file);
+  g_free (filename);
+  g_free (path);
+  g_strfreev (request);
+  g_object_unref (in);
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GSocketService *service;
+  GMainLoop *loop;
+  GError *err = NULL;
+
+  opt_ctx = g_option_context_new ("- Rate limited HTTP file server");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (rate <= 0)
+    g_error ("The rate must be positive");
+  if (root == NULL)
+    root = g_get_current_dir ();
+
+  service = g_threaded_socket_service_new (16);
+  if (!g_socket_listener_add_inet_port (G_SOCKET_LISTENER (service), port,
+          NULL, &err))
+    g_error ("Failed to listen on port %d: %s", port, err->message);
+
+  g_signal_connect (service, "run", G_CALLBACK (handle_connection), NULL);
+  g_socket_service_start (service);
+
+  g_print ("Serving %s on port %d at %d kB/s\n", root, port, rate);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (loop);
+
+  g_object_unref (service);
+  g_main_loop_unref (loop);
+  g_free (root);
+
+  return 0;
+}
@@ -0,0 +1,643 @@
+/* Transcode a file on all cores at once: split the input at video
+ * keyframes, encode each segment with its own pipeline, then join the
+ * encoded segments into one MP4 or WebM file without encoding again.
+ * The audio is encoded in one go, next to the video segments.
+ *
+ *   ./parallel-transcode --compare big-buck-bunny_trailer.webm out.mp4
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+static gint jobs = 0;
+static gint n_segments = 0;
+static gchar *video_encoder = NULL;
+static gchar *audio_encoder = NULL;
+static gboolean compare = FALSE;
+static gboolean keep_files = FALSE;
+
+static GOptionEntry opt_entries[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of pipelines to run at once (default: number of CPUs)", "N"},
+  {"segments", 'n', 0, G_OPTION_ARG_INT, &n_segments,
+      "Number of segments to aim for (default: 2 per job)", "N"},
+  {"video-encoder", 'V', 0, G_OPTION_ARG_STRING, &video_encoder,
+      "Video encoder (default: x264enc for MP4, vp8enc for WebM)", "DESC"},
+  {"audio-encoder", 'A', 0, G_OPTION_ARG_STRING, &audio_encoder,
+      "Audio encoder (default: avenc_aac for MP4, vorbisenc for WebM)",
+      "DESC"},
+  {"compare", 'c', 0, G_OPTION_ARG_NONE, &compare,
+      "Also transcode with a single pipeline, and report the speedup", NULL},
+  {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep_files,
+      "Keep the intermediate files", NULL},
+  {NULL}
+};
+
+/* One pipeline's worth of work: decode [start, stop) of the input and
+ * encode it into a file */
+typedef struct
+{
+  const gchar *uri;
+  GstClockTime start;
+  GstClockTime stop;
+  const gchar *video_encoder;
+  const gchar *audio_encoder;
+  const gchar *mux;
+  gchar *location;
+
+  GstElement *pipeline;
+  /* Where the first decoded video and audio pads go */
+  GstElement *video_branch;
+  GstElement *audio_branch;
+  /* Where to send the seek to the start of the segment */
+  GstPad *seek_pad;
+
+  gboolean ok;
+  gdouble seconds;
+} Job;
+
+typedef struct
+{
+  GstElement *pipeline;
+  GArray *keyframes;
+  gboolean have_video;
+} KeyframeScan;
+
+static GstElement *
+create_element (const gchar * type, const gchar * name)
+{
+  GstElement *e;
+
+  e = gst_element_factory_make (type, name);
+  if (!e) {
+    g_print ("Failed to create element %s\n", type);
+    exit (1);
+  }
+
+  return e;
+}
+
+static gchar *
+canonicalise_uri (const gchar * in)
+{
+  if (gst_uri_is_valid (in))
+    return g_strdup (in);
+
+  return gst_filename_to_uri (in, NULL);
+}
+
+static gdouble
+seconds_since (gint64 start)
+{
+  return (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+}
+
+/* Run @pipeline until EOS or error. With a @seek_pad, seek upstream
+ * from there to only get [start, stop) of the input. That goes around
+ * the muxer, which doesn't take seeks */
+static gboolean
+run_pipeline (GstElement * pipeline, GstPad * seek_pad, GstClockTime start,
+    GstClockTime stop)
+{
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean ret = FALSE;
+
+  /* Preroll first, so the seek reaches the source */
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) ==
+      GST_STATE_CHANGE_FAILURE)
+    goto done;
+
+  if (seek_pad && !gst_pad_push_event (seek_pad, gst_event_new_seek (1.0,
+              GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+              GST_SEEK_TYPE_SET, start, GST_CLOCK_TIME_IS_VALID (stop) ?
+              GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE, stop))) {
+    g_printerr ("Seek to %" GST_TIME_FORMAT " failed\n", GST_TIME_ARGS (start));
+    goto done;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gst_object_unref (bus);
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    GError *err = NULL;
+    gchar *dbg_info = NULL;
+
+    gst_message_parse_error (msg, &err, &dbg_info);
+    g_printerr ("ERROR from element %s: %s\n",
+        GST_OBJECT_NAME (msg->src), err->message);
+    g_printerr ("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+    g_error_free (err);
+    g_free (dbg_info);
+  } else {
+    ret = TRUE;
+  }
+  gst_message_unref (msg);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  return ret;
+}
+
+static void
+link_to_fakesink (GstElement * pipeline, GstPad * pad)
+{
+  GstElement *sink;
+  GstPad *sinkpad;
+
+  sink = create_element ("fakesink", NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+  gst_element_sync_state_with_parent (sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+}
+
+static GstPadProbeReturn
+keyframe_probe (GstPad * pad, GstPadProbeInfo * info, KeyframeScan * scan)
+{
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts = GST_BUFFER_PTS (buf);
+
+  if (GST_CLOCK_TIME_IS_VALID (pts) &&
+      !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    g_array_append_val (scan->keyframes, pts);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+parsed_pad_added (GstElement * parsebin, GstPad * pad, KeyframeScan * scan)
+{
+  GstCaps *caps;
+
+  caps = gst_pad_query_caps (pad, NULL);
+  if (!scan->have_video && g_str_has_prefix (gst_structure_get_name
+          (gst_caps_get_structure (caps, 0)), "video/")) {
+    scan->have_video = TRUE;
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) keyframe_probe, scan, NULL);
+  }
+  gst_caps_unref (caps);
+
+  link_to_fakesink (scan->pipeline, pad);
+}
+
+static void
+source_pad_added (GstElement * src, GstPad * pad, GstElement * parsebin)
+{
+  GstPad *sinkpad = gst_element_get_static_pad (parsebin, "sink");
+
+  if (!gst_pad_is_linked (sinkpad))
+    gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+}
+
+/* Find where the video keyframes are, by only parsing the input */
+static GArray *
+find_keyframes (const gchar * uri)
+{
+  KeyframeScan scan = { 0, };
+  GstElement *src, *parsebin;
+
+  scan.keyframes = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  scan.pipeline = gst_pipeline_new (NULL);
+  src = create_element ("urisourcebin", NULL);
+  parsebin = create_element ("parsebin", NULL);
+  g_object_set (src, "uri", uri, NULL);
+  gst_bin_add_many (GST_BIN (scan.pipeline), src, parsebin, NULL);
+
+  g_signal_connect (src, "pad-added", G_CALLBACK (source_pad_added), parsebin);
+  g_signal_connect (parsebin, "pad-added", G_CALLBACK (parsed_pad_added),
+      &scan);
+
+  if (!run_pipeline (scan.pipeline, NULL, 0, GST_CLOCK_TIME_NONE))
+    g_array_set_size (scan.keyframes, 0);
+  gst_object_unref (scan.pipeline);
+
+  return scan.keyframes;
+}
+
+static void
+decoded_pad_added (GstElement * decodebin, GstPad * pad, Job * job)
+{
+  GstElement **branch = NULL;
+  const gchar *name;
+  GstCaps *caps;
+  GstPad *sinkpad;
+
+  caps = gst_pad_query_caps (pad, NULL);
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (name, "video/"))
+    branch = &job->video_branch;
+  else if (g_str_has_prefix (name, "audio/"))
+    branch = &job->audio_branch;
+  gst_caps_unref (caps);
+
+  /* Only the first stream of each kind is encoded */
+  if (branch == NULL || *branch == NULL) {
+    link_to_fakesink (job->pipeline, pad);
+    return;
+  }
+
+  sinkpad = gst_element_get_static_pad (*branch, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  *branch = NULL;
+}
+
+static GstElement *
+add_branch (Job * job, const gchar * convert, const gchar * encoder,
+    GstElement * mux, GError ** err)
+{
+  GstElement *branch;
+  gchar *desc;
+
+  desc = g_strdup_printf ("queue ! %s ! %s", convert, encoder);
+  branch = gst_parse_bin_from_description (desc, TRUE, err);
+  g_free (desc);
+  if (branch == NULL)
+    return NULL;
+
+  gst_bin_add (GST_BIN (job->pipeline), branch);
+  if (!gst_element_link (branch, mux)) {
+    g_set_error (err, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+        "Can't mux the output of %s into %s", encoder, job->mux);
+    return NULL;
+  }
+
+  return branch;
+}
+
+/* What gets encoded while prerolling is from before the segment start,
+ * keep it away from the muxer until the seek has flushed it out */
+static GstPadProbeReturn
+drop_until_flush (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & (GST_PAD_PROBE_TYPE_BUFFER |
+          GST_PAD_PROBE_TYPE_BUFFER_LIST))
+    return GST_PAD_PROBE_DROP;
+
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_FLUSH_STOP)
+    return GST_PAD_PROBE_REMOVE;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Runs on a pool thread, every job has its own pipeline */
+static void
+run_job (Job * job, gpointer user_data)
+{
+  gint64 begin = g_get_monotonic_time ();
+  GstElement *src, *mux, *sink;
+  GError *err = NULL;
+  GstCaps *caps;
+
+  job->pipeline = gst_pipeline_new (NULL);
+  src = create_element ("uridecodebin", NULL);
+  mux = create_element (job->mux, NULL);
+  sink = create_element ("filesink", NULL);
+  /* Only decode the streams this job encodes, the video segments
+   * shouldn't decode the audio nor the audio job the video */
+  caps = gst_caps_new_empty ();
+  if (job->video_encoder)
+    gst_caps_append (caps, gst_caps_new_empty_simple ("video/x-raw"));
+  if (job->audio_encoder)
+    gst_caps_append (caps, gst_caps_new_empty_simple ("audio/x-raw"));
+  g_object_set (src, "uri", job->uri, "caps", caps,
+      "expose-all-streams", FALSE, NULL);
+  gst_caps_unref (caps);
+  /* Nothing reaches the file before the seek, so don't wait for it
+   * to preroll */
+  g_object_set (sink, "location", job->location, "async", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (job->pipeline), src, mux, sink, NULL);
+  gst_element_link (mux, sink);
+
+  if (job->video_encoder)
+    job->video_branch = add_branch (job, "videoconvert", job->video_encoder,
+        mux, &err);
+  if (job->audio_encoder && err == NULL)
+    job->audio_branch = add_branch (job, "audioconvert ! audioresample",
+        job->audio_encoder, mux, &err);
+  if (err) {
+    g_printerr ("Can't build the pipeline for %s: %s\n", job->location,
+        err->message);
+    g_clear_error (&err);
+    goto done;
+  }
+
+  /* Segments are video only, and seek to their start */
+  if (job->video_branch && (job->start > 0 ||
+          GST_CLOCK_TIME_IS_VALID (job->stop))) {
+    GstPad *srcpad = gst_element_get_static_pad (job->video_branch, "src");
+
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM |
+        GST_PAD_PROBE_TYPE_EVENT_FLUSH, drop_until_flush, NULL, NULL);
+    gst_object_unref (srcpad);
+    job->seek_pad = gst_element_get_static_pad (job->video_branch, "sink");
+  }
+
+  g_signal_connect (src, "pad-added", G_CALLBACK (decoded_pad_added), job);
+  job->ok = run_pipeline (job->pipeline, job->seek_pad, job->start,
+      job->stop);
+
+done:
+  g_clear_object (&job->seek_pad);
+  gst_object_unref (job->pipeline);
+  job->pipeline = NULL;
+  job->seconds = seconds_since (begin);
+}
+
+static void
+link_to_target (GstElement * parsebin, GstPad * pad, GstPad * target)
+{
+  if (gst_pad_is_linked (target) || gst_pad_link (pad, target) !=
+      GST_PAD_LINK_OK)
+    link_to_fakesink (GST_ELEMENT (GST_OBJECT_PARENT (parsebin)), pad);
+}
+
+/* Read @location and hand its single stream to @target */
+static void
+add_encoded_file (GstElement * pipeline, const gchar * location,
+    GstPad * target)
+{
+  GstElement *src, *parsebin;
+
+  src = create_element ("filesrc", NULL);
+  parsebin = create_element ("parsebin", NULL);
+  g_object_set (src, "location", location, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), src, parsebin, NULL);
+  gst_element_link (src, parsebin);
+
+  g_signal_connect (parsebin, "pad-added", G_CALLBACK (link_to_target),
+      target);
+}
+
+/* Play the encoded segments one after the other through concat, which
+ * makes their timestamps follow on, and mux them with the audio */
+static gboolean
+join_segments (Job * segments, guint n, Job * audio, const gchar * mux_name,
+    const gchar * output)
+{
+  GstElement *pipeline, *concat, *mux, *sink;
+  GstPad *srcpad, *muxpad;
+  gboolean ret;
+  guint i;
+
+  pipeline = gst_pipeline_new (NULL);
+  concat = create_element ("concat", NULL);
+  mux = create_element (mux_name, NULL);
+  sink = create_element ("filesink", NULL);
+  g_object_set (sink, "location", output, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), concat, mux, sink, NULL);
+  gst_element_link (mux, sink);
+
+  /* concat plays its sink pads in the order they were requested */
+  for (i = 0; i < n; i++) {
+    GstPad *concatpad = gst_element_get_request_pad (concat, "sink_%u");
+
+    add_encoded_file (pipeline, segments[i].location, concatpad);
+    gst_object_unref (concatpad);
+  }
+
+  srcpad = gst_element_get_static_pad (concat, "src");
+  muxpad = gst_element_get_request_pad (mux, "video_%u");
+  gst_pad_link (srcpad, muxpad);
+  gst_object_unref (muxpad);
+  gst_object_unref (srcpad);
+
+  if (audio) {
+    muxpad = gst_element_get_request_pad (mux, "audio_%u");
+    add_encoded_file (pipeline, audio->location, muxpad);
+    gst_object_unref (muxpad);
+  }
+
+  ret = run_pipeline (pipeline, NULL, 0, GST_CLOCK_TIME_NONE);
+  gst_object_unref (pipeline);
+
+  return ret;
+}
+
+/* Pick segment starts near equal shares of the duration, each on a
+ * keyframe so every segment decodes on its own */
+static GArray *
+choose_segments (GArray * keyframes, GstClockTime duration, guint n)
+{
+  GArray *starts = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  GstClockTime start = 0;
+  guint i, k = 0;
+
+  g_array_append_val (starts, start);
+
+  for (i = 1; i < n; i++) {
+    GstClockTime target = gst_util_uint64_scale (duration, i, n);
+
+    while (k < keyframes->len &&
+        (g_array_index (keyframes, GstClockTime, k) < target ||
+            g_array_index (keyframes, GstClockTime, k) <= start))
+      k++;
+    if (k == keyframes->len)
+      break;
+
+    start = g_array_index (keyframes, GstClockTime, k);
+    if (start >= duration)
+      break;
+    g_array_append_val (starts, start);
+  }
+
+  return starts;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GstDiscoverer *discoverer;
+  GstDiscovererInfo *info;
+  GList *streams;
+  GError *err = NULL;
+  GThreadPool *pool;
+  GArray *keyframes, *starts;
+  Job *segments, audio = { 0, };
+  gchar *uri, *tmpdir;
+  const gchar *output, *mux;
+  GstClockTime duration;
+  gboolean has_audio, ok = TRUE, webm;
+  gdouble parallel_seconds, scan_seconds;
+  gint64 begin;
+  guint i, n;
+
+  opt_ctx = g_option_context_new ("<input> <output.mp4|output.webm> - "
+      "Transcode in parallel segments");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (argc < 3) {
+    g_print ("Usage: %s [-j jobs] [--compare] <input> <output.mp4|.webm>\n",
+        argv[0]);
+    return 1;
+  }
+
+  uri = canonicalise_uri (argv[1]);
+  output = argv[2];
+
+  webm = g_str_has_suffix (output, ".webm");
+  mux = webm ? "webmmux" : "mp4mux";
+  if (video_encoder == NULL)
+    video_encoder = g_strdup (webm ? "vp8enc deadline=1" : "x264enc");
+  if (audio_encoder == NULL)
+    audio_encoder = g_strdup (webm ? "vorbisenc" : "avenc_aac");
+  if (jobs <= 0)
+    jobs = g_get_num_processors ();
+  if (n_segments <= 0)
+    n_segments = 2 * jobs;
+
+  discoverer = gst_discoverer_new (30 * GST_SECOND, &err);
+  if (discoverer == NULL)
+    g_error ("Can't create a discoverer: %s", err->message);
+  info = gst_discoverer_discover_uri (discoverer, uri, &err);
+  if (info == NULL)
+    g_error ("Can't read %s: %s", uri, err->message);
+  duration = gst_discoverer_info_get_duration (info);
+  streams = gst_discoverer_info_get_audio_streams (info);
+  has_audio = streams != NULL;
+  gst_discoverer_stream_info_list_free (streams);
+  gst_discoverer_info_unref (info);
+  g_object_unref (discoverer);
+
+  if (!GST_CLOCK_TIME_IS_VALID (duration))
+    g_error ("Can't tell how long %s is", uri);
+
+  tmpdir = g_dir_make_tmp ("parallel-transcode-XXXXXX", &err);
+  if (tmpdir == NULL)
+    g_error ("Can't make a temporary directory: %s", err->message);
+
+  begin = g_get_monotonic_time ();
+
+  keyframes = find_keyframes (uri);
+  if (keyframes->len == 0)
+    g_error ("Found no video keyframes in %s", uri);
+  starts = choose_segments (keyframes, duration, n_segments);
+  scan_seconds = seconds_since (begin);
+  g_print ("Found %u keyframes in %.2fs, encoding %u segments with %d jobs\n",
+      keyframes->len, scan_seconds, starts->len, jobs);
+
+  n = starts->len;
+  segments = g_new0 (Job, n);
+  pool = g_thread_pool_new ((GFunc) run_job, NULL, jobs, FALSE, NULL);
+
+  /* The audio is one long job, start it first so it overlaps the most */
+  if (has_audio) {
+    audio.uri = uri;
+    audio.stop = GST_CLOCK_TIME_NONE;
+    audio.audio_encoder = audio_encoder;
+    audio.mux = "matroskamux";
+    audio.location = g_build_filename (tmpdir, "audio.mkv", NULL);
+    g_thread_pool_push (pool, &audio, NULL);
+  }
+
+  for (i = 0; i < n; i++) {
+    Job *job = &segments[i];
+    gchar *name = g_strdup_printf ("segment-%03u.mkv", i);
+
+    job->uri = uri;
+    job->start = g_array_index (starts, GstClockTime, i);
+    job->stop = i + 1 < n ? g_array_index (starts, GstClockTime, i + 1) :
+        GST_CLOCK_TIME_NONE;
+    job->video_encoder = video_encoder;
+    job->mux = "matroskamux";
+    job->location = g_build_filename (tmpdir, name, NULL);
+    g_free (name);
+    g_thread_pool_push (pool, job, NULL);
+  }
+
+  /* Wait for all of them */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < n; i++) {
+    g_print ("Segment %u: %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT
+        " encoded in %.2fs%s\n", i, GST_TIME_ARGS (segments[i].start),
+        GST_TIME_ARGS (i + 1 < n ? segments[i].stop : duration),
+        segments[i].seconds, segments[i].ok ? "" : " FAILED");
+    ok &= segments[i].ok;
+  }
+  if (has_audio) {
+    g_print ("Audio encoded in %.2fs%s\n", audio.seconds,
+        audio.ok ? "" : " FAILED");
+    ok &= audio.ok;
+  }
+
+  if (ok) {
+    gint64 join_begin = g_get_monotonic_time ();
+
+    ok = join_segments (segments, n, has_audio ? &audio : NULL, mux, output);
+    g_print ("Joined into %s in %.2fs\n", output, seconds_since (join_begin));
+  }
+
+  parallel_seconds = seconds_since (begin);
+  g_print ("Parallel transcode %s in %.2fs with %d jobs\n",
+      ok ? "finished" : "failed", parallel_seconds, jobs);
+
+  if (compare && ok) {
+    Job single = { 0, };
+    gchar *name = g_strdup_printf ("single.%s", webm ? "webm" : "mp4");
+
+    single.uri = uri;
+    single.stop = GST_CLOCK_TIME_NONE;
+    single.video_encoder = video_encoder;
+    single.audio_encoder = has_audio ? audio_encoder : NULL;
+    single.mux = mux;
+    single.location = g_build_filename (tmpdir, name, NULL);
+    g_free (name);
+
+    run_job (&single, NULL);
+    if (single.ok)
+      g_print ("Single pipeline took %.2fs, speedup %.2fx\n", single.seconds,
+          single.seconds / parallel_seconds);
+    else
+      g_print ("Single pipeline transcode failed\n");
+
+    if (!keep_files)
+      g_unlink (single.location);
+    g_free (single.location);
+  }
+
+  /* Clean up */
+  for (i = 0; i < n; i++) {
+    if (!keep_files)
+      g_unlink (segments[i].location);
+    g_free (segments[i].location);
+  }
+  if (audio.location) {
+    if (!keep_files)
+      g_unlink (audio.location);
+    g_free (audio.location);
+  }
+  if (keep_files)
+    g_print ("Intermediate files are in %s\n", tmpdir);
+  else
+    g_rmdir (tmpdir);
+
+  g_free (tmpdir);
+  g_free (segments);
+  g_array_unref (starts);
+  g_array_unref (keyframes);
+  g_free (video_encoder);
+  g_free (audio_encoder);
+  g_free (uri);
+
+  return ok ? 0 : 1;
+}
@@ -4,14 +4,130 @@
 #include <stdio.h>
 
 #include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "audio-quality.h"
+#include "frame-allocator.h"
+#include "frame-pool.h"
+#include "mem-report.h"
+
+/* How often the demuxer queue limits are looked at, and how long an
+ * interleave peak is remembered for */
+#define QUEUE_CHECK_INTERVAL 200
+#define QUEUE_WINDOW (5 * G_USEC_PER_SEC)
+/* Never go below this, and keep some headroom above the interleave */
+#define MIN_QUEUE_TIME (100 * GST_MSECOND)
+#define QUEUE_MARGIN (50 * GST_MSECOND)
+/* The least max-size-buffers we leave, see resize_queues() */
+#define MIN_QUEUE_BUFFERS 5
+/* Frames the appsink consumer lets queue up */
+#define APPSINK_MAX_BUFFERS 2
+
+static gboolean auto_queues = FALSE;
+static gboolean queue_stats = FALSE;
+static gchar *video_filter = NULL;
+static gchar *audio_filter = NULL;
+static gchar *effect = NULL;
+static gint memory_report = 0;
+static gint max_queue_bytes = 0;
+static gint max_pool_buffers = 0;
+static gint64 max_download_bytes = 0;
+static gboolean alloc_stats = FALSE;
+static gboolean use_appsink = FALSE;
+static gint pool_size = 8;
+static gchar *frame_allocator = NULL;
+static gchar *audio_quality = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"auto-queues", 'a', 0, G_OPTION_ARG_NONE, &auto_queues,
+      "Size the demuxer queues to the audio/video interleave", NULL},
+  {"queue-stats", 'Q', 0, G_OPTION_ARG_NONE, &queue_stats,
+      "Report the peak amount of data in the demuxer queues", NULL},
+  {"video-filter", 0, 0, G_OPTION_ARG_STRING, &video_filter,
+      "Pass the video through these elements before the sink", "DESC"},
+  {"audio-filter", 0, 0, G_OPTION_ARG_STRING, &audio_filter,
+      "Pass the audio through these elements before the sink", "DESC"},
+  {"effect", 'e', 0, G_OPTION_ARG_STRING, &effect,
+      "Video effect from the convolve element in plugin/: sobel, blur, "
+        "sharpen, emboss or edge", "NAME"},
+  {"memory-report", 'm', 0, G_OPTION_ARG_INT, &memory_report,
+      "Report memory use every N seconds, and the peaks at the end", "N"},
+  {"max-queue-bytes", 0, 0, G_OPTION_ARG_INT, &max_queue_bytes,
+      "Cap every queue at this many bytes. Below the audio/video "
+        "interleave, playback stalls", "BYTES"},
+  {"max-pool-buffers", 0, 0, G_OPTION_ARG_INT, &max_pool_buffers,
+      "Cap buffer pools at this many buffers, where downstream allows",
+      "N"},
+  {"max-download-bytes", 0, 0, G_OPTION_ARG_INT64, &max_download_bytes,
+      "Keep at most this much of a download, in a ring buffer", "BYTES"},
+  {"alloc-stats", 'A', 0, G_OPTION_ARG_NONE, &alloc_stats,
+      "Report buffer allocations per element with the memory report", NULL},
+  {"appsink", 0, 0, G_OPTION_ARG_NONE, &use_appsink,
+      "Hand the video frames to the application instead of a video sink",
+      NULL},
+  {"pool-size", 0, 0, G_OPTION_ARG_INT, &pool_size,
+      "Frames in the appsink's buffer pool (default: 8)", "N"},
+  {"frame-allocator", 0, 0, G_OPTION_ARG_STRING, &frame_allocator,
+      "Where the appsink's frames live: sysmem (default), or a "
+        "pre-faulted memfd or hugepage arena", "NAME"},
+  {"audio-quality", 0, 0, G_OPTION_ARG_STRING, &audio_quality,
+      "Resampling and conversion quality: low-cpu, default or mastering",
+      "PROFILE"},
+  {NULL}
+};
+
+typedef struct _GlobalData GlobalData;
+
+/* One multiqueue inside playbin, and the streams going through it */
+typedef struct
+{
+  GlobalData *data;
+  GstElement *mq;
+  GPtrArray *streams;
+  /* Widest interleave seen in this window and the previous one */
+  GstClockTime window_peak;
+  GstClockTime last_window_peak;
+  GstClockTime limit;
+  /* When we started watching it */
+  gint64 added;
+  gboolean removed;
+} TrackedQueue;
 
 typedef struct
+{
+  TrackedQueue *queue;
+  guint id;
+  guint64 bytes_in;
+  guint64 bytes_out;
+  GstClockTime last_ts;
+  gboolean sparse;
+  gboolean eos;
+} QueueStream;
+
+struct _GlobalData
 {
   GMainLoop *loop;
   GstElement *playbin;
   guint bus_watch;
   guint io_watch_id;
-} GlobalData;
+  MemReport *mem_report;
+
+  /* Frames the appsink consumer got, and how many of those came from a
+   * buffer pool rather than being allocated for the occasion */
+  guint64 frames;
+  guint64 pooled_frames;
+  GstAllocator *allocator;
+
+  /* Demuxer queue tracking, protected by queue_lock */
+  GMutex queue_lock;
+  GPtrArray *queues;
+  gint64 window_start;
+  guint64 buffered_bytes;
+  guint64 peak_bytes;
+  GstClockTime peak_interleave;
+  GstClockTime peak_limit;
+};
 
 static gboolean handle_bus_msg (GstBus * bus, GstMessage * msg,
     GlobalData * data);
@@ -32,6 +148,84 @@ create_element (const gchar * type, const gchar * name)
   return e;
 }
 
+/* A bin from a gst-launch style description, for playbin's filters */
+static GstElement *
+create_filter (const gchar * desc)
+{
+  GstElement *bin;
+  GError *err = NULL;
+
+  bin = gst_parse_bin_from_description (desc, TRUE, &err);
+  if (!bin) {
+    g_print ("Failed to create filter '%s': %s\n", desc, err->message);
+    exit (1);
+  }
+
+  return bin;
+}
+
+/* Stands in for whatever the application does with a frame */
+static GstFlowReturn
+new_sample (GstAppSink * appsink, GlobalData * data)
+{
+  GstSample *sample = gst_app_sink_pull_sample (appsink);
+  GstBuffer *buf;
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  buf = gst_sample_get_buffer (sample);
+  if (gst_video_info_from_caps (&vinfo, gst_sample_get_caps (sample)) &&
+      gst_video_frame_map (&frame, &vinfo, buf, GST_MAP_READ))
+    gst_video_frame_unmap (&frame);
+
+  data->frames++;
+  if (buf->pool)
+    data->pooled_frames++;
+
+  /* Back to the pool it came from */
+  gst_sample_unref (sample);
+
+  return GST_FLOW_OK;
+}
+
+static GstElement *
+create_appsink (GlobalData * data)
+{
+  GstAppSinkCallbacks callbacks = { NULL, };
+  GstElement *appsink = create_element ("appsink", NULL);
+  FrameArenaType type;
+  GstCaps *caps;
+  guint n_frames = MAX (pool_size, APPSINK_MAX_BUFFERS + 2);
+
+  /* System memory, so the frames can be read */
+  caps = gst_caps_new_empty_simple ("video/x-raw");
+  g_object_set (appsink, "caps", caps, "max-buffers", APPSINK_MAX_BUFFERS,
+      NULL);
+  gst_caps_unref (caps);
+
+  callbacks.new_sample = (GstFlowReturn (*)(GstAppSink *, gpointer))
+      new_sample;
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, data,
+      NULL);
+
+  if (frame_allocator && !g_str_equal (frame_allocator, "sysmem")) {
+    if (!frame_arena_type_from_string (frame_allocator, &type)) {
+      g_print ("Unknown frame allocator %s\n", frame_allocator);
+      exit (1);
+    }
+    data->allocator = frame_allocator_new (type, n_frames);
+  }
+
+  /* Room for what the appsink holds, the frame being consumed and
+   * the decoder working on the next ones */
+  frame_pool_attach (appsink, n_frames, data->allocator);
+
+  return appsink;
+}
+
 static gchar *
 canonicalise_uri (const gchar * in)
 {
@@ -41,19 +235,302 @@ canonicalise_uri (const gchar * in)
   return gst_filename_to_uri (in, NULL);
 }
 
+static void
+tracked_queue_free (TrackedQueue * tq)
+{
+  g_ptr_array_free (tq->streams, TRUE);
+  gst_object_unref (tq->mq);
+  g_free (tq);
+}
+
+static QueueStream *
+queue_stream_for_pad (TrackedQueue * tq, GstPad * pad)
+{
+  const gchar *name = GST_PAD_NAME (pad);
+  QueueStream *stream;
+  guint i, id;
+
+  /* sink_N goes with src_N */
+  id = atoi (strchr (name, '_') + 1);
+  for (i = 0; i < tq->streams->len; i++) {
+    stream = g_ptr_array_index (tq->streams, i);
+    if (stream->id == id)
+      return stream;
+  }
+
+  stream = g_new0 (QueueStream, 1);
+  stream->queue = tq;
+  stream->id = id;
+  stream->last_ts = GST_CLOCK_TIME_NONE;
+  g_ptr_array_add (tq->streams, stream);
+
+  return stream;
+}
+
+/* How far apart the streams of one demuxer are, leaving out sparse
+ * streams like subtitles. Call with the queue lock held */
+static void
+update_interleave (TrackedQueue * tq)
+{
+  GstClockTime min = GST_CLOCK_TIME_NONE, max = GST_CLOCK_TIME_NONE;
+  guint i;
+
+  for (i = 0; i < tq->streams->len; i++) {
+    QueueStream *stream = g_ptr_array_index (tq->streams, i);
+
+    if (stream->sparse || stream->eos ||
+        !GST_CLOCK_TIME_IS_VALID (stream->last_ts))
+      continue;
+    if (!GST_CLOCK_TIME_IS_VALID (min) || stream->last_ts < min)
+      min = stream->last_ts;
+    if (!GST_CLOCK_TIME_IS_VALID (max) || stream->last_ts > max)
+      max = stream->last_ts;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (min))
+    return;
+
+  tq->window_peak = MAX (tq->window_peak, max - min);
+  tq->data->peak_interleave = MAX (tq->data->peak_interleave, max - min);
+}
+
+static GstPadProbeReturn
+queue_sink_probe (GstPad * pad, GstPadProbeInfo * info, QueueStream * stream)
+{
+  GlobalData *data = stream->queue->data;
+
+  g_mutex_lock (&data->queue_lock);
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+    gsize size = gst_buffer_get_size (buf);
+
+    stream->bytes_in += size;
+    data->buffered_bytes += size;
+    data->peak_bytes = MAX (data->peak_bytes, data->buffered_bytes);
+
+    if (GST_CLOCK_TIME_IS_VALID (GST_BUFFER_DTS_OR_PTS (buf))) {
+      stream->last_ts = GST_BUFFER_DTS_OR_PTS (buf);
+      update_interleave (stream->queue);
+    }
+  } else {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstStreamFlags flags;
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_FLUSH_STOP:
+        /* Whatever was queued is gone */
+        data->buffered_bytes -= stream->bytes_in - stream->bytes_out;
+        stream->bytes_in = stream->bytes_out = 0;
+        stream->last_ts = GST_CLOCK_TIME_NONE;
+        stream->eos = FALSE;
+        break;
+      case GST_EVENT_STREAM_START:
+        gst_event_parse_stream_flags (event, &flags);
+        stream->sparse = (flags & GST_STREAM_FLAG_SPARSE) != 0;
+        stream->last_ts = GST_CLOCK_TIME_NONE;
+        stream->eos = FALSE;
+        break;
+      case GST_EVENT_EOS:
+        stream->eos = TRUE;
+        break;
+      default:
+        break;
+    }
+  }
+  g_mutex_unlock (&data->queue_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+queue_src_probe (GstPad * pad, GstPadProbeInfo * info, QueueStream * stream)
+{
+  GlobalData *data = stream->queue->data;
+  gsize size = gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  g_mutex_lock (&data->queue_lock);
+  /* A buffer on its way out during a flush was already forgotten */
+  size = MIN (size, stream->bytes_in - stream->bytes_out);
+  stream->bytes_out += size;
+  data->buffered_bytes -= size;
+  g_mutex_unlock (&data->queue_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+queue_pad_added (GstElement * mq, GstPad * pad, TrackedQueue * tq)
+{
+  GlobalData *data = tq->data;
+  QueueStream *stream;
+
+  g_mutex_lock (&data->queue_lock);
+  stream = queue_stream_for_pad (tq, pad);
+  g_mutex_unlock (&data->queue_lock);
+
+  if (GST_PAD_IS_SINK (pad))
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+        (GstPadProbeCallback) queue_sink_probe, stream, NULL);
+  else
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) queue_src_probe, stream, NULL);
+}
+
+static void
+deep_element_added (GstBin * playbin, GstBin * bin, GstElement * element,
+    GlobalData * data)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  TrackedQueue *tq;
+
+  /* The multiqueues between the demuxers and the decoders */
+  if (factory == NULL ||
+      g_strcmp0 (GST_OBJECT_NAME (factory), "multiqueue") != 0)
+    return;
+
+  tq = g_new0 (TrackedQueue, 1);
+  tq->data = data;
+  tq->mq = gst_object_ref (element);
+  tq->streams = g_ptr_array_new_with_free_func (g_free);
+  tq->added = g_get_monotonic_time ();
+
+  g_mutex_lock (&data->queue_lock);
+  g_ptr_array_add (data->queues, tq);
+  g_mutex_unlock (&data->queue_lock);
+
+  g_signal_connect (element, "pad-added", G_CALLBACK (queue_pad_added), tq);
+}
+
+static void
+deep_element_removed (GstBin * playbin, GstBin * bin, GstElement * element,
+    GlobalData * data)
+{
+  guint i, j;
+
+  g_mutex_lock (&data->queue_lock);
+  for (i = 0; i < data->queues->len; i++) {
+    TrackedQueue *tq = g_ptr_array_index (data->queues, i);
+
+    if (tq->mq != element || tq->removed)
+      continue;
+    /* Its pads may still see a buffer or two, keep it around */
+    for (j = 0; j < tq->streams->len; j++) {
+      QueueStream *stream = g_ptr_array_index (tq->streams, j);
+      data->buffered_bytes -= stream->bytes_in - stream->bytes_out;
+      stream->bytes_in = stream->bytes_out = 0;
+    }
+    tq->removed = TRUE;
+    break;
+  }
+  g_mutex_unlock (&data->queue_lock);
+}
+
+/* Give each multiqueue just enough room for the interleave seen
+ * recently. multiqueue's time limit is hard: when a queue is full and
+ * another runs empty it only raises the buffers limit of the full one.
+ * So a queue keeps decodebin's limits until a whole window of
+ * interleave has been measured, and always keeps a buffers limit for
+ * that growth to work with */
+static gboolean
+resize_queues (GlobalData * data)
+{
+  GPtrArray *mqs = g_ptr_array_new_with_free_func (gst_object_unref);
+  GArray *limits = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  gint64 now = g_get_monotonic_time ();
+  gboolean new_window;
+  guint i;
+
+  g_mutex_lock (&data->queue_lock);
+  new_window = now - data->window_start > QUEUE_WINDOW;
+  if (new_window)
+    data->window_start = now;
+
+  for (i = 0; i < data->queues->len; i++) {
+    TrackedQueue *tq = g_ptr_array_index (data->queues, i);
+    GstClockTime needed = MAX (tq->window_peak, tq->last_window_peak);
+    GstClockTime limit = MAX (MIN_QUEUE_TIME,
+        needed + needed / 4 + QUEUE_MARGIN);
+
+    if (tq->removed)
+      continue;
+    if (new_window) {
+      tq->last_window_peak = tq->window_peak;
+      tq->window_peak = 0;
+    }
+    if (now - tq->added < QUEUE_WINDOW)
+      continue;
+
+    /* Only bother with changes of more than 10% */
+    if (tq->limit == 0 || limit > tq->limit + tq->limit / 10 ||
+        limit < tq->limit - tq->limit / 10) {
+      g_print ("%s limit now %" G_GUINT64_FORMAT " ms\n",
+          GST_OBJECT_NAME (tq->mq), limit / GST_MSECOND);
+      tq->limit = limit;
+      data->peak_limit = MAX (data->peak_limit, limit);
+    }
+    g_ptr_array_add (mqs, gst_object_ref (tq->mq));
+    g_array_append_val (limits, tq->limit);
+  }
+  g_mutex_unlock (&data->queue_lock);
+
+  /* decodebin sets its own limits when it's done prerolling, so check
+   * every time. multiqueue takes its own lock to change them, do it
+   * without ours */
+  for (i = 0; i < mqs->len; i++) {
+    GstElement *mq = g_ptr_array_index (mqs, i);
+    GstClockTime limit = g_array_index (limits, GstClockTime, i), cur_time;
+    guint cur_bytes, cur_buffers;
+
+    g_object_get (mq, "max-size-time", &cur_time, "max-size-bytes",
+        &cur_bytes, "max-size-buffers", &cur_buffers, NULL);
+    if (cur_time != limit || cur_bytes != max_queue_bytes ||
+        cur_buffers < MIN_QUEUE_BUFFERS)
+      g_object_set (mq, "max-size-time", limit, "max-size-bytes",
+          max_queue_bytes, "max-size-buffers", MAX (cur_buffers,
+              MIN_QUEUE_BUFFERS), NULL);
+  }
+  g_ptr_array_free (mqs, TRUE);
+  g_array_free (limits, TRUE);
+
+  return TRUE;
+}
+
+static void
+print_queue_stats (GlobalData * data)
+{
+  g_mutex_lock (&data->queue_lock);
+  g_print ("Demuxer queues: peak %" G_GUINT64_FORMAT " kB buffered, "
+      "widest interleave %" G_GUINT64_FORMAT " ms", data->peak_bytes / 1024,
+      data->peak_interleave / GST_MSECOND);
+  if (auto_queues)
+    g_print (", largest limit %" G_GUINT64_FORMAT " ms",
+        data->peak_limit / GST_MSECOND);
+  g_print ("\n");
+  g_mutex_unlock (&data->queue_lock);
+}
+
 int
 main (int argc, char *argv[])
 {
-  GlobalData data;
+  GlobalData data = { 0, };
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
   GIOChannel *io = NULL;
   GstBus *bus;
   gchar *uri;
+  guint queue_timeout = 0;
 
   /* Initialize GStreamer */
-  gst_init (&argc, &argv);
+  opt_ctx = g_option_context_new ("<file|URI> - Play a file");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
 
   if (argc < 2) {
-    g_print ("Usage: %s <file|URI>\n", argv[0]);
+    g_print ("Usage: %s [--auto-queues] [--queue-stats] [--effect NAME] "
+        "[--memory-report N] <file|URI>\n", argv[0]);
     g_print ("When running, pressing 'q' quits the application\n"
         "'f' seeks backwards 10 seconds\n"
         "'g' seeks forwards 10 seconds\n"
@@ -70,6 +547,58 @@ main (int argc, char *argv[])
   /* Set the uri property on playbin */
   g_object_set (data.playbin, "uri", uri, NULL);
 
+  /* The CPU convolve element works where gleffects can't */
+  if (effect && video_filter == NULL)
+    video_filter = g_strdup_printf ("videoconvert ! convolve effect=%s ! "
+        "videoconvert", effect);
+  if (video_filter)
+    g_object_set (data.playbin, "video-filter", create_filter (video_filter),
+        NULL);
+  if (audio_filter)
+    g_object_set (data.playbin, "audio-filter", create_filter (audio_filter),
+        NULL);
+  if (audio_quality) {
+    const AudioQualityProfile *profile =
+        audio_quality_profile_find (audio_quality);
+
+    if (profile == NULL) {
+      g_print ("Unknown audio quality profile %s\n", audio_quality);
+      return 1;
+    }
+    audio_quality_profile_watch (profile, data.playbin);
+  }
+
+  /* Only the appsink's pool can use a different allocator */
+  if (frame_allocator)
+    use_appsink = TRUE;
+  if (use_appsink)
+    g_object_set (data.playbin, "video-sink", create_appsink (&data), NULL);
+
+  /* Watch the queues between the demuxers and decoders */
+  g_mutex_init (&data.queue_lock);
+  data.queues = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      tracked_queue_free);
+  if (auto_queues || queue_stats) {
+    g_signal_connect (data.playbin, "deep-element-added",
+        G_CALLBACK (deep_element_added), &data);
+    g_signal_connect (data.playbin, "deep-element-removed",
+        G_CALLBACK (deep_element_removed), &data);
+  }
+  if (auto_queues)
+    queue_timeout = g_timeout_add (QUEUE_CHECK_INTERVAL,
+        (GSourceFunc) resize_queues, &data);
+
+  /* Where the memory goes, and keeping it within limits */
+  if (alloc_stats && memory_report <= 0)
+    memory_report = 5;
+  if (memory_report > 0 || max_queue_bytes > 0 || max_pool_buffers > 0 ||
+      max_download_bytes > 0) {
+    data.mem_report = mem_report_new (data.playbin);
+    mem_report_set_limits (data.mem_report, MAX (max_queue_bytes, 0),
+        MAX (max_pool_buffers, 0), MAX (max_download_bytes, 0));
+    mem_report_start (data.mem_report, MAX (memory_report, 0), alloc_stats);
+  }
+
   /* Connect to the bus to receive callbacks */
   bus = gst_element_get_bus (data.playbin);
 
@@ -95,16 +624,66 @@ main (int argc, char *argv[])
   /* Run the mainloop until it is exited by the message handler */
   g_main_loop_run (data.loop);
 
+  if (auto_queues || queue_stats)
+    print_queue_stats (&data);
+  if (use_appsink)
+    g_print ("appsink: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+        " from a buffer pool\n", data.frames, data.pooled_frames);
+  if (data.allocator)
+    frame_allocator_print_stats (data.allocator);
+
   /* Clean everything up before exiting */
   g_source_remove (data.bus_watch);
   g_source_remove (data.io_watch_id);
+  if (queue_timeout)
+    g_source_remove (queue_timeout);
   gst_element_set_state (data.playbin, GST_STATE_NULL);
+  if (data.mem_report) {
+    if (memory_report > 0)
+      mem_report_print_peaks (data.mem_report);
+    mem_report_free (data.mem_report);
+  }
   gst_object_unref (data.playbin);
+  if (data.allocator)
+    gst_object_unref (data.allocator);
+  g_ptr_array_free (data.queues, TRUE);
+  g_mutex_clear (&data.queue_lock);
   g_main_loop_unref (data.loop);
+  g_free (video_filter);
+  g_free (audio_filter);
+  g_free (effect);
+  g_free (frame_allocator);
+  g_free (audio_quality);
 
   return 0;
 }
 
+static void
+print_perf_probe (const gchar * name, const GstStructure * s)
+{
+  gdouble rate = 0, bitrate = 0;
+  guint64 gap_mean = 0, gap_max = 0, down_mean = 0, down_max = 0;
+  gint64 drift, drift_change = 0;
+
+  gst_structure_get_double (s, "buffer-rate", &rate);
+  gst_structure_get_double (s, "bitrate", &bitrate);
+  gst_structure_get_uint64 (s, "gap-mean", &gap_mean);
+  gst_structure_get_uint64 (s, "gap-max", &gap_max);
+  gst_structure_get_uint64 (s, "downstream-mean", &down_mean);
+  gst_structure_get_uint64 (s, "downstream-max", &down_max);
+
+  g_print ("%s: %.1f buffers/s, %.0f kbit/s, gap %.1f ms (max %.1f), "
+      "downstream %.1f ms (max %.1f)", name, rate, bitrate / 1000,
+      (gdouble) gap_mean / GST_MSECOND, (gdouble) gap_max / GST_MSECOND,
+      (gdouble) down_mean / GST_MSECOND, (gdouble) down_max / GST_MSECOND);
+  if (gst_structure_get_int64 (s, "drift", &drift)) {
+    gst_structure_get_int64 (s, "drift-change", &drift_change);
+    g_print (", drift %.1f ms (%+.1f)", (gdouble) drift / GST_MSECOND,
+        (gdouble) drift_change / GST_MSECOND);
+  }
+  g_print ("\n");
+}
+
 static gboolean
 handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
 {
@@ -155,6 +734,14 @@ handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
       gst_tag_list_free (tags);
       break;
     }
+    case GST_MESSAGE_ELEMENT:{
+      const GstStructure *s = gst_message_get_structure (msg);
+
+      /* From perfprobe elements in the filters */
+      if (gst_structure_has_name (s, "perfprobe"))
+        print_perf_probe (GST_MESSAGE_SRC_NAME (msg), s);
+      break;
+    }
     case GST_MESSAGE_ASYNC_DONE:{
       GstPad *video_pad;
       GstCaps *caps;
@@ -0,0 +1,326 @@
+/* Row kernels for the convolve element. All of them work on 16 bit
+ * intermediates, which is enough for every kernel we have: the largest
+ * sum is 16 * 255 for the blur. The SIMD versions are picked at run
+ * time, so one build works on any CPU of the architecture.
+ */
+#include "convolve-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static inline guint8
+convolve_pixel (const guint8 * r0, const guint8 * r1, const guint8 * r2,
+    gint xl, gint x, gint xr, const ConvolveKernel * k)
+{
+  gint v;
+
+  if (k->sobel) {
+    gint gx = (r0[xr] + 2 * r1[xr] + r2[xr]) - (r0[xl] + 2 * r1[xl] + r2[xl]);
+    gint gy = (r2[xl] + 2 * r2[x] + r2[xr]) - (r0[xl] + 2 * r0[x] + r0[xr]);
+
+    v = ABS (gx) + ABS (gy);
+  } else {
+    v = k->coef[0] * r0[xl] + k->coef[1] * r0[x] + k->coef[2] * r0[xr] +
+        k->coef[3] * r1[xl] + k->coef[4] * r1[x] + k->coef[5] * r1[xr] +
+        k->coef[6] * r2[xl] + k->coef[7] * r2[x] + k->coef[8] * r2[xr];
+    v = (v >> k->shift) + k->bias;
+  }
+
+  return CLAMP (v, 0, 255);
+}
+
+void
+convolve_row (ConvolveRowFunc simd, const guint8 * r0, const guint8 * r1,
+    const guint8 * r2, guint8 * dst, gint width, const ConvolveKernel * k)
+{
+  gint x;
+
+  if (width < 3) {
+    for (x = 0; x < width; x++)
+      dst[x] = convolve_pixel (r0, r1, r2, MAX (x - 1, 0), x,
+          MIN (x + 1, width - 1), k);
+    return;
+  }
+
+  dst[0] = convolve_pixel (r0, r1, r2, 0, 0, 1, k);
+  x = simd ? simd (r0, r1, r2, dst, width, k) : 1;
+  for (; x < width - 1; x++)
+    dst[x] = convolve_pixel (r0, r1, r2, x - 1, x, x + 1, k);
+  dst[width - 1] = convolve_pixel (r0, r1, r2, width - 2, width - 1,
+      width - 1, k);
+}
+
+#ifdef HAVE_X86
+__attribute__ ((target ("sse2")))
+static inline void
+load_sse2 (const guint8 * p, __m128i * lo, __m128i * hi)
+{
+  __m128i v = _mm_loadu_si128 ((const __m128i *) p);
+
+  *lo = _mm_unpacklo_epi8 (v, _mm_setzero_si128 ());
+  *hi = _mm_unpackhi_epi8 (v, _mm_setzero_si128 ());
+}
+
+__attribute__ ((target ("sse2")))
+static inline __m128i
+abs_sse2 (__m128i v)
+{
+  return _mm_max_epi16 (v, _mm_sub_epi16 (_mm_setzero_si128 (), v));
+}
+
+/* 16 pixels at a time */
+__attribute__ ((target ("sse2")))
+static gint
+convolve_row_sse2 (const guint8 * r0, const guint8 * r1, const guint8 * r2,
+    guint8 * dst, gint width, const ConvolveKernel * k)
+{
+  const guint8 *rows[3] = { r0, r1, r2 };
+  __m128i shift = _mm_cvtsi32_si128 (k->shift);
+  __m128i bias = _mm_set1_epi16 (k->bias);
+  __m128i lo, hi, l[3][3], h[3][3];
+  gint x, i, j;
+
+  for (x = 1; x + 16 < width; x += 16) {
+    if (k->sobel) {
+      __m128i gx_lo, gx_hi, gy_lo, gy_hi;
+
+      for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+          load_sse2 (rows[i] + x + j - 1, &l[i][j], &h[i][j]);
+
+#define SOBEL_SSE2(a, gx, gy) \
+      gx = _mm_sub_epi16 (_mm_add_epi16 (_mm_add_epi16 (a[0][2], a[2][2]), \
+              _mm_slli_epi16 (a[1][2], 1)), _mm_add_epi16 (_mm_add_epi16 \
+              (a[0][0], a[2][0]), _mm_slli_epi16 (a[1][0], 1))); \
+      gy = _mm_sub_epi16 (_mm_add_epi16 (_mm_add_epi16 (a[2][0], a[2][2]), \
+              _mm_slli_epi16 (a[2][1], 1)), _mm_add_epi16 (_mm_add_epi16 \
+              (a[0][0], a[0][2]), _mm_slli_epi16 (a[0][1], 1)));
+      SOBEL_SSE2 (l, gx_lo, gy_lo);
+      SOBEL_SSE2 (h, gx_hi, gy_hi);
+#undef SOBEL_SSE2
+
+      lo = _mm_add_epi16 (abs_sse2 (gx_lo), abs_sse2 (gy_lo));
+      hi = _mm_add_epi16 (abs_sse2 (gx_hi), abs_sse2 (gy_hi));
+    } else {
+      lo = hi = _mm_setzero_si128 ();
+      for (i = 0; i < 9; i++) {
+        __m128i c, vl, vh;
+
+        if (k->coef[i] == 0)
+          continue;
+        c = _mm_set1_epi16 (k->coef[i]);
+        load_sse2 (rows[i / 3] + x + i % 3 - 1, &vl, &vh);
+        lo = _mm_add_epi16 (lo, _mm_mullo_epi16 (vl, c));
+        hi = _mm_add_epi16 (hi, _mm_mullo_epi16 (vh, c));
+      }
+      lo = _mm_add_epi16 (_mm_sra_epi16 (lo, shift), bias);
+      hi = _mm_add_epi16 (_mm_sra_epi16 (hi, shift), bias);
+    }
+
+    _mm_storeu_si128 ((__m128i *) (dst + x), _mm_packus_epi16 (lo, hi));
+  }
+
+  return x;
+}
+
+/* Unpacking and packing both work within 128 bit lanes, so the pixels
+ * come back out in the order they went in */
+__attribute__ ((target ("avx2")))
+static inline void
+load_avx2 (const guint8 * p, __m256i * lo, __m256i * hi)
+{
+  __m256i v = _mm256_loadu_si256 ((const __m256i *) p);
+
+  *lo = _mm256_unpacklo_epi8 (v, _mm256_setzero_si256 ());
+  *hi = _mm256_unpackhi_epi8 (v, _mm256_setzero_si256 ());
+}
+
+/* 32 pixels at a time */
+__attribute__ ((target ("avx2")))
+static gint
+convolve_row_avx2 (const guint8 * r0, const guint8 * r1, const guint8 * r2,
+    guint8 * dst, gint width, const ConvolveKernel * k)
+{
+  const guint8 *rows[3] = { r0, r1, r2 };
+  __m128i shift = _mm_cvtsi32_si128 (k->shift);
+  __m256i bias = _mm256_set1_epi16 (k->bias);
+  __m256i lo, hi, l[3][3], h[3][3];
+  gint x, i, j;
+
+  for (x = 1; x + 32 < width; x += 32) {
+    if (k->sobel) {
+      __m256i gx_lo, gx_hi, gy_lo, gy_hi;
+
+      for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+          load_avx2 (rows[i] + x + j - 1, &l[i][j], &h[i][j]);
+
+#define SOBEL_AVX2(a, gx, gy) \
+      gx = _mm256_sub_epi16 (_mm256_add_epi16 (_mm256_add_epi16 (a[0][2], \
+                  a[2][2]), _mm256_slli_epi16 (a[1][2], 1)), \
+          _mm256_add_epi16 (_mm256_add_epi16 (a[0][0], a[2][0]), \
+              _mm256_slli_epi16 (a[1][0], 1))); \
+      gy = _mm256_sub_epi16 (_mm256_add_epi16 (_mm256_add_epi16 (a[2][0], \
+                  a[2][2]), _mm256_slli_epi16 (a[2][1], 1)), \
+          _mm256_add_epi16 (_mm256_add_epi16 (a[0][0], a[0][2]), \
+              _mm256_slli_epi16 (a[0][1], 1)));
+      SOBEL_AVX2 (l, gx_lo, gy_lo);
+      SOBEL_AVX2 (h, gx_hi, gy_hi);
+#undef SOBEL_AVX2
+
+      lo = _mm256_add_epi16 (_mm256_abs_epi16 (gx_lo),
+          _mm256_abs_epi16 (gy_lo));
+      hi = _mm256_add_epi16 (_mm256_abs_epi16 (gx_hi),
+          _mm256_abs_epi16 (gy_hi));
+    } else {
+      lo = hi = _mm256_setzero_si256 ();
+      for (i = 0; i < 9; i++) {
+        __m256i c, vl, vh;
+
+        if (k->coef[i] == 0)
+          continue;
+        c = _mm256_set1_epi16 (k->coef[i]);
+        load_avx2 (rows[i / 3] + x + i % 3 - 1, &vl, &vh);
+        lo = _mm256_add_epi16 (lo, _mm256_mullo_epi16 (vl, c));
+        hi = _mm256_add_epi16 (hi, _mm256_mullo_epi16 (vh, c));
+      }
+      lo = _mm256_add_epi16 (_mm256_sra_epi16 (lo, shift), bias);
+      hi = _mm256_add_epi16 (_mm256_sra_epi16 (hi, shift), bias);
+    }
+
+    _mm256_storeu_si256 ((__m256i *) (dst + x), _mm256_packus_epi16 (lo,
+            hi));
+  }
+
+  return x;
+}
+#endif /* HAVE_X86 */
+
+#ifdef HAVE_NEON
+static inline void
+load_neon (const guint8 * p, int16x8_t * lo, int16x8_t * hi)
+{
+  uint8x16_t v = vld1q_u8 (p);
+
+  *lo = vreinterpretq_s16_u16 (vmovl_u8 (vget_low_u8 (v)));
+  *hi = vreinterpretq_s16_u16 (vmovl_u8 (vget_high_u8 (v)));
+}
+
+/* 16 pixels at a time */
+static gint
+convolve_row_neon (const guint8 * r0, const guint8 * r1, const guint8 * r2,
+    guint8 * dst, gint width, const ConvolveKernel * k)
+{
+  const guint8 *rows[3] = { r0, r1, r2 };
+  int16x8_t shift = vdupq_n_s16 (-k->shift);
+  int16x8_t bias = vdupq_n_s16 (k->bias);
+  int16x8_t lo, hi, l[3][3], h[3][3];
+  gint x, i, j;
+
+  for (x = 1; x + 16 < width; x += 16) {
+    if (k->sobel) {
+      int16x8_t gx_lo, gx_hi, gy_lo, gy_hi;
+
+      for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+          load_neon (rows[i] + x + j - 1, &l[i][j], &h[i][j]);
+
+#define SOBEL_NEON(a, gx, gy) \
+      gx = vsubq_s16 (vaddq_s16 (vaddq_s16 (a[0][2], a[2][2]), \
+              vshlq_n_s16 (a[1][2], 1)), vaddq_s16 (vaddq_s16 (a[0][0], \
+                  a[2][0]), vshlq_n_s16 (a[1][0], 1))); \
+      gy = vsubq_s16 (vaddq_s16 (vaddq_s16 (a[2][0], a[2][2]), \
+              vshlq_n_s16 (a[2][1], 1)), vaddq_s16 (vaddq_s16 (a[0][0], \
+                  a[0][2]), vshlq_n_s16 (a[0][1], 1)));
+      SOBEL_NEON (l, gx_lo, gy_lo);
+      SOBEL_NEON (h, gx_hi, gy_hi);
+#undef SOBEL_NEON
+
+      lo = vaddq_s16 (vabsq_s16 (gx_lo), vabsq_s16 (gy_lo));
+      hi = vaddq_s16 (vabsq_s16 (gx_hi), vabsq_s16 (gy_hi));
+    } else {
+      lo = hi = vdupq_n_s16 (0);
+      for (i = 0; i < 9; i++) {
+        int16x8_t vl, vh;
+
+        if (k->coef[i] == 0)
+          continue;
+        load_neon (rows[i / 3] + x + i % 3 - 1, &vl, &vh);
+        lo = vmlaq_n_s16 (lo, vl, k->coef[i]);
+        hi = vmlaq_n_s16 (hi, vh, k->coef[i]);
+      }
+      /* A negative shift count shifts right, keeping the sign */
+      lo = vaddq_s16 (vshlq_s16 (lo, shift), bias);
+      hi = vaddq_s16 (vshlq_s16 (hi, shift), bias);
+    }
+
+    vst1q_u8 (dst + x, vcombine_u8 (vqmovun_s16 (lo), vqmovun_s16 (hi)));
+  }
+
+  return x;
+}
+#endif /* HAVE_NEON */
+
+gboolean
+convolve_impl_supported (ConvolveImpl impl)
+{
+  switch (impl) {
+    case CONVOLVE_IMPL_AUTO:
+    case CONVOLVE_IMPL_SCALAR:
+      return TRUE;
+#ifdef HAVE_X86
+    case CONVOLVE_IMPL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case CONVOLVE_IMPL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+#ifdef HAVE_NEON
+    case CONVOLVE_IMPL_NEON:
+      return TRUE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+ConvolveImpl
+convolve_best_impl (void)
+{
+  if (convolve_impl_supported (CONVOLVE_IMPL_AVX2))
+    return CONVOLVE_IMPL_AVX2;
+  if (convolve_impl_supported (CONVOLVE_IMPL_SSE2))
+    return CONVOLVE_IMPL_SSE2;
+  if (convolve_impl_supported (CONVOLVE_IMPL_NEON))
+    return CONVOLVE_IMPL_NEON;
+
+  return CONVOLVE_IMPL_SCALAR;
+}
+
+ConvolveRowFunc
+convolve_get_row_func (ConvolveImpl impl)
+{
+  if (impl == CONVOLVE_IMPL_AUTO)
+    impl = convolve_best_impl ();
+
+  switch (impl) {
+#ifdef HAVE_X86
+    case CONVOLVE_IMPL_SSE2:
+      return convolve_row_sse2;
+    case CONVOLVE_IMPL_AVX2:
+      return convolve_row_avx2;
+#endif
+#ifdef HAVE_NEON
+    case CONVOLVE_IMPL_NEON:
+      return convolve_row_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
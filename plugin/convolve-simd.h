@@ -0,0 +1,42 @@
+#ifndef __CONVOLVE_SIMD_H__
+#define __CONVOLVE_SIMD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A 3x3 kernel: out = (sum (coef * in) >> shift) + bias, or the Sobel
+ * gradient magnitude |gx| + |gy| if sobel is set */
+typedef struct
+{
+  gint16 coef[9];
+  gint shift;
+  gint16 bias;
+  gboolean sobel;
+} ConvolveKernel;
+
+typedef enum
+{
+  CONVOLVE_IMPL_AUTO,
+  CONVOLVE_IMPL_SCALAR,
+  CONVOLVE_IMPL_SSE2,
+  CONVOLVE_IMPL_AVX2,
+  CONVOLVE_IMPL_NEON
+} ConvolveImpl;
+
+/* Does pixels 1 to some x < width - 1 of a row, and returns that x */
+typedef gint (*ConvolveRowFunc) (const guint8 * r0, const guint8 * r1,
+    const guint8 * r2, guint8 * dst, gint width, const ConvolveKernel * k);
+
+ConvolveImpl convolve_best_impl (void);
+gboolean convolve_impl_supported (ConvolveImpl impl);
+ConvolveRowFunc convolve_get_row_func (ConvolveImpl impl);
+
+/* One output row from the input rows above, at and below it. Edge
+ * pixels repeat */
+void convolve_row (ConvolveRowFunc simd, const guint8 * r0,
+    const guint8 * r1, const guint8 * r2, guint8 * dst, gint width,
+    const ConvolveKernel * k);
+
+G_END_DECLS
+#endif /* __CONVOLVE_SIMD_H__ */
@@ -0,0 +1,361 @@
+/* convolve: Sobel edge detection and a few other 3x3 effects on the CPU,
+ * for machines that can't run gleffects. Only the luma plane is
+ * filtered; the chroma is copied for blur and sharpen, and made grey
+ * for the others.
+ *
+ *   videotestsrc ! convolve effect=sobel ! videoconvert ! autovideosink
+ *
+ * Each frame is cut into horizontal stripes that run on a pool of
+ * threads, and each row uses SSE2, AVX2 or NEON when the CPU has it.
+ */
+#include <string.h>
+
+#include "gstconvolve.h"
+#include "convolve-simd.h"
+
+GST_DEBUG_CATEGORY_STATIC (convolve_debug);
+#define GST_CAT_DEFAULT convolve_debug
+
+typedef enum
+{
+  EFFECT_SOBEL,
+  EFFECT_BLUR,
+  EFFECT_SHARPEN,
+  EFFECT_EMBOSS,
+  EFFECT_EDGE
+} ConvolveEffect;
+
+#define DEFAULT_EFFECT EFFECT_SOBEL
+#define DEFAULT_THREADS 0
+#define DEFAULT_IMPLEMENTATION CONVOLVE_IMPL_AUTO
+
+enum
+{
+  PROP_0,
+  PROP_EFFECT,
+  PROP_THREADS,
+  PROP_IMPLEMENTATION
+};
+
+static const ConvolveKernel kernels[] = {
+  [EFFECT_SOBEL] = {{0,}, 0, 0, TRUE},
+  [EFFECT_BLUR] = {{1, 2, 1, 2, 4, 2, 1, 2, 1}, 4, 0, FALSE},
+  [EFFECT_SHARPEN] = {{0, -1, 0, -1, 5, -1, 0, -1, 0}, 0, 0, FALSE},
+  [EFFECT_EMBOSS] = {{-2, -1, 0, -1, 1, 1, 0, 1, 2}, 0, 0, FALSE},
+  [EFFECT_EDGE] = {{-1, -1, -1, -1, 8, -1, -1, -1, -1}, 0, 0, FALSE},
+};
+
+typedef struct
+{
+  GstVideoFrame *in;
+  GstVideoFrame *out;
+  gint first_row;
+  gint last_row;
+} Stripe;
+
+struct _GstConvolve
+{
+  GstVideoFilter parent;
+
+  /* Properties, under the object lock */
+  ConvolveEffect effect;
+  guint threads;
+  ConvolveImpl implementation;
+
+  /* Set up in start () */
+  ConvolveRowFunc row_func;
+  GThreadPool *pool;
+  guint n_stripes;
+
+  GMutex lock;
+  GCond cond;
+  guint pending;
+  ConvolveKernel kernel;
+  gboolean keep_colour;
+};
+
+#define GST_TYPE_CONVOLVE_EFFECT (gst_convolve_effect_get_type ())
+static GType
+gst_convolve_effect_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {EFFECT_SOBEL, "Sobel edge detection", "sobel"},
+    {EFFECT_BLUR, "Gaussian blur", "blur"},
+    {EFFECT_SHARPEN, "Sharpen", "sharpen"},
+    {EFFECT_EMBOSS, "Emboss", "emboss"},
+    {EFFECT_EDGE, "Laplacian edges", "edge"},
+    {0, NULL, NULL}
+  };
+
+  if (!type)
+    type = g_enum_register_static ("GstConvolveEffect", values);
+  return type;
+}
+
+#define GST_TYPE_CONVOLVE_IMPLEMENTATION (gst_convolve_implementation_get_type ())
+static GType
+gst_convolve_implementation_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {CONVOLVE_IMPL_AUTO, "Best the CPU supports", "auto"},
+    {CONVOLVE_IMPL_SCALAR, "Plain C", "scalar"},
+    {CONVOLVE_IMPL_SSE2, "SSE2", "sse2"},
+    {CONVOLVE_IMPL_AVX2, "AVX2", "avx2"},
+    {CONVOLVE_IMPL_NEON, "NEON", "neon"},
+    {0, NULL, NULL}
+  };
+
+  if (!type)
+    type = g_enum_register_static ("GstConvolveImplementation", values);
+  return type;
+}
+
+#define VIDEO_FORMATS "{ GRAY8, I420, YV12, NV12, NV21, Y41B, Y42B, Y444 }"
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (VIDEO_FORMATS)));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (VIDEO_FORMATS)));
+
+#define gst_convolve_parent_class parent_class
+G_DEFINE_TYPE (GstConvolve, gst_convolve, GST_TYPE_VIDEO_FILTER);
+
+static void
+gst_convolve_process_stripe (GstConvolve * self, Stripe * stripe)
+{
+  const guint8 *in = GST_VIDEO_FRAME_PLANE_DATA (stripe->in, 0);
+  guint8 *out = GST_VIDEO_FRAME_PLANE_DATA (stripe->out, 0);
+  gint in_stride = GST_VIDEO_FRAME_PLANE_STRIDE (stripe->in, 0);
+  gint out_stride = GST_VIDEO_FRAME_PLANE_STRIDE (stripe->out, 0);
+  gint width = GST_VIDEO_FRAME_COMP_WIDTH (stripe->in, 0);
+  gint height = GST_VIDEO_FRAME_COMP_HEIGHT (stripe->in, 0);
+  gint y;
+
+  for (y = stripe->first_row; y < stripe->last_row; y++)
+    convolve_row (self->row_func, in + MAX (y - 1, 0) * in_stride,
+        in + y * in_stride, in + MIN (y + 1, height - 1) * in_stride,
+        out + y * out_stride, width, &self->kernel);
+}
+
+static void
+gst_convolve_stripe_func (Stripe * stripe, GstConvolve * self)
+{
+  gst_convolve_process_stripe (self, stripe);
+
+  g_mutex_lock (&self->lock);
+  if (--self->pending == 0)
+    g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static GstFlowReturn
+gst_convolve_transform_frame (GstVideoFilter * filter,
+    GstVideoFrame * in_frame, GstVideoFrame * out_frame)
+{
+  GstConvolve *self = GST_CONVOLVE (filter);
+  gint height = GST_VIDEO_FRAME_COMP_HEIGHT (in_frame, 0);
+  guint n_stripes = MIN (self->n_stripes, MAX (height, 1));
+  Stripe *stripes = g_newa (Stripe, n_stripes);
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  self->kernel = kernels[self->effect];
+  self->keep_colour = self->effect == EFFECT_BLUR ||
+      self->effect == EFFECT_SHARPEN;
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; i < n_stripes; i++) {
+    stripes[i].in = in_frame;
+    stripes[i].out = out_frame;
+    stripes[i].first_row = height * i / n_stripes;
+    stripes[i].last_row = height * (i + 1) / n_stripes;
+  }
+
+  /* All but the last stripe go to the pool, this thread does that one */
+  self->pending = n_stripes - 1;
+  for (i = 0; i + 1 < n_stripes; i++)
+    g_thread_pool_push (self->pool, &stripes[i], NULL);
+  gst_convolve_process_stripe (self, &stripes[n_stripes - 1]);
+
+  g_mutex_lock (&self->lock);
+  while (self->pending > 0)
+    g_cond_wait (&self->cond, &self->lock);
+  g_mutex_unlock (&self->lock);
+
+  /* Edges and embossing are grey, the others keep their colour */
+  for (i = 1; i < GST_VIDEO_FRAME_N_PLANES (out_frame); i++) {
+    if (self->keep_colour)
+      gst_video_frame_copy_plane (out_frame, in_frame, i);
+    else
+      memset (GST_VIDEO_FRAME_PLANE_DATA (out_frame, i), 128,
+          GST_VIDEO_FRAME_PLANE_STRIDE (out_frame, i) *
+          GST_VIDEO_FRAME_COMP_HEIGHT (out_frame, i));
+  }
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_convolve_start (GstBaseTransform * trans)
+{
+  GstConvolve *self = GST_CONVOLVE (trans);
+  ConvolveImpl impl;
+  guint threads;
+
+  GST_OBJECT_LOCK (self);
+  impl = self->implementation;
+  threads = self->threads;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!convolve_impl_supported (impl)) {
+    GST_ELEMENT_ERROR (self, CORE, NOT_IMPLEMENTED,
+        ("This CPU or build doesn't support the requested implementation"),
+        (NULL));
+    return FALSE;
+  }
+  self->row_func = convolve_get_row_func (impl);
+
+  self->n_stripes = threads ? threads : g_get_num_processors ();
+  if (self->n_stripes > 1)
+    self->pool = g_thread_pool_new ((GFunc) gst_convolve_stripe_func, self,
+        self->n_stripes - 1, TRUE, NULL);
+
+  GST_INFO_OBJECT (self, "Using %u threads, implementation %d",
+      self->n_stripes, impl == CONVOLVE_IMPL_AUTO ? convolve_best_impl () :
+      impl);
+
+  return TRUE;
+}
+
+static gboolean
+gst_convolve_stop (GstBaseTransform * trans)
+{
+  GstConvolve *self = GST_CONVOLVE (trans);
+
+  if (self->pool) {
+    g_thread_pool_free (self->pool, FALSE, TRUE);
+    self->pool = NULL;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_convolve_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstConvolve *self = GST_CONVOLVE (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_EFFECT:
+      self->effect = g_value_get_enum (value);
+      break;
+    case PROP_THREADS:
+      self->threads = g_value_get_uint (value);
+      break;
+    case PROP_IMPLEMENTATION:
+      self->implementation = g_value_get_enum (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_convolve_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstConvolve *self = GST_CONVOLVE (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_EFFECT:
+      g_value_set_enum (value, self->effect);
+      break;
+    case PROP_THREADS:
+      g_value_set_uint (value, self->threads);
+      break;
+    case PROP_IMPLEMENTATION:
+      g_value_set_enum (value, self->implementation);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_convolve_finalize (GObject * object)
+{
+  GstConvolve *self = GST_CONVOLVE (object);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_convolve_class_init (GstConvolveClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+  GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS (klass);
+
+  gobject_class->set_property = gst_convolve_set_property;
+  gobject_class->get_property = gst_convolve_get_property;
+  gobject_class->finalize = gst_convolve_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_EFFECT,
+      g_param_spec_enum ("effect", "Effect", "What to do to the picture",
+          GST_TYPE_CONVOLVE_EFFECT, DEFAULT_EFFECT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_uint ("threads", "Threads",
+          "Threads to split each frame over, from the next start "
+          "(0 = one per CPU)", 0, 256, DEFAULT_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IMPLEMENTATION,
+      g_param_spec_enum ("implementation", "Implementation",
+          "Which instruction set to use, from the next start",
+          GST_TYPE_CONVOLVE_IMPLEMENTATION, DEFAULT_IMPLEMENTATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  trans_class->start = GST_DEBUG_FUNCPTR (gst_convolve_start);
+  trans_class->stop = GST_DEBUG_FUNCPTR (gst_convolve_stop);
+  filter_class->transform_frame =
+      GST_DEBUG_FUNCPTR (gst_convolve_transform_frame);
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Convolution effects", "Filter/Effect/Video",
+      "Sobel edges, blur, sharpen and emboss on the CPU with SIMD",
+      "GStreamer tutorial");
+
+  GST_DEBUG_CATEGORY_INIT (convolve_debug, "convolve", 0,
+      "Convolution effects");
+}
+
+static void
+gst_convolve_init (GstConvolve * self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+
+  self->effect = DEFAULT_EFFECT;
+  self->threads = DEFAULT_THREADS;
+  self->implementation = DEFAULT_IMPLEMENTATION;
+}
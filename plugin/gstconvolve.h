@@ -0,0 +1,15 @@
+#ifndef __GST_CONVOLVE_H__
+#define __GST_CONVOLVE_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_CONVOLVE (gst_convolve_get_type ())
+G_DECLARE_FINAL_TYPE (GstConvolve, gst_convolve, GST, CONVOLVE,
+    GstVideoFilter)
+
+G_END_DECLS
+#endif /* __GST_CONVOLVE_H__ */
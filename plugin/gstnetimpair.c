@@ -0,0 +1,615 @@
+/* netimpair: make a packet flow look like it went over a bad network,
+ * without netem or root. Each buffer is one packet, which may be lost
+ * (at random, or in bursts), held back for a delay plus jitter, sent
+ * out of order, or queued behind a bandwidth cap.
+ *
+ *   udpsrc ! netimpair loss=2 burst-length=3 delay=40 jitter=10 ! \
+ *       rtpjitterbuffer ! ...
+ *
+ * Packets go out from a thread of our own at the time they're due, by
+ * the monotonic system time, so the impairment doesn't depend on the
+ * pipeline clock. On the way out they are stamped with the running
+ * time they left at, as udpsrc would have when they arrived. With a
+ * non-zero seed the same settings drop and reorder the same packets on
+ * every run.
+ */
+#include <string.h>
+
+#include "gstnetimpair.h"
+
+GST_DEBUG_CATEGORY_STATIC (net_impair_debug);
+#define GST_CAT_DEFAULT net_impair_debug
+
+#define DEFAULT_LOSS 0.0
+#define DEFAULT_BURST_LENGTH 1.0
+#define DEFAULT_DELAY 0
+#define DEFAULT_JITTER 0
+#define DEFAULT_REORDER 0.0
+#define DEFAULT_BANDWIDTH 0
+#define DEFAULT_QUEUE_SIZE 1000
+#define DEFAULT_SEED 0
+
+enum
+{
+  PROP_0,
+  PROP_LOSS,
+  PROP_BURST_LENGTH,
+  PROP_DELAY,
+  PROP_JITTER,
+  PROP_REORDER,
+  PROP_BANDWIDTH,
+  PROP_QUEUE_SIZE,
+  PROP_SEED,
+  PROP_STATS
+};
+
+typedef struct
+{
+  /* Monotonic time in microseconds */
+  gint64 send_time;
+  GstMiniObject *obj;
+} QueuedItem;
+
+struct _GstNetImpair
+{
+  GstElement parent;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* Everything below is protected by the lock */
+  GMutex lock;
+  GCond cond;
+
+  gdouble loss;
+  gdouble burst_length;
+  guint delay;
+  guint jitter;
+  gdouble reorder;
+  guint bandwidth;
+  guint queue_size;
+  guint seed;
+
+  GQueue queue;
+  gboolean flushing;
+  GstFlowReturn srcresult;
+
+  GRand *rand;
+  gboolean in_burst;
+  /* When the last in-order packet is due, and when the capped link is
+   * free to start sending the next one */
+  gint64 last_send_time;
+  gint64 link_free_time;
+
+  guint64 forwarded;
+  guint64 dropped;
+  guint64 reordered;
+  guint64 overflowed;
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+#define gst_net_impair_parent_class parent_class
+G_DEFINE_TYPE (GstNetImpair, gst_net_impair, GST_TYPE_ELEMENT);
+
+static void
+queued_item_free (QueuedItem * item)
+{
+  gst_mini_object_unref (item->obj);
+  g_free (item);
+}
+
+/* Call with the lock held */
+static void
+gst_net_impair_reset (GstNetImpair * self)
+{
+  g_queue_foreach (&self->queue, (GFunc) queued_item_free, NULL);
+  g_queue_clear (&self->queue);
+  self->in_burst = FALSE;
+  self->last_send_time = 0;
+  self->link_free_time = 0;
+}
+
+/* Call with the lock held */
+static void
+gst_net_impair_reseed (GstNetImpair * self)
+{
+  if (self->rand)
+    g_rand_free (self->rand);
+  self->rand = self->seed ? g_rand_new_with_seed (self->seed) : g_rand_new ();
+}
+
+/* Two state loss model: in a burst every packet is lost, and bursts
+ * last burst-length packets on average. Bursts start just often enough
+ * to keep the overall loss at the loss property. Call with the lock
+ * held */
+static gboolean
+gst_net_impair_lose_packet (GstNetImpair * self)
+{
+  gdouble loss = self->loss / 100.0;
+  gdouble start;
+
+  if (loss <= 0.0)
+    return FALSE;
+  if (loss >= 1.0)
+    return TRUE;
+  if (self->burst_length <= 1.0)
+    return g_rand_double (self->rand) < loss;
+
+  if (self->in_burst) {
+    if (g_rand_double (self->rand) < 1.0 / self->burst_length)
+      self->in_burst = FALSE;
+  } else {
+    start = loss / (self->burst_length * (1.0 - loss));
+    if (g_rand_double (self->rand) < start)
+      self->in_burst = TRUE;
+  }
+
+  return self->in_burst;
+}
+
+/* Keep the queue sorted by send time, and in arrival order among equal
+ * times. Call with the lock held */
+static void
+gst_net_impair_enqueue (GstNetImpair * self, GstMiniObject * obj,
+    gint64 send_time)
+{
+  QueuedItem *item = g_new (QueuedItem, 1);
+  GList *l;
+
+  item->obj = obj;
+  item->send_time = send_time;
+
+  for (l = self->queue.tail; l; l = l->prev)
+    if (((QueuedItem *) l->data)->send_time <= send_time)
+      break;
+
+  if (l)
+    g_queue_insert_after (&self->queue, l, item);
+  else
+    g_queue_push_head (&self->queue, item);
+
+  g_cond_signal (&self->cond);
+}
+
+static GstFlowReturn
+gst_net_impair_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (parent);
+  GstFlowReturn ret;
+  gint64 now, send_time;
+
+  g_mutex_lock (&self->lock);
+  if (self->srcresult != GST_FLOW_OK) {
+    ret = self->srcresult;
+    g_mutex_unlock (&self->lock);
+    gst_buffer_unref (buf);
+    return ret;
+  }
+
+  if (gst_net_impair_lose_packet (self)) {
+    self->dropped++;
+    goto drop;
+  }
+  if (g_queue_get_length (&self->queue) >= self->queue_size) {
+    self->overflowed++;
+    goto drop;
+  }
+
+  now = g_get_monotonic_time ();
+
+  /* A capped link sends one packet after the other */
+  if (self->bandwidth > 0) {
+    self->link_free_time = MAX (now, self->link_free_time) +
+        gst_buffer_get_size (buf) * 8 * 1000 / self->bandwidth;
+    now = self->link_free_time;
+  }
+
+  if (self->reorder > 0.0 && g_rand_double (self->rand) * 100.0 <
+      self->reorder) {
+    /* Skip the delay, and overtake what's queued */
+    send_time = now;
+    self->reordered++;
+  } else {
+    send_time = now + self->delay * G_TIME_SPAN_MILLISECOND;
+    if (self->jitter > 0)
+      send_time += g_rand_int_range (self->rand, -(gint) self->jitter,
+          self->jitter + 1) * G_TIME_SPAN_MILLISECOND;
+    /* Jitter alone doesn't reorder */
+    send_time = MAX (send_time, self->last_send_time);
+    self->last_send_time = send_time;
+  }
+
+  gst_net_impair_enqueue (self, GST_MINI_OBJECT_CAST (buf), send_time);
+  g_mutex_unlock (&self->lock);
+
+  return GST_FLOW_OK;
+
+drop:
+  g_mutex_unlock (&self->lock);
+  gst_buffer_unref (buf);
+  return GST_FLOW_OK;
+}
+
+/* Like udpsrc, the arrival time goes into DTS and there's no PTS.
+ * rtpjitterbuffer goes by it, so this is what makes the delay and
+ * jitter visible downstream */
+static GstBuffer *
+gst_net_impair_stamp (GstNetImpair * self, GstBuffer * buf)
+{
+  GstClock *clock = gst_element_get_clock (GST_ELEMENT (self));
+  GstClockTime now, base_time;
+
+  if (clock == NULL)
+    return buf;
+
+  now = gst_clock_get_time (clock);
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+  gst_object_unref (clock);
+
+  buf = gst_buffer_make_writable (buf);
+  GST_BUFFER_DTS (buf) = now > base_time ? now - base_time : 0;
+  GST_BUFFER_PTS (buf) = GST_CLOCK_TIME_NONE;
+
+  return buf;
+}
+
+static void
+gst_net_impair_loop (GstNetImpair * self)
+{
+  QueuedItem *item;
+  GstMiniObject *obj;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&self->lock);
+  while (!self->flushing) {
+    item = g_queue_peek_head (&self->queue);
+    if (item == NULL)
+      g_cond_wait (&self->cond, &self->lock);
+    else if (item->send_time > g_get_monotonic_time ())
+      g_cond_wait_until (&self->cond, &self->lock, item->send_time);
+    else
+      break;
+  }
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    gst_pad_pause_task (self->srcpad);
+    return;
+  }
+
+  item = g_queue_pop_head (&self->queue);
+  obj = item->obj;
+  g_free (item);
+  if (GST_IS_BUFFER (obj))
+    self->forwarded++;
+  g_mutex_unlock (&self->lock);
+
+  if (GST_IS_BUFFER (obj)) {
+    ret = gst_pad_push (self->srcpad,
+        gst_net_impair_stamp (self, GST_BUFFER_CAST (obj)));
+  } else if (GST_EVENT_TYPE (obj) == GST_EVENT_EOS) {
+    gst_pad_push_event (self->srcpad, GST_EVENT_CAST (obj));
+    ret = GST_FLOW_EOS;
+  } else {
+    gst_pad_push_event (self->srcpad, GST_EVENT_CAST (obj));
+  }
+
+  if (ret != GST_FLOW_OK) {
+    g_mutex_lock (&self->lock);
+    self->srcresult = ret;
+    g_mutex_unlock (&self->lock);
+
+    if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS)
+      GST_ELEMENT_FLOW_ERROR (self, ret);
+    gst_pad_pause_task (self->srcpad);
+  }
+}
+
+static gboolean
+gst_net_impair_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (parent);
+  QueuedItem *tail;
+  gint64 send_time;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      g_mutex_lock (&self->lock);
+      self->flushing = TRUE;
+      self->srcresult = GST_FLOW_FLUSHING;
+      g_cond_signal (&self->cond);
+      g_mutex_unlock (&self->lock);
+
+      gst_pad_push_event (self->srcpad, event);
+      gst_pad_pause_task (self->srcpad);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&self->lock);
+      gst_net_impair_reset (self);
+      self->flushing = FALSE;
+      self->srcresult = GST_FLOW_OK;
+      g_mutex_unlock (&self->lock);
+
+      gst_pad_push_event (self->srcpad, event);
+      return gst_pad_start_task (self->srcpad,
+          (GstTaskFunction) gst_net_impair_loop, self, NULL);
+    default:
+      break;
+  }
+
+  if (!GST_EVENT_IS_SERIALIZED (event))
+    return gst_pad_push_event (self->srcpad, event);
+
+  /* Serialized events go out after everything that came before them */
+  g_mutex_lock (&self->lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    gst_event_unref (event);
+    return FALSE;
+  }
+  tail = g_queue_peek_tail (&self->queue);
+  send_time = tail ? tail->send_time : 0;
+  gst_net_impair_enqueue (self, GST_MINI_OBJECT_CAST (event), send_time);
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_net_impair_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (parent);
+  gboolean ret;
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (active) {
+    g_mutex_lock (&self->lock);
+    self->flushing = FALSE;
+    self->srcresult = GST_FLOW_OK;
+    g_mutex_unlock (&self->lock);
+    return gst_pad_start_task (pad, (GstTaskFunction) gst_net_impair_loop,
+        self, NULL);
+  }
+
+  g_mutex_lock (&self->lock);
+  self->flushing = TRUE;
+  self->srcresult = GST_FLOW_FLUSHING;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  ret = gst_pad_stop_task (pad);
+
+  g_mutex_lock (&self->lock);
+  gst_net_impair_reset (self);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+static GstStateChangeReturn
+gst_net_impair_change_state (GstElement * element, GstStateChange transition)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (element);
+
+  /* Every run starts from the seed again */
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    g_mutex_lock (&self->lock);
+    gst_net_impair_reseed (self);
+    gst_net_impair_reset (self);
+    self->forwarded = self->dropped = self->reordered = self->overflowed = 0;
+    g_mutex_unlock (&self->lock);
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_net_impair_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (object);
+
+  g_mutex_lock (&self->lock);
+  switch (prop_id) {
+    case PROP_LOSS:
+      self->loss = g_value_get_double (value);
+      break;
+    case PROP_BURST_LENGTH:
+      self->burst_length = g_value_get_double (value);
+      break;
+    case PROP_DELAY:
+      self->delay = g_value_get_uint (value);
+      break;
+    case PROP_JITTER:
+      self->jitter = g_value_get_uint (value);
+      break;
+    case PROP_REORDER:
+      self->reorder = g_value_get_double (value);
+      break;
+    case PROP_BANDWIDTH:
+      self->bandwidth = g_value_get_uint (value);
+      break;
+    case PROP_QUEUE_SIZE:
+      self->queue_size = g_value_get_uint (value);
+      break;
+    case PROP_SEED:
+      self->seed = g_value_get_uint (value);
+      gst_net_impair_reseed (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_net_impair_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (object);
+
+  g_mutex_lock (&self->lock);
+  switch (prop_id) {
+    case PROP_LOSS:
+      g_value_set_double (value, self->loss);
+      break;
+    case PROP_BURST_LENGTH:
+      g_value_set_double (value, self->burst_length);
+      break;
+    case PROP_DELAY:
+      g_value_set_uint (value, self->delay);
+      break;
+    case PROP_JITTER:
+      g_value_set_uint (value, self->jitter);
+      break;
+    case PROP_REORDER:
+      g_value_set_double (value, self->reorder);
+      break;
+    case PROP_BANDWIDTH:
+      g_value_set_uint (value, self->bandwidth);
+      break;
+    case PROP_QUEUE_SIZE:
+      g_value_set_uint (value, self->queue_size);
+      break;
+    case PROP_SEED:
+      g_value_set_uint (value, self->seed);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_structure_new ("netimpair-stats",
+              "forwarded", G_TYPE_UINT64, self->forwarded,
+              "dropped", G_TYPE_UINT64, self->dropped,
+              "reordered", G_TYPE_UINT64, self->reordered,
+              "overflowed", G_TYPE_UINT64, self->overflowed, NULL));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_net_impair_finalize (GObject * object)
+{
+  GstNetImpair *self = GST_NET_IMPAIR (object);
+
+  gst_net_impair_reset (self);
+  if (self->rand)
+    g_rand_free (self->rand);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_net_impair_class_init (GstNetImpairClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->set_property = gst_net_impair_set_property;
+  gobject_class->get_property = gst_net_impair_get_property;
+  gobject_class->finalize = gst_net_impair_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOSS,
+      g_param_spec_double ("loss", "Loss",
+          "Percentage of packets to lose", 0.0, 100.0, DEFAULT_LOSS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BURST_LENGTH,
+      g_param_spec_double ("burst-length", "Burst length",
+          "Average number of packets lost in a row (1 = independent losses)",
+          1.0, G_MAXDOUBLE, DEFAULT_BURST_LENGTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DELAY,
+      g_param_spec_uint ("delay", "Delay",
+          "Delay in ms added to every packet", 0, G_MAXUINT, DEFAULT_DELAY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_JITTER,
+      g_param_spec_uint ("jitter", "Jitter",
+          "Random variation of the delay, +/- ms", 0, G_MAXINT,
+          DEFAULT_JITTER, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_REORDER,
+      g_param_spec_double ("reorder", "Reorder",
+          "Percentage of packets sent right away, ahead of delayed ones",
+          0.0, 100.0, DEFAULT_REORDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BANDWIDTH,
+      g_param_spec_uint ("bandwidth", "Bandwidth",
+          "Link capacity in kbit/s (0 = unlimited)", 0, G_MAXUINT,
+          DEFAULT_BANDWIDTH, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_QUEUE_SIZE,
+      g_param_spec_uint ("queue-size", "Queue size",
+          "Packets that can wait for the link before more get dropped", 1,
+          G_MAXUINT, DEFAULT_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SEED,
+      g_param_spec_uint ("seed", "Seed",
+          "Random seed, to repeat the same impairment (0 = random)", 0,
+          G_MAXUINT, DEFAULT_SEED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Packets forwarded, dropped, reordered and overflowed",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state = gst_net_impair_change_state;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Network impairment", "Filter/Network",
+      "Loses, delays, reorders and rate limits packets like a bad network",
+      "GStreamer tutorial");
+
+  GST_DEBUG_CATEGORY_INIT (net_impair_debug, "netimpair", 0,
+      "Network impairment");
+}
+
+static void
+gst_net_impair_init (GstNetImpair * self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->queue);
+
+  self->loss = DEFAULT_LOSS;
+  self->burst_length = DEFAULT_BURST_LENGTH;
+  self->delay = DEFAULT_DELAY;
+  self->jitter = DEFAULT_JITTER;
+  self->reorder = DEFAULT_REORDER;
+  self->bandwidth = DEFAULT_BANDWIDTH;
+  self->queue_size = DEFAULT_QUEUE_SIZE;
+  self->seed = DEFAULT_SEED;
+  self->flushing = TRUE;
+  self->srcresult = GST_FLOW_FLUSHING;
+  gst_net_impair_reseed (self);
+
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_net_impair_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_net_impair_sink_event));
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_activatemode_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_net_impair_src_activate_mode));
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+}
@@ -0,0 +1,13 @@
+#ifndef __GST_NET_IMPAIR_H__
+#define __GST_NET_IMPAIR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_NET_IMPAIR (gst_net_impair_get_type ())
+G_DECLARE_FINAL_TYPE (GstNetImpair, gst_net_impair, GST, NET_IMPAIR,
+    GstElement)
+
+G_END_DECLS
+#endif /* __GST_NET_IMPAIR_H__ */
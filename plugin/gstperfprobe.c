@@ -0,0 +1,299 @@
+/* perfprobe: a measuring point to drop into any pipeline. Buffers go
+ * through untouched; every interval the element posts an element
+ * message called "perfprobe" with what it saw since the last one:
+ *
+ *   buffer-rate     buffers per second
+ *   bitrate         bits per second
+ *   gap-min/-mean/-max
+ *                   time between buffers arriving, in ns
+ *   drift           how far the buffers' running time is ahead of the
+ *                   clock's, in ns; it falls when upstream can't keep up
+ *   drift-change    how much that moved since the previous message
+ *   downstream-mean/-max
+ *                   time spent pushing each buffer on, in ns, which is
+ *                   how long everything after us took, or blocked
+ *
+ *   gst-launch-1.0 -m videotestsrc ! perfprobe ! videoconvert ! ...
+ *
+ * It only works in push mode. In front of a demuxer that would rather
+ * pull, like oggdemux after filesrc, the demuxer gets pushed to.
+ */
+#include "gstperfprobe.h"
+
+GST_DEBUG_CATEGORY_STATIC (perf_probe_debug);
+#define GST_CAT_DEFAULT perf_probe_debug
+
+#define DEFAULT_INTERVAL 1000
+
+enum
+{
+  PROP_0,
+  PROP_INTERVAL
+};
+
+struct _GstPerfProbe
+{
+  GstElement parent;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* Under the object lock */
+  guint interval;
+
+  /* Only touched from the streaming thread */
+  GstSegment segment;
+  gint64 window_start;
+  gint64 last_arrival;
+  guint64 buffers;
+  guint64 bytes;
+  guint64 gaps;
+  GstClockTime gap_sum;
+  GstClockTime gap_min;
+  GstClockTime gap_max;
+  GstClockTime downstream_sum;
+  GstClockTime downstream_max;
+  GstClockTimeDiff drift;
+  GstClockTimeDiff last_drift;
+  gboolean have_drift;
+  gboolean have_last_drift;
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+#define gst_perf_probe_parent_class parent_class
+G_DEFINE_TYPE (GstPerfProbe, gst_perf_probe, GST_TYPE_ELEMENT);
+
+static void
+gst_perf_probe_reset_window (GstPerfProbe * self, gint64 now)
+{
+  self->window_start = now;
+  self->buffers = self->bytes = self->gaps = 0;
+  self->gap_sum = self->gap_max = self->downstream_sum =
+      self->downstream_max = 0;
+  self->gap_min = GST_CLOCK_TIME_NONE;
+}
+
+static void
+gst_perf_probe_post (GstPerfProbe * self, gint64 now)
+{
+  gdouble seconds = (now - self->window_start) / (gdouble) G_USEC_PER_SEC;
+  GstStructure *s;
+
+  s = gst_structure_new ("perfprobe",
+      "buffer-rate", G_TYPE_DOUBLE, self->buffers / seconds,
+      "bitrate", G_TYPE_DOUBLE, self->bytes * 8 / seconds,
+      "gap-min", G_TYPE_UINT64, self->gaps ? self->gap_min : 0,
+      "gap-mean", G_TYPE_UINT64, self->gaps ? self->gap_sum / self->gaps : 0,
+      "gap-max", G_TYPE_UINT64, self->gap_max,
+      "downstream-mean", G_TYPE_UINT64, self->buffers ?
+      self->downstream_sum / self->buffers : 0,
+      "downstream-max", G_TYPE_UINT64, self->downstream_max, NULL);
+
+  if (self->have_drift) {
+    gst_structure_set (s, "drift", G_TYPE_INT64, self->drift,
+        "drift-change", G_TYPE_INT64, self->have_last_drift ?
+        self->drift - self->last_drift : (gint64) 0, NULL);
+    self->last_drift = self->drift;
+    self->have_last_drift = TRUE;
+  }
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self), s));
+}
+
+/* Running time of the buffer against running time of the clock */
+static void
+gst_perf_probe_update_drift (GstPerfProbe * self, GstBuffer * buf)
+{
+  GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buf), running_time, now;
+  GstClock *clock;
+
+  if (!GST_CLOCK_TIME_IS_VALID (ts) || self->segment.format != GST_FORMAT_TIME)
+    return;
+  running_time = gst_segment_to_running_time (&self->segment,
+      GST_FORMAT_TIME, ts);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (clock == NULL)
+    return;
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+
+  self->drift = GST_CLOCK_DIFF (now - gst_element_get_base_time (GST_ELEMENT
+          (self)), running_time);
+  self->have_drift = TRUE;
+}
+
+static GstFlowReturn
+gst_perf_probe_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstPerfProbe *self = GST_PERF_PROBE (parent);
+  gint64 now = g_get_monotonic_time (), interval, done;
+  GstClockTime gap, downstream;
+  GstFlowReturn ret;
+
+  if (self->window_start == 0)
+    gst_perf_probe_reset_window (self, now);
+
+  if (self->last_arrival) {
+    gap = (now - self->last_arrival) * GST_USECOND;
+    self->gap_sum += gap;
+    self->gap_max = MAX (self->gap_max, gap);
+    if (!GST_CLOCK_TIME_IS_VALID (self->gap_min) || gap < self->gap_min)
+      self->gap_min = gap;
+    self->gaps++;
+  }
+  self->last_arrival = now;
+  self->buffers++;
+  self->bytes += gst_buffer_get_size (buf);
+  gst_perf_probe_update_drift (self, buf);
+
+  ret = gst_pad_push (self->srcpad, buf);
+
+  done = g_get_monotonic_time ();
+  downstream = (done - now) * GST_USECOND;
+  self->downstream_sum += downstream;
+  self->downstream_max = MAX (self->downstream_max, downstream);
+
+  GST_OBJECT_LOCK (self);
+  interval = self->interval * G_TIME_SPAN_MILLISECOND;
+  GST_OBJECT_UNLOCK (self);
+
+  if (interval > 0 && done - self->window_start >= interval) {
+    gst_perf_probe_post (self, done);
+    gst_perf_probe_reset_window (self, done);
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_perf_probe_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstPerfProbe *self = GST_PERF_PROBE (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &self->segment);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* Don't count the time it took to seek as a gap */
+      self->last_arrival = 0;
+      self->have_last_drift = FALSE;
+      gst_segment_init (&self->segment, GST_FORMAT_UNDEFINED);
+      break;
+    default:
+      break;
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static GstStateChangeReturn
+gst_perf_probe_change_state (GstElement * element, GstStateChange transition)
+{
+  GstPerfProbe *self = GST_PERF_PROBE (element);
+
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    gst_segment_init (&self->segment, GST_FORMAT_UNDEFINED);
+    self->window_start = self->last_arrival = 0;
+    self->have_drift = self->have_last_drift = FALSE;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_perf_probe_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstPerfProbe *self = GST_PERF_PROBE (object);
+
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      self->interval = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_perf_probe_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstPerfProbe *self = GST_PERF_PROBE (object);
+
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->interval);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_perf_probe_class_init (GstPerfProbeClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->set_property = gst_perf_probe_set_property;
+  gobject_class->get_property = gst_perf_probe_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_INTERVAL,
+      g_param_spec_uint ("interval", "Interval",
+          "How often to post measurements, in ms (0 = never)", 0, G_MAXUINT,
+          DEFAULT_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state = gst_perf_probe_change_state;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Performance probe", "Generic",
+      "Measures buffer rate, bitrate, gaps, drift and downstream time",
+      "GStreamer tutorial");
+
+  GST_DEBUG_CATEGORY_INIT (perf_probe_debug, "perfprobe", 0,
+      "Performance probe");
+}
+
+static void
+gst_perf_probe_init (GstPerfProbe * self)
+{
+  self->interval = DEFAULT_INTERVAL;
+  gst_segment_init (&self->segment, GST_FORMAT_UNDEFINED);
+
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_perf_probe_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_perf_probe_sink_event));
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+}
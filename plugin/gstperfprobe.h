@@ -0,0 +1,13 @@
+#ifndef __GST_PERF_PROBE_H__
+#define __GST_PERF_PROBE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_PERF_PROBE (gst_perf_probe_get_type ())
+G_DECLARE_FINAL_TYPE (GstPerfProbe, gst_perf_probe, GST, PERF_PROBE,
+    GstElement)
+
+G_END_DECLS
+#endif /* __GST_PERF_PROBE_H__ */
@@ -0,0 +1,29 @@
+/* Elements used by the tutorial tools. Build with make, then point
+ * GStreamer at this directory:
+ *
+ *   GST_PLUGIN_PATH=plugin gst-inspect-1.0 tutorial
+ */
+#include <gst/gst.h>
+
+#include "gstnetimpair.h"
+#include "gstconvolve.h"
+#include "gstperfprobe.h"
+
+#ifndef PACKAGE
+#define PACKAGE "gst-tutorial-lca2018"
+#endif
+
+static gboolean
+plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, "netimpair", GST_RANK_NONE,
+      GST_TYPE_NET_IMPAIR) &&
+      gst_element_register (plugin, "convolve", GST_RANK_NONE,
+      GST_TYPE_CONVOLVE) &&
+      gst_element_register (plugin, "perfprobe", GST_RANK_NONE,
+      GST_TYPE_PERF_PROBE);
+}
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR, GST_VERSION_MINOR, tutorial,
+    "Elements for the GStreamer tutorial tools", plugin_init, "1.0", "LGPL",
+    PACKAGE, "https://github.com/thaytan/gst-tutorial-lca2018")
@@ -0,0 +1,196 @@
+/* CPU cost of resampling between 44.1 and 48kHz with each of the
+ * audio quality profiles, on the audio of cooldance.ogg. Only the time
+ * spent inside the measured audioresample counts, not decoding or
+ * getting the audio to the input rate. It's the CPU time of the
+ * streaming thread, which runs the element from one probe to the
+ * other, so time the thread spends preempted doesn't count.
+ *
+ *   ./resample-bench -r 10
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include "audio-quality.h"
+
+static gint passes = 5;
+static gchar *file = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"passes", 'r', 0, G_OPTION_ARG_INT, &passes,
+      "Times to run through the file for each measurement (default: 5)",
+      "N"},
+  {"file", 'f', 0, G_OPTION_ARG_FILENAME, &file,
+      "Ogg Vorbis file to take the audio from (default: cooldance.ogg)",
+      "FILE"},
+  {NULL}
+};
+
+static const struct
+{
+  gint in_rate;
+  gint out_rate;
+} conversions[] = {
+  {44100, 48000},
+  {48000, 44100},
+};
+
+typedef struct
+{
+  gint64 entered;
+  gint64 total;
+  guint64 frames;
+  gint bpf;
+  gint channels;
+} ResampleTime;
+
+/* In nanoseconds, a buffer only takes a few microseconds */
+static gint64
+thread_cpu_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return GST_TIMESPEC_TO_TIME (ts);
+}
+
+static GstPadProbeReturn
+resample_in_probe (GstPad * pad, GstPadProbeInfo * info, ResampleTime * t)
+{
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (t->bpf == 0) {
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+    GstAudioInfo ainfo;
+
+    if (caps && gst_audio_info_from_caps (&ainfo, caps)) {
+      t->bpf = GST_AUDIO_INFO_BPF (&ainfo);
+      t->channels = GST_AUDIO_INFO_CHANNELS (&ainfo);
+    }
+    if (caps)
+      gst_caps_unref (caps);
+  }
+  if (t->bpf)
+    t->frames += gst_buffer_get_size (buf) / t->bpf;
+
+  t->entered = thread_cpu_time ();
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+resample_out_probe (GstPad * pad, GstPadProbeInfo * info, ResampleTime * t)
+{
+  t->total += thread_cpu_time () - t->entered;
+  return GST_PAD_PROBE_OK;
+}
+
+/* One pass through the file, adding to @t */
+static gboolean
+run (const AudioQualityProfile * profile, gint in_rate, gint out_rate,
+    ResampleTime * t)
+{
+  GstElement *pipeline, *resample;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  GError *err = NULL;
+  gchar *desc;
+  gboolean ok;
+
+  desc = g_strdup_printf ("filesrc location=%s ! oggdemux ! vorbisdec ! "
+      "audioconvert ! audioresample ! audio/x-raw,format=F32LE,rate=%d ! "
+      "audioresample name=r ! audio/x-raw,rate=%d ! fakesink", file, in_rate,
+      out_rate);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (pipeline == NULL) {
+    g_printerr ("Could not create pipeline: %s\n", err->message);
+    exit (1);
+  }
+
+  resample = gst_bin_get_by_name (GST_BIN (pipeline), "r");
+  audio_quality_profile_apply (profile, resample);
+  pad = gst_element_get_static_pad (resample, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) resample_in_probe, t, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (resample, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) resample_out_probe, t, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (resample);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  guint c, p;
+  gint i;
+
+  opt_ctx = g_option_context_new ("- Benchmark the audio quality profiles");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (file == NULL)
+    file = g_strdup ("cooldance.ogg");
+  passes = MAX (passes, 1);
+
+  g_print ("%s, %d passes\n", file, passes);
+  g_print ("  %-10s %-14s %14s %12s %12s\n", "profile", "conversion",
+      "CPU ms/s audio", "x realtime", "Msamples/s");
+  for (c = 0; c < G_N_ELEMENTS (conversions); c++) {
+    for (p = 0; audio_quality_profile_names[p]; p++) {
+      const AudioQualityProfile *profile =
+          audio_quality_profile_find (audio_quality_profile_names[p]);
+      ResampleTime t = { 0, };
+      gdouble audio_seconds, cpu_seconds;
+      gchar *conversion;
+
+      for (i = 0; i < passes; i++) {
+        if (!run (profile, conversions[c].in_rate, conversions[c].out_rate,
+                &t))
+          break;
+      }
+      if (i < passes || t.frames == 0 || t.total == 0) {
+        g_print ("  %-10s failed\n", profile->name);
+        continue;
+      }
+
+      audio_seconds = (gdouble) t.frames / conversions[c].in_rate;
+      cpu_seconds = (gdouble) t.total / GST_SECOND;
+      conversion = g_strdup_printf ("%.1f->%.1fkHz",
+          conversions[c].in_rate / 1000.0, conversions[c].out_rate / 1000.0);
+      g_print ("  %-10s %-14s %14.3f %12.1f %12.2f\n", profile->name,
+          conversion, cpu_seconds * 1000 / audio_seconds,
+          audio_seconds / cpu_seconds,
+          t.frames * t.channels / cpu_seconds / 1e6);
+      g_free (conversion);
+    }
+  }
+
+  g_free (file);
+
+  return 0;
+}
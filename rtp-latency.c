@@ -0,0 +1,595 @@
+/* Glass-to-glass latency of the RTP MPEG-2 video path from
+ * command-lines.txt, sender and receiver in one process on loopback so
+ * they share a clock:
+ *
+ *   videotestsrc ! avenc_mpeg2video ! mpegvideoparse ! rtpmpvpay ! udpsink
+ *   udpsrc ! rtpjitterbuffer ! rtpmpvdepay ! avdec_mpeg2video ! videosink
+ *
+ * The sender stamps when each frame was captured and when it came out
+ * of the encoder into an RTP header extension on every packet. The
+ * receiver adds when the frame arrived, left the jitterbuffer, was
+ * decoded and reached the sink, and breaks the latency down per frame.
+ *
+ *   ./rtp-latency -l 50 -e "avenc_mpeg2video bitrate=2000000 gop-size=15"
+ *
+ * With the netimpair element from plugin/ the loopback can be made to
+ * behave like a real network, to see what the jitterbuffer copes with:
+ *
+ *   GST_PLUGIN_PATH=plugin ./rtp-latency -i "loss=1 delay=30 jitter=10"
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+/* One-byte RTP header extension we put our timestamps in */
+#define STAMP_EXT_ID 1
+#define RING_SIZE 256
+
+static gint port = 5004;
+static gint jb_latency = 200;
+static gint num_frames = 300;
+static gchar *encoder = NULL;
+static gchar *decoder = NULL;
+static gchar *video_caps = NULL;
+static gchar *impair = NULL;
+static gboolean no_display = FALSE;
+static gboolean verbose = FALSE;
+
+static GOptionEntry opt_entries[] = {
+  {"port", 'p', 0, G_OPTION_ARG_INT, &port,
+      "UDP port on the loopback (default: 5004)", "PORT"},
+  {"latency", 'l', 0, G_OPTION_ARG_INT, &jb_latency,
+      "rtpjitterbuffer latency in ms (default: 200)", "MS"},
+  {"num-frames", 'n', 0, G_OPTION_ARG_INT, &num_frames,
+      "Number of frames to send (default: 300)", "N"},
+  {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder,
+      "Encoder and its settings (default: avenc_mpeg2video)", "DESC"},
+  {"decoder", 'd', 0, G_OPTION_ARG_STRING, &decoder,
+      "Decoder (default: avdec_mpeg2video)", "DESC"},
+  {"caps", 'c', 0, G_OPTION_ARG_STRING, &video_caps,
+      "Video to capture (default: video/x-raw,width=640,height=480,"
+        "framerate=30/1)", "CAPS"},
+  {"impair", 'i', 0, G_OPTION_ARG_STRING, &impair,
+      "Pass the packets through netimpair with these properties", "PROPS"},
+  {"no-display", 0, 0, G_OPTION_ARG_NONE, &no_display,
+      "Don't show the video, end in a fakesink", NULL},
+  {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+      "Print the breakdown of every frame", NULL},
+  {NULL}
+};
+
+/* Everything we know about one frame, all clock times */
+typedef struct
+{
+  gboolean used;
+  GstClockTime pts;
+  guint32 rtp_time;
+  GstClockTime capture;
+  GstClockTime encoded;
+  GstClockTime arrival;
+  GstClockTime jb_out;
+  GstClockTime decoded;
+} FrameTimes;
+
+typedef struct
+{
+  guint64 count;
+  GstClockTimeDiff min;
+  GstClockTimeDiff max;
+  GstClockTimeDiff sum;
+} LatencyStats;
+
+enum
+{
+  STAGE_ENCODE,
+  STAGE_NETWORK,
+  STAGE_JITTERBUFFER,
+  STAGE_DECODE,
+  STAGE_DISPLAY,
+  STAGE_TOTAL,
+  N_STAGES
+};
+
+static const gchar *stage_names[N_STAGES] = {
+  "encode", "network", "jitterbuffer", "decode", "display", "total"
+};
+
+typedef struct
+{
+  GMainLoop *loop;
+  GstClock *clock;
+  GstElement *sender;
+  GstElement *receiver;
+
+  /* The probes run on the streaming threads */
+  GMutex lock;
+  FrameTimes sent[RING_SIZE];
+  FrameTimes received[RING_SIZE];
+  guint next_received;
+  LatencyStats stats[N_STAGES];
+  guint frames;
+} GlobalData;
+
+static GstElement *
+create_pipeline (const gchar * desc)
+{
+  GstElement *pipeline;
+  GError *err = NULL;
+
+  pipeline = gst_parse_launch (desc, &err);
+  if (pipeline == NULL) {
+    g_print ("Failed to create pipeline '%s': %s\n", desc, err->message);
+    exit (1);
+  }
+
+  return pipeline;
+}
+
+static FrameTimes *
+frame_by_pts (FrameTimes * ring, GstClockTime pts, gboolean create)
+{
+  FrameTimes *frame;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return NULL;
+
+  frame = &ring[(pts / GST_MSECOND) % RING_SIZE];
+  if (frame->used && frame->pts == pts)
+    return frame;
+  if (!create)
+    return NULL;
+
+  memset (frame, 0, sizeof (FrameTimes));
+  frame->used = TRUE;
+  frame->pts = pts;
+  frame->capture = frame->encoded = frame->arrival = frame->jb_out =
+      frame->decoded = GST_CLOCK_TIME_NONE;
+
+  return frame;
+}
+
+static FrameTimes *
+frame_by_rtp_time (FrameTimes * ring, guint32 rtp_time)
+{
+  guint i;
+
+  for (i = 0; i < RING_SIZE; i++)
+    if (ring[i].used && ring[i].rtp_time == rtp_time)
+      return &ring[i];
+
+  return NULL;
+}
+
+static void
+latency_stats_add (LatencyStats * stats, GstClockTimeDiff value)
+{
+  if (stats->count == 0 || value < stats->min)
+    stats->min = value;
+  if (stats->count == 0 || value > stats->max)
+    stats->max = value;
+  stats->sum += value;
+  stats->count++;
+}
+
+static void
+print_stats (GlobalData * data)
+{
+  guint i;
+
+  g_print ("\nLatency over %u frames (jitterbuffer latency %d ms):\n",
+      data->frames, jb_latency);
+  for (i = 0; i < N_STAGES; i++) {
+    LatencyStats *stats = &data->stats[i];
+
+    if (stats->count == 0)
+      continue;
+    g_print ("  %-12s mean %7.2f ms  min %7.2f ms  max %7.2f ms\n",
+        stage_names[i], (gdouble) stats->sum / stats->count / GST_MSECOND,
+        (gdouble) stats->min / GST_MSECOND, (gdouble) stats->max /
+        GST_MSECOND);
+  }
+}
+
+/* Sender side */
+
+static GstPadProbeReturn
+capture_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  FrameTimes *frame;
+
+  g_mutex_lock (&data->lock);
+  frame = frame_by_pts (data->sent, GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER
+          (info)), TRUE);
+  if (frame)
+    frame->capture = now;
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+encoded_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  FrameTimes *frame;
+
+  g_mutex_lock (&data->lock);
+  frame = frame_by_pts (data->sent, GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER
+          (info)), FALSE);
+  if (frame && !GST_CLOCK_TIME_IS_VALID (frame->encoded))
+    frame->encoded = now;
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Put the capture and encode times of the frame @packet belongs to
+ * into the packet */
+static gboolean
+stamp_packet (GstBuffer ** packet, guint idx, GlobalData * data)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  FrameTimes *frame;
+  guint64 stamp[2] = { 0, };
+
+  g_mutex_lock (&data->lock);
+  frame = frame_by_pts (data->sent, GST_BUFFER_PTS (*packet), FALSE);
+  if (frame) {
+    stamp[0] = GUINT64_TO_BE (frame->capture);
+    stamp[1] = GUINT64_TO_BE (frame->encoded);
+  }
+  g_mutex_unlock (&data->lock);
+
+  if (frame == NULL)
+    return TRUE;
+
+  *packet = gst_buffer_make_writable (*packet);
+  if (gst_rtp_buffer_map (*packet, GST_MAP_READWRITE, &rtp)) {
+    gst_rtp_buffer_add_extension_onebyte_header (&rtp, STAMP_EXT_ID, stamp,
+        sizeof (stamp));
+    gst_rtp_buffer_unmap (&rtp);
+  }
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+payload_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    list = gst_buffer_list_make_writable (list);
+    gst_buffer_list_foreach (list, (GstBufferListFunc) stamp_packet, data);
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+  } else {
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    stamp_packet (&buf, 0, data);
+    GST_PAD_PROBE_INFO_DATA (info) = buf;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Receiver side */
+
+static GstPadProbeReturn
+arrival_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  FrameTimes *frame;
+  gpointer ext;
+  guint size;
+  guint64 stamp[2];
+  guint32 rtp_time;
+
+  if (!gst_rtp_buffer_map (buf, GST_MAP_READ, &rtp))
+    return GST_PAD_PROBE_OK;
+  rtp_time = gst_rtp_buffer_get_timestamp (&rtp);
+  if (!gst_rtp_buffer_get_extension_onebyte_header (&rtp, STAMP_EXT_ID, 0,
+          &ext, &size) || size != sizeof (stamp)) {
+    gst_rtp_buffer_unmap (&rtp);
+    return GST_PAD_PROBE_OK;
+  }
+  memcpy (stamp, ext, sizeof (stamp));
+  gst_rtp_buffer_unmap (&rtp);
+
+  /* The first packet of each frame starts its record, the PTS comes
+   * from the jitterbuffer */
+  g_mutex_lock (&data->lock);
+  if (frame_by_rtp_time (data->received, rtp_time) == NULL) {
+    frame = &data->received[data->next_received++ % RING_SIZE];
+    frame->used = TRUE;
+    frame->pts = GST_CLOCK_TIME_NONE;
+    frame->rtp_time = rtp_time;
+    frame->capture = GUINT64_FROM_BE (stamp[0]);
+    frame->encoded = GUINT64_FROM_BE (stamp[1]);
+    frame->arrival = now;
+    frame->jb_out = frame->decoded = GST_CLOCK_TIME_NONE;
+  }
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+jitterbuffer_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  FrameTimes *frame;
+  guint32 rtp_time;
+
+  if (!gst_rtp_buffer_map (buf, GST_MAP_READ, &rtp))
+    return GST_PAD_PROBE_OK;
+  rtp_time = gst_rtp_buffer_get_timestamp (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  /* From here on the frame goes by the PTS the jitterbuffer gave it */
+  g_mutex_lock (&data->lock);
+  frame = frame_by_rtp_time (data->received, rtp_time);
+  if (frame && !GST_CLOCK_TIME_IS_VALID (frame->jb_out)) {
+    frame->jb_out = now;
+    frame->pts = GST_BUFFER_PTS (buf);
+  }
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static FrameTimes *
+received_by_pts (GlobalData * data, GstClockTime pts)
+{
+  guint i;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return NULL;
+
+  for (i = 0; i < RING_SIZE; i++)
+    if (data->received[i].used && data->received[i].pts == pts)
+      return &data->received[i];
+
+  return NULL;
+}
+
+static GstPadProbeReturn
+decoded_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  FrameTimes *frame;
+
+  g_mutex_lock (&data->lock);
+  frame = received_by_pts (data, GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER
+          (info)));
+  if (frame)
+    frame->decoded = now;
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* The frame made it to the sink, account for it */
+static GstPadProbeReturn
+display_probe (GstPad * pad, GstPadProbeInfo * info, GlobalData * data)
+{
+  GstClockTime now = gst_clock_get_time (data->clock);
+  GstClockTimeDiff stages[N_STAGES];
+  GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  FrameTimes *frame;
+  guint i;
+
+  g_mutex_lock (&data->lock);
+  frame = received_by_pts (data, pts);
+  if (frame == NULL || !GST_CLOCK_TIME_IS_VALID (frame->decoded) ||
+      !GST_CLOCK_TIME_IS_VALID (frame->jb_out)) {
+    g_mutex_unlock (&data->lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  stages[STAGE_ENCODE] = GST_CLOCK_DIFF (frame->capture, frame->encoded);
+  stages[STAGE_NETWORK] = GST_CLOCK_DIFF (frame->encoded, frame->arrival);
+  stages[STAGE_JITTERBUFFER] = GST_CLOCK_DIFF (frame->arrival, frame->jb_out);
+  stages[STAGE_DECODE] = GST_CLOCK_DIFF (frame->jb_out, frame->decoded);
+  stages[STAGE_DISPLAY] = GST_CLOCK_DIFF (frame->decoded, now);
+  stages[STAGE_TOTAL] = GST_CLOCK_DIFF (frame->capture, now);
+  for (i = 0; i < N_STAGES; i++)
+    latency_stats_add (&data->stats[i], stages[i]);
+  data->frames++;
+  frame->used = FALSE;
+  g_mutex_unlock (&data->lock);
+
+  if (verbose) {
+    g_print ("Frame %" GST_TIME_FORMAT ":", GST_TIME_ARGS (pts));
+    for (i = 0; i < N_STAGES; i++)
+      g_print (" %s %.2f", stage_names[i], (gdouble) stages[i] / GST_MSECOND);
+    g_print (" ms\n");
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_probe (GstElement * pipeline, const gchar * element, const gchar * pad,
+    GstPadProbeType type, GstPadProbeCallback callback, GlobalData * data)
+{
+  GstElement *e;
+  GstPad *p;
+
+  e = gst_bin_get_by_name (GST_BIN (pipeline), element);
+  p = gst_element_get_static_pad (e, pad);
+  gst_pad_add_probe (p, type, callback, data, NULL);
+  gst_object_unref (p);
+  gst_object_unref (e);
+}
+
+static void
+print_impair_stats (GstElement * pipeline)
+{
+  GstElement *e = gst_bin_get_by_name (GST_BIN (pipeline), "impair");
+  GstStructure *s;
+  guint64 forwarded = 0, dropped = 0, reordered = 0;
+
+  g_object_get (e, "stats", &s, NULL);
+  gst_structure_get_uint64 (s, "forwarded", &forwarded);
+  gst_structure_get_uint64 (s, "dropped", &dropped);
+  gst_structure_get_uint64 (s, "reordered", &reordered);
+  gst_structure_free (s);
+  gst_object_unref (e);
+
+  g_print ("Network: %" G_GUINT64_FORMAT " packets delivered, %"
+      G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " reordered\n",
+      forwarded, dropped, reordered);
+}
+
+static gboolean
+stop_receiver (GlobalData * data)
+{
+  g_main_loop_quit (data->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+handle_bus_msg (GstBus * bus, GstMessage * msg, GlobalData * data)
+{
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:{
+      /* The sender is done, give the last frames time to come out of
+       * the jitterbuffer */
+      g_timeout_add (jb_latency + 500, (GSourceFunc) stop_receiver, data);
+      break;
+    }
+    case GST_MESSAGE_ERROR:{
+      GError *err = NULL;
+      gchar *dbg_info = NULL;
+
+      gst_message_parse_error (msg, &err, &dbg_info);
+      g_printerr ("ERROR from element %s: %s\n",
+          GST_OBJECT_NAME (msg->src), err->message);
+      g_printerr ("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+      g_print ("Exiting.\n");
+      g_error_free (err);
+      g_free (dbg_info);
+
+      g_main_loop_quit (data->loop);
+      break;
+    }
+    default:
+      /* Ignore messages we don't know about */
+      break;
+  }
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  GlobalData data = { 0, };
+  GstBus *bus;
+  guint sender_watch, receiver_watch;
+  gchar *desc;
+
+  opt_ctx = g_option_context_new ("- RTP MPEG-2 video latency meter");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (encoder == NULL)
+    encoder = g_strdup ("avenc_mpeg2video");
+  if (decoder == NULL)
+    decoder = g_strdup ("avdec_mpeg2video");
+  if (video_caps == NULL)
+    video_caps = g_strdup ("video/x-raw,width=640,height=480,framerate=30/1");
+
+  g_mutex_init (&data.lock);
+
+  desc = g_strdup_printf ("videotestsrc name=src is-live=true num-buffers=%d "
+      "! %s ! videoconvert ! %s name=enc ! mpegvideoparse ! "
+      "rtpmpvpay name=pay ! udpsink host=127.0.0.1 port=%d sync=false",
+      num_frames, video_caps, encoder, port);
+  data.sender = create_pipeline (desc);
+  g_free (desc);
+
+  desc = g_strdup_printf ("udpsrc port=%d caps=\"application/"
+      "x-rtp,media=video,clock-rate=90000,encoding-name=MPV,payload=32\" ! "
+      "%s%s%s rtpjitterbuffer name=jb latency=%d ! rtpmpvdepay ! "
+      "mpegvideoparse ! %s name=dec ! videoconvert ! %s name=sink sync=false",
+      port, impair ? "netimpair name=impair " : "", impair ? impair : "",
+      impair ? " !" : "", jb_latency, decoder,
+      no_display ? "fakesink" : "autovideosink");
+  data.receiver = create_pipeline (desc);
+  g_free (desc);
+
+  /* Both ends on one clock, so their times can be compared directly */
+  data.clock = gst_system_clock_obtain ();
+  gst_pipeline_use_clock (GST_PIPELINE (data.sender), data.clock);
+  gst_pipeline_use_clock (GST_PIPELINE (data.receiver), data.clock);
+
+  add_probe (data.sender, "src", "src", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) capture_probe, &data);
+  add_probe (data.sender, "enc", "src", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) encoded_probe, &data);
+  add_probe (data.sender, "pay", "src", GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_BUFFER_LIST, (GstPadProbeCallback) payload_probe,
+      &data);
+  /* Packets "arrive" once through the impaired network, if any */
+  add_probe (data.receiver, "jb", "sink", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) arrival_probe, &data);
+  add_probe (data.receiver, "jb", "src", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) jitterbuffer_probe, &data);
+  add_probe (data.receiver, "dec", "src", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) decoded_probe, &data);
+  add_probe (data.receiver, "sink", "sink", GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) display_probe, &data);
+
+  bus = gst_element_get_bus (data.sender);
+  sender_watch = gst_bus_add_watch (bus, (GstBusFunc) handle_bus_msg, &data);
+  gst_object_unref (bus);
+  bus = gst_element_get_bus (data.receiver);
+  receiver_watch = gst_bus_add_watch (bus, (GstBusFunc) handle_bus_msg,
+      &data);
+  gst_object_unref (bus);
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+
+  /* The receiver has to be listening before anything is sent */
+  gst_element_set_state (data.receiver, GST_STATE_PLAYING);
+  gst_element_set_state (data.sender, GST_STATE_PLAYING);
+  g_print ("Sending %d frames through %s on port %d\n", num_frames, encoder,
+      port);
+
+  g_main_loop_run (data.loop);
+
+  print_stats (&data);
+  if (impair)
+    print_impair_stats (data.receiver);
+
+  /* Clean everything up before exiting */
+  g_source_remove (sender_watch);
+  g_source_remove (receiver_watch);
+  gst_element_set_state (data.sender, GST_STATE_NULL);
+  gst_element_set_state (data.receiver, GST_STATE_NULL);
+  gst_object_unref (data.sender);
+  gst_object_unref (data.receiver);
+  gst_object_unref (data.clock);
+  g_main_loop_unref (data.loop);
+  g_mutex_clear (&data.lock);
+  g_free (encoder);
+  g_free (decoder);
+  g_free (video_caps);
+  g_free (impair);
+
+  return 0;
+}
@@ -0,0 +1,357 @@
+/* Finds the scene cuts in a file and prints a shot list, as fast as the
+ * file can be decoded rather than in real time. Frames are scaled down
+ * to greyscale first, then compared with the previous one by mean
+ * pixel difference and by luma histogram. A cut needs both, since
+ * either alone is fooled by fades, camera moves or flashes.
+ *
+ * With --keyframes, it seeks from keyframe to keyframe and decodes only
+ * those. Cuts are then only placed to the keyframe at or after them,
+ * but encoders tend to put a keyframe on a cut anyway.
+ *
+ *   ./scene-detect big-buck-bunny_trailer.webm
+ *   ./scene-detect --keyframes -w 160 long-recording.mkv
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "frame-diff.h"
+
+static gint width = 320;
+static gdouble threshold = 0.3;
+static gdouble min_diff = 10;
+static gdouble min_shot = 0.5;
+static gboolean keyframes = FALSE;
+static gchar *impl_name = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"width", 'w', 0, G_OPTION_ARG_INT, &width,
+      "Width to scale frames to before comparing, 0 for the file's "
+        "(default: 320)", "PIXELS"},
+  {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold,
+      "Histogram change for a cut, from 0 to 1 (default: 0.3)", "T"},
+  {"min-diff", 'd', 0, G_OPTION_ARG_DOUBLE, &min_diff,
+      "Mean pixel difference for a cut, from 0 to 255 (default: 10)", "D"},
+  {"min-shot", 's', 0, G_OPTION_ARG_DOUBLE, &min_shot,
+      "Shortest shot in seconds (default: 0.5)", "SECONDS"},
+  {"keyframes", 'k', 0, G_OPTION_ARG_NONE, &keyframes,
+      "Only decode keyframes, seeking from one to the next", NULL},
+  {"implementation", 'i', 0, G_OPTION_ARG_STRING, &impl_name,
+      "Frame difference code: auto, scalar, sse2, avx2 or neon "
+        "(default: auto)", "NAME"},
+  {NULL}
+};
+
+typedef struct
+{
+  FrameDiffImpl impl;
+
+  /* The previous frame's luma, packed */
+  guint8 *prev;
+  gint prev_width;
+  gint prev_height;
+  guint32 prev_hist[FRAME_DIFF_BINS];
+
+  guint frames;
+  gint64 analysis_time;
+
+  /* Start times of the shots */
+  GArray *cuts;
+  GstClockTime last_time;
+} Detector;
+
+/* Compares a frame with the previous one, and starts a new shot if
+ * it's different enough */
+static void
+analyse (Detector * d, GstSample * sample)
+{
+  GstSegment *segment = gst_sample_get_segment (sample);
+  GstBuffer *buf = gst_sample_get_buffer (sample);
+  guint32 hist[FRAME_DIFF_BINS];
+  GstVideoFrame frame;
+  GstVideoInfo vinfo;
+  GstClockTime time;
+  const guint8 *data;
+  gint w, h, stride, y;
+  gint64 start;
+
+  if (!gst_video_info_from_caps (&vinfo, gst_sample_get_caps (sample)) ||
+      !gst_video_frame_map (&frame, &vinfo, buf, GST_MAP_READ))
+    return;
+
+  time = gst_segment_to_stream_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buf));
+  data = GST_VIDEO_FRAME_COMP_DATA (&frame, 0);
+  stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
+  w = GST_VIDEO_FRAME_COMP_WIDTH (&frame, 0);
+  h = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, 0);
+
+  start = g_get_monotonic_time ();
+  frame_diff_histogram (data, stride, w, h, hist);
+
+  if (d->prev == NULL || w != d->prev_width || h != d->prev_height) {
+    /* The first frame, or a new size we can't compare with */
+    if (d->cuts->len == 0)
+      g_array_append_val (d->cuts, time);
+    g_free (d->prev);
+    d->prev = g_malloc (w * h);
+    d->prev_width = w;
+    d->prev_height = h;
+  } else {
+    gdouble mean_diff, hist_diff;
+
+    mean_diff = frame_diff_sad (d->impl, data, stride, d->prev, w, w, h) /
+        (gdouble) (w * h);
+    hist_diff = frame_diff_histogram_distance (hist, d->prev_hist,
+        (guint64) w * h);
+
+    if (hist_diff >= threshold && mean_diff >= min_diff &&
+        GST_CLOCK_TIME_IS_VALID (time)) {
+      GstClockTime shot_start = g_array_index (d->cuts, GstClockTime,
+          d->cuts->len - 1);
+
+      if (!GST_CLOCK_TIME_IS_VALID (shot_start) ||
+          time >= shot_start + min_shot * GST_SECOND)
+        g_array_append_val (d->cuts, time);
+    }
+  }
+
+  for (y = 0; y < h; y++)
+    memcpy (d->prev + y * w, data + y * stride, w);
+  memcpy (d->prev_hist, hist, sizeof (hist));
+  d->analysis_time += g_get_monotonic_time () - start;
+  d->frames++;
+
+  if (GST_CLOCK_TIME_IS_VALID (time)) {
+    time += GST_BUFFER_DURATION_IS_VALID (buf) ?
+        GST_BUFFER_DURATION (buf) : 0;
+    if (!GST_CLOCK_TIME_IS_VALID (d->last_time) || time > d->last_time)
+      d->last_time = time;
+  }
+
+  gst_video_frame_unmap (&frame);
+}
+
+/* Prints an error off the bus and returns TRUE, if there is one */
+static gboolean
+bus_error (GstElement * pipeline)
+{
+  GstMessage *msg;
+  GstBus *bus;
+  GError *err = NULL;
+  gchar *dbg_info = NULL;
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  gst_object_unref (bus);
+  if (msg == NULL)
+    return FALSE;
+
+  gst_message_parse_error (msg, &err, &dbg_info);
+  g_printerr ("ERROR from element %s: %s\n",
+      GST_OBJECT_NAME (msg->src), err->message);
+  g_printerr ("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+  g_error_free (err);
+  g_free (dbg_info);
+  gst_message_unref (msg);
+
+  return TRUE;
+}
+
+/* The next sample, or NULL at EOS or on an error */
+static GstSample *
+pull (GstElement * pipeline, GstAppSink * appsink)
+{
+  GstSample *sample;
+
+  while (TRUE) {
+    sample = gst_app_sink_try_pull_sample (appsink, 100 * GST_MSECOND);
+    if (sample || gst_app_sink_is_eos (appsink) || bus_error (pipeline))
+      return sample;
+  }
+}
+
+/* Waits for the pipeline to preroll, and returns the frame it prerolled
+ * on. In PAUSED, basesink holds on to an EOS before appsink sees it, so
+ * appsink never says it's EOS. The pipeline prerolls anyway, and
+ * prerolling without a frame is how we know */
+static GstSample *
+pull_preroll (GstElement * pipeline, GstAppSink * appsink)
+{
+  GstStateChangeReturn ret;
+
+  do {
+    ret = gst_element_get_state (pipeline, NULL, NULL, 100 * GST_MSECOND);
+    if (ret == GST_STATE_CHANGE_FAILURE || bus_error (pipeline))
+      return NULL;
+  } while (ret == GST_STATE_CHANGE_ASYNC);
+
+  return gst_app_sink_try_pull_preroll (appsink, 0);
+}
+
+static void
+decode_all (Detector * d, GstElement * pipeline, GstAppSink * appsink)
+{
+  GstSample *sample;
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  while ((sample = pull (pipeline, appsink))) {
+    analyse (d, sample);
+    gst_sample_unref (sample);
+  }
+}
+
+/* Stays in PAUSED and takes the preroll frame after every seek. The
+ * KEY_UNIT | SNAP_AFTER seek to just after the current keyframe lands
+ * on the next one, so nothing in between gets decoded */
+static void
+decode_keyframes (Detector * d, GstElement * pipeline, GstAppSink * appsink)
+{
+  GstClockTime pos, last = GST_CLOCK_TIME_NONE;
+  GstClockTime step = 1;
+  GstSample *sample;
+  gint64 duration = -1;
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  while ((sample = pull_preroll (pipeline, appsink))) {
+    GstBuffer *buf = gst_sample_get_buffer (sample);
+
+    if (duration < 0)
+      gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration);
+
+    pos = gst_segment_to_stream_time (gst_sample_get_segment (sample),
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buf));
+    if (!GST_CLOCK_TIME_IS_VALID (pos)) {
+      gst_sample_unref (sample);
+      break;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (last) && pos <= last) {
+      /* Some demuxers don't snap after, push further along */
+      step = MAX (step * 2, 100 * GST_MSECOND);
+      if (step > 60 * GST_SECOND) {
+        gst_sample_unref (sample);
+        break;
+      }
+    } else {
+      analyse (d, sample);
+      last = pos;
+      step = 1;
+    }
+    gst_sample_unref (sample);
+
+    /* Nothing more to find, and some demuxers won't even EOS */
+    if (duration > 0 && last + step >= duration)
+      break;
+
+    if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT |
+            GST_SEEK_FLAG_SNAP_AFTER, last + step))
+      break;
+  }
+}
+
+static void
+print_shots (Detector * d, GstElement * pipeline)
+{
+  GstClockTime start, end;
+  gint64 duration;
+  guint i;
+
+  if (gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration) &&
+      (!GST_CLOCK_TIME_IS_VALID (d->last_time) || duration > d->last_time))
+    d->last_time = duration;
+
+  g_print ("%5s  %-16s %-16s %10s\n", "shot", "start", "end", "seconds");
+  for (i = 0; i < d->cuts->len; i++) {
+    start = g_array_index (d->cuts, GstClockTime, i);
+    end = i + 1 < d->cuts->len ?
+        g_array_index (d->cuts, GstClockTime, i + 1) : d->last_time;
+    g_print ("%5u  %" GST_TIME_FORMAT "  %" GST_TIME_FORMAT " ", i + 1,
+        GST_TIME_ARGS (start), GST_TIME_ARGS (end));
+    if (GST_CLOCK_TIME_IS_VALID (start) && GST_CLOCK_TIME_IS_VALID (end))
+      g_print ("%10.3f\n", (gdouble) (end - start) / GST_SECOND);
+    else
+      g_print ("%10s\n", "?");
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_ctx;
+  GError *err = NULL;
+  GstElement *pipeline, *appsink;
+  Detector d = { 0, };
+  gchar *uri, *desc, *scale;
+  gint64 start;
+  gdouble seconds;
+
+  opt_ctx = g_option_context_new ("<file|uri> - Print a shot list");
+  g_option_context_add_main_entries (opt_ctx, opt_entries, NULL);
+  g_option_context_add_group (opt_ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (opt_ctx, &argc, &argv, &err))
+    g_error ("Error parsing options: %s", err->message);
+  g_option_context_free (opt_ctx);
+
+  if (argc < 2) {
+    g_print ("Usage: %s [--keyframes] [-w width] <file|uri>\n", argv[0]);
+    return 1;
+  }
+
+  d.impl = FRAME_DIFF_IMPL_AUTO;
+  if (impl_name && (!frame_diff_impl_from_string (impl_name, &d.impl) ||
+          !frame_diff_impl_supported (d.impl))) {
+    g_print ("Implementation %s isn't available here\n", impl_name);
+    return 1;
+  }
+
+  uri = gst_uri_is_valid (argv[1]) ? g_strdup (argv[1]) :
+      gst_filename_to_uri (argv[1], NULL);
+  /* Leaving the height open keeps the aspect ratio */
+  scale = width > 0 ? g_strdup_printf (",width=%d,pixel-aspect-ratio=1/1",
+      width) : g_strdup ("");
+  desc = g_strdup_printf ("uridecodebin uri=%s caps=video/x-raw "
+      "expose-all-streams=false ! videoconvert ! videoscale ! "
+      "video/x-raw,format=GRAY8%s ! appsink name=sink sync=false "
+      "max-buffers=2", uri, scale);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  g_free (scale);
+  if (pipeline == NULL) {
+    g_printerr ("Could not create pipeline: %s\n", err->message);
+    return 1;
+  }
+  appsink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  d.cuts = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  d.last_time = GST_CLOCK_TIME_NONE;
+
+  start = g_get_monotonic_time ();
+  if (keyframes)
+    decode_keyframes (&d, pipeline, GST_APP_SINK (appsink));
+  else
+    decode_all (&d, pipeline, GST_APP_SINK (appsink));
+  seconds = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+
+  print_shots (&d, pipeline);
+  g_print ("%u %s in %.2f s, %.1f frames/s, %.3f ms/frame comparing (%s)\n",
+      d.frames, keyframes ? "keyframes" : "frames", seconds,
+      d.frames / seconds, d.frames ?
+      d.analysis_time / 1000.0 / d.frames : 0.0,
+      frame_diff_impl_name (d.impl));
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (appsink);
+  gst_object_unref (pipeline);
+  g_array_free (d.cuts, TRUE);
+  g_free (d.prev);
+  g_free (impl_name);
+  g_free (uri);
+
+  return 0;
+}